@@ -0,0 +1,124 @@
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "asset_watcher.h"
+
+namespace {
+    std::string withoutTrailingSlashes(const char *directory) {
+        std::string path = directory;
+        while (path.size() > 1 && path[path.size()-1] == '/') {
+            path.erase(path.size()-1);
+        }
+        return path;
+    }
+}
+
+AssetWatcher::AssetWatcher(const char *directory, const char *excluded_directory) : watch_fd(-1) {
+    if (excluded_directory != NULL) {
+        this->excluded_directory = withoutTrailingSlashes(excluded_directory);
+    }
+
+#ifdef __linux__
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+        return;
+    }
+    watchDirectory(withoutTrailingSlashes(directory));
+#else
+    (void)directory;
+#endif
+}
+
+AssetWatcher::~AssetWatcher() {
+#ifdef __linux__
+    if (watch_fd >= 0) {
+        close(watch_fd);
+    }
+#endif
+}
+
+// inotify watches aren't recursive, so add one for every directory in the tree
+// but the excluded one
+void AssetWatcher::watchDirectory(const std::string &directory) {
+#ifdef __linux__
+    if (directory == excluded_directory) {
+        return;
+    }
+
+    // Saves show up as a close after writing, or as a rename over the old
+    // file for editors that write to a temporary first
+    int wd = inotify_add_watch(watch_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        return;
+    }
+    watch_directories[wd] = directory;
+
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string path = directory + "/" + entry->d_name;
+        struct stat path_stat;
+        if (stat(path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+            watchDirectory(path);
+        }
+    }
+    closedir(dir);
+#else
+    (void)directory;
+#endif
+}
+
+// Drain the pending inotify events without blocking
+void AssetWatcher::changedFiles(std::vector<std::string> &filenames) {
+    filenames.clear();
+
+#ifdef __linux__
+    if (watch_fd < 0) {
+        return;
+    }
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len) {
+            const struct inotify_event *event = (const struct inotify_event*)ptr;
+
+            std::map<int,std::string>::const_iterator dir_it = watch_directories.find(event->wd);
+            if (dir_it == watch_directories.end() || event->len == 0) {
+                continue;
+            }
+            std::string path = dir_it->second + "/" + event->name;
+
+            // Start watching new directories; plain creations are followed by a close
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watchDirectory(path);
+                }
+                continue;
+            }
+            if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                continue;
+            }
+
+            // A save can produce several events, so only report each file once
+            if (std::find(filenames.begin(), filenames.end(), path) == filenames.end()) {
+                filenames.push_back(path);
+            }
+        }
+    }
+#endif
+}
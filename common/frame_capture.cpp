@@ -0,0 +1,245 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "lodepng.h"
+
+#include "frame_capture.h"
+
+FrameCapture::FrameCapture(const char *filename_pattern, unsigned thread_count, unsigned ring_size, size_t max_queued) :
+        filename_pattern(filename_pattern), max_queued(max_queued), oldest_slot(0), in_flight(0), frame_count(0),
+        encoding_count(0), written_count(0), dropped_count(0), stopping(false) {
+    // A frame has to be read before it's mapped, so there are at least two buffers
+    if (ring_size < 2) {
+        ring_size = 2;
+    }
+    if (this->max_queued == 0) {
+        this->max_queued = 1;
+    }
+
+    ReadbackSlot slot = {0, 0, NULL, 0, 0, 0};
+    slots.assign(ring_size, slot);
+
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+
+    for (unsigned i=0; i < thread_count; i++) {
+        workers.push_back(std::thread(&FrameCapture::workerLoop, this));
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    finish();
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+
+    for (size_t i=0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+// Start reading this frame back, after handing on the frames read ring_size-1
+// or more frames ago whose fences have passed
+void FrameCapture::capture(GLsizei width, GLsizei height) {
+    unsigned frame = frame_count++;
+    unsigned lag = slots.size() - 1;
+
+    // Frames come out in order, so a read the GPU hasn't finished holds up the ones after it
+    while (in_flight > 0) {
+        ReadbackSlot &slot = slots[oldest_slot];
+        if (frame - slot.frame < lag) {
+            break;
+        }
+
+        GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        readSlot(slot, status != GL_WAIT_FAILED, false);
+    }
+
+    // Every buffer is still waiting on the GPU, so this frame is skipped
+    if (in_flight == slots.size() || width <= 0 || height <= 0) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        dropped_count++;
+        return;
+    }
+
+    ReadbackSlot &slot = slots[(oldest_slot + in_flight) % slots.size()];
+    GLsizeiptr size = (GLsizeiptr)width * height * 4;
+    if (slot.buffer == 0) {
+        glGenBuffers(1, &slot.buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.buffer_size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot.buffer_size = size;
+    }
+
+    // With a pack buffer bound this only queues the copy
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frame;
+    in_flight++;
+}
+
+// Copy the oldest slot's pixels out for the encoders and free the slot. With
+// wait_for_space this waits for room in the queue instead of dropping the frame.
+void FrameCapture::readSlot(ReadbackSlot &slot, bool fence_passed, bool wait_for_space) {
+    EncodeJob job;
+    job.frame = slot.frame;
+    job.width = slot.width;
+    job.height = slot.height;
+
+    bool queue_full;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while (wait_for_space && jobs.size() >= max_queued) {
+            job_done.wait(lock);
+        }
+        queue_full = jobs.size() >= max_queued;
+        if (!spare_pixels.empty()) {
+            job.pixels.swap(spare_pixels.back());
+            spare_pixels.pop_back();
+        }
+    }
+
+    const unsigned char *mapped = NULL;
+    if (fence_passed && !queue_full) {
+        size_t row_size = (size_t)slot.width * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        mapped = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row_size * slot.height, GL_MAP_READ_BIT);
+        if (mapped != NULL) {
+            // GL's rows go bottom up and PNG's top down
+            job.pixels.resize(row_size * slot.height);
+            for (GLsizei y=0; y < slot.height; y++) {
+                memcpy(&job.pixels[y * row_size], mapped + (slot.height-1-y) * row_size, row_size);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    glDeleteSync(slot.fence);
+    slot.fence = NULL;
+    oldest_slot = (oldest_slot + 1) % slots.size();
+    in_flight--;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (mapped == NULL) {
+            dropped_count++;
+            spare_pixels.push_back(std::move(job.pixels));
+            return;
+        }
+        jobs.push_back(std::move(job));
+    }
+    job_ready.notify_one();
+}
+
+// Read back whatever is in flight, wait for the encoders, then free the buffers
+void FrameCapture::finish() {
+    while (in_flight > 0) {
+        ReadbackSlot &slot = slots[oldest_slot];
+        GLenum status;
+        do {
+            status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        readSlot(slot, status != GL_WAIT_FAILED, true);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while (!jobs.empty() || encoding_count > 0) {
+            job_done.wait(lock);
+        }
+    }
+
+    for (size_t i=0; i < slots.size(); i++) {
+        if (slots[i].buffer != 0) {
+            glDeleteBuffers(1, &slots[i].buffer);
+        }
+        slots[i].buffer = 0;
+        slots[i].buffer_size = 0;
+    }
+}
+
+unsigned FrameCapture::framesWritten() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return written_count;
+}
+
+unsigned FrameCapture::framesDropped() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return dropped_count;
+}
+
+// Encode and save queued frames until the capture is destroyed
+void FrameCapture::workerLoop() {
+    // Frames are saved as RGB at the fast level; the framebuffer's alpha means nothing in a PNG
+    LodePNG_Encoder encoder;
+    LodePNG_Encoder_init(&encoder);
+    encoder.infoRaw.color.colorType = 6;
+    encoder.infoRaw.color.bitDepth = 8;
+    encoder.infoPng.color.colorType = 2;
+    encoder.infoPng.color.bitDepth = 8;
+    encoder.settings.autoLeaveOutAlphaChannel = 0;
+    encoder.settings.zlibsettings.level = 1;
+
+    std::vector<char> filename(filename_pattern.size() + 32);
+
+    while (true) {
+        EncodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (jobs.empty() && !stopping) {
+                job_ready.wait(lock);
+            }
+            if (jobs.empty()) {
+                break;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            encoding_count++;
+        }
+
+        unsigned char *png = NULL;
+        size_t png_size = 0;
+        LodePNG_Encoder_encode(&encoder, &png, &png_size, &job.pixels[0], job.width, job.height);
+
+        snprintf(&filename[0], filename.size(), filename_pattern.c_str(), (int)job.frame);
+        bool saved = encoder.error == 0 && LodePNG_saveFile(png, png_size, &filename[0]) == 0;
+        free(png);
+        if (!saved) {
+            std::cout << "Error: unable to save frame " << &filename[0] << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            encoding_count--;
+            if (saved) {
+                written_count++;
+            } else {
+                dropped_count++;
+            }
+            spare_pixels.push_back(std::move(job.pixels));
+        }
+        job_done.notify_all();
+    }
+
+    LodePNG_Encoder_cleanup(&encoder);
+}
@@ -0,0 +1,39 @@
+#ifndef ASSET_WATCHER_H
+#define ASSET_WATCHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Watches a directory tree for files being saved, so assets can be reloaded
+// while the program runs. Uses inotify, so it only reports changes on Linux;
+// elsewhere isWatching() is false and nothing is ever reported.
+class AssetWatcher {
+    public:
+        // excluded_directory, if given, is a directory in the tree to leave
+        // unwatched (written the same way, e.g. "data/cache/" under "data"),
+        // such as the texture cache, which is written to while loading
+        AssetWatcher(const char *directory, const char *excluded_directory = NULL);
+        ~AssetWatcher();
+
+        bool isWatching() const { return watch_fd >= 0; }
+
+        // Fill in the paths (e.g. "data/images/brick.png") of the files written
+        // since the last call. Never blocks, so it can be called every frame.
+        void changedFiles(std::vector<std::string> &filenames);
+
+    private:
+        // Watches are tied to the descriptor, so copying is disallowed
+        AssetWatcher(const AssetWatcher&);
+        AssetWatcher& operator=(const AssetWatcher&);
+
+        void watchDirectory(const std::string &directory);
+
+        int watch_fd;
+        std::string excluded_directory;
+
+        // The directory each watch descriptor refers to
+        std::map<int,std::string> watch_directories;
+};
+
+#endif
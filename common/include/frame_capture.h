@@ -0,0 +1,99 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Saves rendered frames as PNGs, e.g. for regression comparisons, without
+// stalling the frame loop. Each frame is read into one of a ring of pixel pack
+// buffers with a fence behind it, and mapped ring_size-1 frames later (frame N
+// at N+2 with the default ring of 3) once the fence says the GPU is done with
+// it. Its rows are copied out and encoded at lodepng's fast level on a pool of
+// worker threads. When the GPU or the encoders fall behind, frames are dropped
+// rather than waited for, so capture() never blocks.
+//
+// Only the bound read framebuffer is read, so it works the same in a window,
+// on an FBO or in a headless (e.g. Mesa surfaceless) context. Needs GL 3.2.
+class FrameCapture {
+    public:
+        // filename_pattern is a printf format for the frame number, such as
+        // "capture/frame_%05d.png". A thread_count of 0 starts one encoder per
+        // core, and at most max_queued frames wait to be encoded.
+        FrameCapture(const char *filename_pattern, unsigned thread_count = 0, unsigned ring_size = 3, size_t max_queued = 8);
+
+        // Finishes the frames captured so far, so the GL context has to still be current
+        ~FrameCapture();
+
+        // Call once a frame after drawing, before swapping: starts reading back
+        // the bottom left width x height pixels and hands the frames whose
+        // fences have passed to the encoders
+        void capture(GLsizei width, GLsizei height);
+
+        // Wait for every frame captured so far to be read back and written, and
+        // free the buffers. Blocks, so it is for when capturing stops.
+        void finish();
+
+        // Frames passed to capture(), written to disk, and dropped (not read
+        // back or encoded in time, or failed to save)
+        unsigned framesCaptured() const { return frame_count; }
+        unsigned framesWritten();
+        unsigned framesDropped();
+
+    private:
+        // Captures own threads and GL objects, so copying is disallowed
+        FrameCapture(const FrameCapture&);
+        FrameCapture& operator=(const FrameCapture&);
+
+        // A pixel pack buffer and the fence after the read into it; fence is
+        // NULL when no read is in flight
+        typedef struct {
+            GLuint buffer;
+            GLsizeiptr buffer_size;
+            GLsync fence;
+            GLsizei width, height;
+            unsigned frame;
+        } ReadbackSlot;
+
+        typedef struct {
+            unsigned frame;
+            unsigned width, height;
+            std::vector<unsigned char> pixels;
+        } EncodeJob;
+
+        // Map the oldest slot's buffer and queue its pixels for the encoders,
+        // dropping them if the read failed or (unless waiting) the queue is full
+        void readSlot(ReadbackSlot &slot, bool fence_passed, bool wait_for_space);
+
+        void workerLoop();
+
+        std::string filename_pattern;
+        size_t max_queued;
+
+        std::vector<ReadbackSlot> slots;
+        size_t oldest_slot;
+        size_t in_flight;
+        unsigned frame_count;
+
+        std::vector<std::thread> workers;
+
+        std::mutex queue_mutex;
+        std::condition_variable job_ready;
+        std::condition_variable job_done;
+
+        std::deque<EncodeJob> jobs;
+        size_t encoding_count;
+        unsigned written_count;
+        unsigned dropped_count;
+        bool stopping;
+
+        // Pixel vectors the workers are done with, so frames don't allocate
+        std::vector<std::vector<unsigned char> > spare_pixels;
+};
+
+#endif
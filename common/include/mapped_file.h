@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+    public:
+        MappedFile();
+        MappedFile(const char *filename);
+        ~MappedFile();
+
+        bool open(const char *filename);
+        void close();
+
+        bool isOpen() const { return data_ptr != NULL; }
+        const unsigned char *data() const { return data_ptr; }
+        size_t size() const { return data_size; }
+
+    private:
+        // Mappings are not shareable, so copying is disallowed
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        const unsigned char *data_ptr;
+        size_t data_size;
+
+#ifdef _WIN32
+        void *file_handle;
+        void *mapping_handle;
+#endif
+};
+
+#endif
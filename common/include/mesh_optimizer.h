@@ -0,0 +1,40 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "vertex.h"
+
+// Post-transform vertex cache statistics for an indexed triangle list
+typedef struct {
+    // Average cache miss ratio: vertex shader runs per triangle (0.5 - 3.0, lower is better)
+    float acmr;
+    // Average transformed vertex ratio: vertex shader runs per used vertex (1.0 is ideal)
+    float atvr;
+} CacheStats;
+
+// A run of the index list drawn with one call; base_vertex is added to every
+// index in it, and max_index is the highest index in it (before base_vertex)
+typedef struct {
+    GLuint first_index;
+    GLsizei index_count;
+    GLint base_vertex;
+    GLuint max_index;
+} DrawRange;
+
+// Simulate a FIFO post-transform cache of the given size over the index list
+CacheStats analyzeVertexCache(const std::vector<GLuint> &indices, size_t vertex_count, unsigned cache_size = 16);
+
+// Reorder triangles so that neighbouring triangles share vertices (Forsyth's algorithm)
+void optimizeVertexCache(std::vector<GLuint> &indices, size_t vertex_count);
+
+// Reorder vertices into the order the index list first uses them, remapping the indices to match
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
+
+// Break a triangle list into sub-meshes of at most max_vertices vertices each, so that
+// large meshes can still be drawn with 16-bit indices
+void splitMesh(std::vector<Vertex> &vertices, std::vector<GLuint> &indices, std::vector<DrawRange> &ranges, size_t max_vertices = 65536);
+
+#endif
@@ -2,39 +2,246 @@
 #define MODEL_H
 
 #include <map>
+#include <string>
 #include <vector>
 
 #include <GL/glew.h>
 
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
 #include "vertex.h"
+#include "vertex_format.h"
 
 enum shader_types {VERTEX, FRAGMENT, GEOMETRY};
 enum buffer_types {VERTEX_BUFFER, INDEX_BUFFER};
 
+// Header of the binary mesh cache written by Model::toBinary. All offsets
+// are in bytes from the start of the file, and the vertex/index arrays are
+// stored exactly as they get uploaded to the buffer objects, with the
+// vertices packed as described by vertex_format (vertex_size is its stride)
+// and the indices index_size (1, 2 or 4) bytes each.
+#define MESH_FILE_MAGIC "GLPM"
+#define MESH_FILE_VERSION 4
+
+typedef struct {
+    char magic[4];
+    GLuint version;
+
+    GLuint vertex_size;
+    GLuint vertex_count;
+    GLuint vertex_offset;
+
+    GLuint index_size;
+    GLuint index_count;
+    GLuint index_offset;
+
+    // DrawRange array
+    GLuint range_count;
+    GLuint range_offset;
+
+    // NUL terminated names: vertex, fragment and geometry shader, then the textures
+    GLuint texture_count;
+    GLuint string_offset;
+    GLuint string_size;
+
+    VertexFormat vertex_format;
+} MeshFileHeader;
+
+// A decoded texture waiting to be uploaded, as tightly packed rows of channels
+// samples per pixel (1 grey, 2 grey+alpha, 3 RGB, 4 RGBA) of bit_depth bits
+// each (8, or 16 stored big endian as in the PNG). With levels above 1 the
+// pixels go on with the mip levels, each half the size of the one before
+// (rounded down, but at least 1) in the same layout.
+typedef struct {
+    unsigned width, height;
+    unsigned channels, bit_depth;
+    unsigned levels;
+    std::vector<unsigned char> pixels;
+} TextureImage;
+
+// The bytes all of an image's levels take up
+size_t textureSize(const TextureImage &image);
+
+// The GL formats a TextureImage gets uploaded as. Without swizzle the grey
+// layouts use the old luminance formats, otherwise one or two channel ones.
+void textureFormat(const TextureImage &image, bool swizzle, GLint &internal_format, GLenum &format, GLenum &type);
+
+// Called with a smaller copy of an interlaced PNG as its Adam7 passes arrive:
+// after passes 1, 3 and 5 at 1/8, 1/4 and 1/2 of the width and height
+// (rounded up), in the layout the finished image will have. Each pixel is the
+// top left one of its block, so a texture can show it until the rest comes.
+typedef void (*TexturePreview)(void *user, const TextureImage &preview);
+
+namespace LodePNG {
+    class Decoder;
+}
+
+// Decodes PNG textures one after another with the same decoder, which keeps
+// its buffers and Huffman tables, so after the first few textures decoding
+// doesn't allocate anything but the pixels. Use one per thread.
+// Skipping the checksums only makes sense for files we wrote ourselves.
+class TextureDecoder {
+    public:
+        // With native_layout set, TextureImages keep the PNG's own channels and
+        // bit depth instead of being expanded to 8-bit RGBA; only palettes (to
+        // RGBA), grey under 8 bits and colour keys (an added alpha) get converted
+        TextureDecoder(bool native_layout = false);
+        ~TextureDecoder();
+
+        // Load and decode a PNG, returning false if that fails
+        bool decode(const char *filename, TextureImage &image, bool verify_checksums = true);
+
+        // Decode a PNG as it's read from a file or pipe, a block at a time. Rows
+        // are decoded as their data arrives, so next to the pixels only the
+        // block, a few rows and the inflate window are in memory.
+        bool decodeStream(int fd, TextureImage &image, bool verify_checksums = true);
+
+        // Have decode(filename, image) and decodeStream hand out previews of
+        // interlaced PNGs; NULL turns them off again
+        void setPreview(TexturePreview callback, void *user = NULL);
+
+        // Decode a PNG into memory the caller owns, such as a mapped pixel unpack
+        // buffer, as rows of RGBA pixels stride bytes apart. size is the bytes
+        // available at pixels; size() reads the dimensions to allocate for.
+        bool size(const char *filename, unsigned &width, unsigned &height);
+        bool decode(const char *filename, unsigned char *pixels, size_t stride, size_t size, bool verify_checksums = true);
+
+    private:
+        TextureDecoder(const TextureDecoder&);
+        TextureDecoder& operator=(const TextureDecoder&);
+
+        LodePNG::Decoder *decoder;
+        bool native_layout;
+        std::vector<unsigned char> read_buffer;
+
+        TexturePreview preview;
+        void *preview_user;
+};
+
+// Decode a single texture with a decoder of its own
+bool decodeTexture(const char *filename, TextureImage &image, bool verify_checksums = true, bool native_layout = false);
+
 class Model {
     public:
-        Model() {};
-        Model(const char *filename);
+        Model();
+        Model(const char *filename, bool optimize_mesh = false, bool split_mesh = false);
+
+        // Lets go of anything read() left staged, such as file mappings, when
+        // the model is never uploaded. The GL objects are not deleted.
+        ~Model();
 
         void fromYAML(const char *filename);
+        bool fromBinary(const char *filename);
+
+        // Loading in two halves: read() does all the file reading and decoding
+        // without touching OpenGL, so it can run on any thread, then upload()
+        // creates the GL objects on the thread that owns the context. Without
+        // read_textures the textures are created empty, for updateTexture to fill.
+        bool read(const char *filename, bool read_textures = true);
+        void upload();
+
+        // Free what read() prepared without uploading it
+        void releaseStaging();
+
+        // Hot reloading: take the geometry from a freshly read() copy of this
+        // model, re-uploading only what changed, or replace one texture's pixels
+        void updateGeometry(Model &source);
+        void updateTexture(size_t index, const TextureImage &image);
+
+        // Read a YAML model file or binary mesh cache without touching OpenGL;
+        // both return false if the file can't be read
+        bool readYAML(const char *filename);
+        bool readBinary(const char *filename);
+        bool toBinary(const char *filename) const;
+
+        // Decode the textures, read the shader sources and pack the buffers for upload()
+        void readAssets(bool read_textures = true);
+
+        // Where the index'th texture is loaded from
+        std::string texturePath(size_t index) const;
+
+        // Reorder the triangles and vertices for the post-transform cache and vertex fetch
+        void optimizeMesh(const char *name);
+
+        // Pick the index size for the mesh (splitting it first if split_mesh is set) and fill in draw_ranges
+        void buildDrawRanges();
+
+        // Draw every range of the index buffer with the bound shader program
+        void draw(GLenum mode = GL_TRIANGLES) const;
+
+        // The file this model was last read from
+        std::string source_filename;
 
         std::vector<Vertex> vertex_list;
-        std::vector<GLushort> index_list;
+        std::vector<GLuint> index_list;
+
+        // Bytes per index in the index buffer (1, 2 or 4), and the parts of it to draw
+        GLuint index_size;
+        std::vector<DrawRange> draw_ranges;
+
+        // Which attributes get uploaded, and how they are packed
+        VertexFormat vertex_format;
 
         // Shader indices
         GLhandleARB shader_program;
         std::map<shader_types,GLuint> shader_map;
+        std::map<shader_types,std::string> shader_filenames;
 
         // Texture indices
         GLuint *texture_ids;
         GLsizei texture_count;
+        std::vector<std::string> texture_filenames;
 
-        // Buffer/Array Object 
+        // Buffer/Array Object
         GLuint vao;
         GLuint *buffer_ids;
         std::map<buffer_types,GLuint> buffer_map;
 
+        // Run optimizeMesh on every YAML model as it is read
+        bool optimize_mesh;
+
+        // Split meshes too big for 16-bit indices into sub-meshes instead of using 32-bit ones
+        bool split_mesh;
+
+        // Check the PNG chunk CRCs and zlib Adler-32 of the textures; turn off
+        // for trusted packed assets to save a pass over every texture byte
+        bool verify_checksums;
+
+        // Load textures through the texture cache in data/cache/, so they are
+        // only decoded (and their mip levels built) when their PNG changes
+        bool cache_textures;
+
+        // Where the texture files and the texture cache entries are, with a
+        // trailing slash (data/images/ and data/cache/ by default)
+        std::string texture_directory;
+        std::string texture_cache_directory;
+
+    private:
+        // Models own their staged file mappings, so copying is disallowed
+        Model(const Model&);
+        Model& operator=(const Model&);
+
     protected:
+        // What readAssets() prepared for upload(); released once uploaded
+        std::vector<TextureImage> texture_images;
+        std::map<shader_types,std::string> shader_sources;
+        std::vector<unsigned char> packed_vertices;
+        std::vector<unsigned char> packed_indices;
+
+        // The binary mesh cache whose arrays are waiting to be uploaded, if any
+        MappedFile *mesh_file;
+
+        // Each texture's cache entry, whose pixels upload() sends instead of
+        // texture_images[i].pixels when it is open
+        std::vector<MappedFile*> texture_files;
+
+        // The vertex/index arrays upload() sends, from the packed vectors or the mesh file
+        void stagedBuffers(const GLvoid *&vertices, GLsizeiptr &vertex_bytes, const GLvoid *&indices, GLsizeiptr &index_bytes) const;
+
+        void loadTextures();
+        void loadShaders();
+        void loadBuffers(const GLvoid *vertices, GLsizeiptr vertex_bytes, const GLvoid *indices, GLsizeiptr index_bytes);
+
         void cleanUp();
 };
 
@@ -0,0 +1,94 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model.h"
+
+// Loads many models at once. Each model's file reading, YAML parsing and PNG
+// decoding (Model::read) runs on a pool of worker threads; only the GL object
+// creation (Model::upload) is left for the render thread, through
+// uploadReady() or finish(). Hot reloads of changed model and texture files
+// go through the same queues, so they never stall the frame loop.
+//
+// With progressive_textures, models are uploaded as soon as their geometry and
+// shaders are read, with empty textures that are decoded afterwards as jobs of
+// their own. Interlaced PNGs get uploaded at 1/8, 1/4 and 1/2 size as their
+// passes arrive, so a scene shows up well before its textures are finished.
+class ModelLoader {
+    public:
+        // A thread_count of 0 starts one worker per core
+        ModelLoader(unsigned thread_count = 0, bool progressive_textures = false);
+        ~ModelLoader();
+
+        // Queue a model file to be read into the given model, which has to
+        // stay alive until it has been uploaded
+        void load(Model *model, const char *filename);
+
+        // Queue re-reads of any of the given models or their textures whose
+        // files are in the list (see AssetWatcher); uploadReady() applies them
+        void reloadChanged(const std::vector<std::string> &filenames, const std::vector<Model*> &models);
+
+        // Upload up to max_models models (or reloads, textures and texture
+        // previews) that have finished reading (0 for no limit) and return how
+        // many were uploaded. Call from the GL thread, e.g. once a frame to
+        // spread the uploads out.
+        size_t uploadReady(size_t max_models = 0);
+
+        // Wait for every queued model to be read and upload them all
+        void finish();
+
+        // Models queued that haven't been uploaded (or failed) yet
+        size_t pending();
+
+    private:
+        // Loaders own threads, so copying is disallowed
+        ModelLoader(const ModelLoader&);
+        ModelLoader& operator=(const ModelLoader&);
+
+        enum job_types {LOAD_MODEL, LOAD_TEXTURE, TEXTURE_PREVIEW, RELOAD_MODEL, RELOAD_TEXTURE};
+
+        typedef struct {
+            job_types type;
+            Model *model;
+            std::string filename;
+            bool read_ok;
+
+            // Reloads are read into these, then applied to the model
+            Model *reloaded_model;
+            size_t texture_index;
+            TextureImage texture_image;
+        } LoadJob;
+
+        // Where a LOAD_TEXTURE job's previews go
+        typedef struct {
+            ModelLoader *loader;
+            const LoadJob *job;
+        } PreviewTarget;
+
+        void queueJob(const LoadJob &job);
+
+        // Queue a TEXTURE_PREVIEW for uploadReady(), from a worker
+        static void queuePreview(void *user, const TextureImage &preview);
+
+        void workerLoop();
+
+        std::vector<std::thread> workers;
+
+        std::mutex queue_mutex;
+        std::condition_variable job_ready;
+        std::condition_variable model_ready;
+
+        std::deque<LoadJob> jobs;
+        std::deque<LoadJob> read_models;
+        size_t pending_count;
+        bool stopping;
+        bool progressive_textures;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <string>
+
+#include <GL/glew.h>
+
+#include "mapped_file.h"
+#include "model.h"
+
+// Header of a texture cache entry, a KTX-like container of a decoded texture
+// ready for upload. The pixels start data_offset bytes into the file: every
+// mip level from the full size down to 1x1, one after the other, each as
+// tightly packed rows in the layout TextureImage describes. The key is a hash
+// of the source PNG and the settings it was processed with, split into two
+// halves so the header has no 64-bit fields to pad around.
+#define TEXTURE_FILE_MAGIC "GLPT"
+#define TEXTURE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    GLuint version;
+    GLuint key[2];
+
+    GLuint width;
+    GLuint height;
+    GLuint channels;
+    GLuint bit_depth;
+    GLuint level_count;
+
+    // What the levels get uploaded as (with GL_UNPACK_SWAP_BYTES for 16-bit
+    // samples on little endian machines, as they are big endian)
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+
+    GLuint data_offset;
+    GLuint data_size;
+} TextureFileHeader;
+
+// Append an image's mip levels to its pixels, each a 2x2 box filter of the
+// one before, down to 1x1
+void buildMipmaps(TextureImage &image);
+
+// A directory of texture cache entries, named after their keys, so a texture
+// is only decoded again when its PNG or the settings change. Entries are
+// checked over before being used, and a missing or bad one is rebuilt from
+// the PNG. Old entries are never removed, clear the directory to reclaim them.
+class TextureCache {
+    public:
+        // The directory is created when the first entry is written. Without
+        // mipmaps the entries only hold the full size level.
+        TextureCache(const char *directory = "data/cache/", bool mipmaps = true);
+
+        // Map the entry for a PNG into file and describe its pixels in image,
+        // leaving image.pixels empty. Without a valid entry the PNG is decoded
+        // into image in its native layout (with its mip levels) and written out
+        // as a new entry, and file is left closed. Returns false if the PNG
+        // can't be read.
+        bool load(const char *filename, TextureImage &image, MappedFile &file, bool verify_checksums = true);
+
+        // Where the entry for a PNG goes, or an empty string if it can't be read
+        std::string entryPath(const char *filename);
+
+    private:
+        // Caches own a decoder, so copying is disallowed
+        TextureCache(const TextureCache&);
+        TextureCache& operator=(const TextureCache&);
+
+        bool readEntry(const std::string &path, const GLuint key[2], TextureImage &image, MappedFile &file);
+        bool writeEntry(const std::string &path, const GLuint key[2], const TextureImage &image);
+
+        std::string directory;
+        bool mipmaps;
+        TextureDecoder decoder;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "vertex.h"
+
+// The attributes a Vertex can carry, in shader attribute location order
+enum vertex_attributes {
+    ATTRIB_POSITION,
+    ATTRIB_NORMAL,
+    ATTRIB_COLOR,
+    ATTRIB_TEXCOORD0,
+    ATTRIB_TEXCOORD1,
+    ATTRIB_TEXCOORD2,
+    ATTRIB_COUNT
+};
+
+// How an attribute is stored in the vertex buffer
+enum attribute_types {
+    ATTRIB_NONE,            // not uploaded at all
+    ATTRIB_FLOAT,           // 32-bit floats
+    ATTRIB_HALF,            // 16-bit floats
+    ATTRIB_SNORM16,         // 16-bit normalised; positions use position_scale/bias
+    ATTRIB_INT_2_10_10_10,  // packed signed 10-bit xyz + 2-bit w, normalised
+    ATTRIB_UNORM8           // 8-bit normalised, for colours
+};
+
+// The packed, interleaved layout a model's vertices are uploaded in. It is
+// plain data so it can be stored as-is in a binary mesh file.
+typedef struct {
+    GLuint types[ATTRIB_COUNT];
+    GLuint offsets[ATTRIB_COUNT];
+    GLuint stride;
+
+    // Quantised positions are decoded as pos * position_scale + position_bias
+    GLfloat position_scale[3];
+    GLfloat position_bias[3];
+} VertexFormat;
+
+// Look up attribute/type names as they are written in model files ("pos", "half", ...)
+int attributeFromName(const char *name);
+int attributeTypeFromName(const char *name);
+
+// Work out the offsets, stride and (for quantised positions) scale/bias of a format
+void layoutVertexFormat(VertexFormat &format, const std::vector<Vertex> &vertices);
+
+// Check that every attribute of a format read from a file has a known type and
+// lies within the stride
+bool vertexFormatFits(const VertexFormat &format);
+
+// Convert vertices into the packed layout described by the format
+void packVertices(const VertexFormat &format, const Vertex *vertices, size_t vertex_count, std::vector<unsigned char> &packed);
+
+// Point the attribute arrays of the bound VAO at the bound vertex buffer
+void setVertexAttributes(const VertexFormat &format);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef YAML_MODEL_HANDLER_H
+#define YAML_MODEL_HANDLER_H
+
+#include <string>
+#include <vector>
+
+#include "yaml-cpp/eventhandler.h"
+
+#include "vertex_format.h"
+
+class Model;
+
+// Streams the events of a YAML model file straight into a Model's
+// vertex_list, index_list, vertex_format and shader/texture names. Unlike
+// YAML::Parser::GetNextDocument this never builds a YAML::Node tree, so
+// there is no per-scalar heap node and peak memory stays near the size of
+// the finished mesh.
+class YAMLModelHandler : public YAML::EventHandler {
+    public:
+        YAMLModelHandler(Model &model);
+
+        virtual void OnDocumentStart(const YAML::Mark& mark);
+        virtual void OnDocumentEnd();
+
+        virtual void OnNull(const YAML::Mark& mark, YAML::anchor_t anchor);
+        virtual void OnAlias(const YAML::Mark& mark, YAML::anchor_t anchor);
+        virtual void OnScalar(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor, const std::string& value);
+
+        virtual void OnSequenceStart(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor);
+        virtual void OnSequenceEnd();
+
+        virtual void OnMapStart(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor);
+        virtual void OnMapEnd();
+
+    private:
+        // The parts of the model file we know how to handle
+        enum section_types {NO_SECTION, VERTICES, INDICES, SHADERS, TEXTURES, FORMAT};
+
+        // One open sequence or map. Maps alternate between expecting a key
+        // and a value; sequences count their entries.
+        typedef struct {
+            bool is_map;
+            bool expecting_key;
+            std::string key;
+            int index;
+        } Collection;
+
+        void openCollection(bool is_map);
+        void closeCollection();
+        void handleValue(const YAML::Mark& mark, const std::string& value);
+        void skipNode();
+        void nextEntry();
+
+        Model &model;
+        std::vector<Collection> collections;
+
+        section_types section;
+
+        // The vertex attribute (vertex_attributes) being read, or -1
+        int field;
+
+        // Which attributes the vertices use, and the types the format section asks for
+        bool attribute_present[ATTRIB_COUNT];
+        GLuint attribute_types[ATTRIB_COUNT];
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile() : data_ptr(NULL), data_size(0) {
+#ifdef _WIN32
+    file_handle = NULL;
+    mapping_handle = NULL;
+#endif
+}
+
+MappedFile::MappedFile(const char *filename) : data_ptr(NULL), data_size(0) {
+#ifdef _WIN32
+    file_handle = NULL;
+    mapping_handle = NULL;
+#endif
+    open(filename);
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+// Map the given file, returning false if it can't be opened or is empty
+bool MappedFile::open(const char *filename) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    mapping_handle = mapping;
+    data_ptr = (const unsigned char*)view;
+    data_size = (size_t)file_size.QuadPart;
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *view = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+
+    if (view == MAP_FAILED) {
+        return false;
+    }
+
+    data_ptr = (const unsigned char*)view;
+    data_size = (size_t)file_stat.st_size;
+#endif
+
+    return true;
+}
+
+// Unmap the file (if any)
+void MappedFile::close() {
+    if (data_ptr == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(data_ptr);
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    file_handle = NULL;
+    mapping_handle = NULL;
+#else
+    munmap((void*)data_ptr, data_size);
+#endif
+
+    data_ptr = NULL;
+    data_size = 0;
+}
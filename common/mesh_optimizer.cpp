@@ -0,0 +1,303 @@
+#include <cmath>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+namespace {
+    // Make sure every index refers to an existing vertex before we use them as array offsets
+    bool indicesInRange(const std::vector<GLuint> &indices, size_t vertex_count) {
+        for (size_t i=0; i < indices.size(); i++) {
+            if (indices[i] >= vertex_count) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Tuning values from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    const int cache_size = 32;
+    const float cache_decay_power = 1.5f;
+    const float last_triangle_score = 0.75f;
+    const float valence_boost_scale = 2.0f;
+    const float valence_boost_power = 0.5f;
+
+    // Score a vertex by how recently it was used and how many triangles still need it
+    float vertexScore(int cache_position, int remaining_triangles) {
+        if (remaining_triangles == 0) {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                // The vertices of the triangle we just added get a fixed score, so
+                // we don't favour strips over fans
+                score = last_triangle_score;
+            } else {
+                float scaler = 1.0f / (cache_size - 3);
+                score = powf(1.0f - (cache_position - 3) * scaler, cache_decay_power);
+            }
+        }
+
+        // Favour vertices with few triangles left so we don't leave lonely ones behind
+        score += valence_boost_scale * powf((float)remaining_triangles, -valence_boost_power);
+        return score;
+    }
+}
+
+// Simulate a FIFO post-transform cache of the given size over the index list
+CacheStats analyzeVertexCache(const std::vector<GLuint> &indices, size_t vertex_count, unsigned cache_size) {
+    CacheStats stats;
+    stats.acmr = 0.0f;
+    stats.atvr = 0.0f;
+
+    if (indices.size() < 3 || !indicesInRange(indices, vertex_count)) {
+        return stats;
+    }
+
+    // A vertex is in the FIFO if fewer than cache_size misses happened since it was loaded
+    std::vector<size_t> cache_time(vertex_count, 0);
+    std::vector<bool> used(vertex_count, false);
+    size_t misses = 0;
+    size_t used_count = 0;
+
+    for (size_t i=0; i < indices.size(); i++) {
+        GLuint index = indices[i];
+        if (!used[index] || misses - cache_time[index] >= cache_size) {
+            misses++;
+            cache_time[index] = misses;
+        }
+        if (!used[index]) {
+            used[index] = true;
+            used_count++;
+        }
+    }
+
+    stats.acmr = (float)misses / (indices.size() / 3);
+    stats.atvr = (float)misses / used_count;
+    return stats;
+}
+
+// Reorder triangles so that neighbouring triangles share vertices (Forsyth's algorithm)
+void optimizeVertexCache(std::vector<GLuint> &indices, size_t vertex_count) {
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0 || !indicesInRange(indices, vertex_count)) {
+        return;
+    }
+
+    // Build the list of triangles that use each vertex
+    std::vector<int> remaining(vertex_count, 0);
+    for (size_t i=0; i < triangle_count*3; i++) {
+        remaining[indices[i]]++;
+    }
+
+    std::vector<size_t> adjacency_offset(vertex_count+1, 0);
+    for (size_t v=0; v < vertex_count; v++) {
+        adjacency_offset[v+1] = adjacency_offset[v] + remaining[v];
+    }
+
+    std::vector<size_t> adjacency(triangle_count*3);
+    std::vector<size_t> adjacency_fill(adjacency_offset.begin(), adjacency_offset.end()-1);
+    for (size_t t=0; t < triangle_count; t++) {
+        for (int k=0; k < 3; k++) {
+            adjacency[adjacency_fill[indices[t*3+k]]++] = t;
+        }
+    }
+
+    // Initial scores; nothing is in the cache yet
+    std::vector<float> vertex_scores(vertex_count);
+    for (size_t v=0; v < vertex_count; v++) {
+        vertex_scores[v] = vertexScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triangle_scores(triangle_count);
+    std::vector<bool> triangle_added(triangle_count, false);
+    size_t best_triangle = 0;
+    for (size_t t=0; t < triangle_count; t++) {
+        triangle_scores[t] = vertex_scores[indices[t*3]] + vertex_scores[indices[t*3+1]] + vertex_scores[indices[t*3+2]];
+        if (triangle_scores[t] > triangle_scores[best_triangle]) {
+            best_triangle = t;
+        }
+    }
+
+    std::vector<GLuint> output;
+    output.reserve(triangle_count*3);
+
+    std::vector<GLuint> cache, new_cache;
+    cache.reserve(cache_size+3);
+    new_cache.reserve(cache_size+3);
+
+    size_t next_unadded = 0;
+    bool have_best = true;
+
+    while (output.size() < triangle_count*3) {
+
+        // When the cache offers nothing, fall back to the next triangle we haven't drawn
+        if (!have_best) {
+            while (triangle_added[next_unadded]) {
+                next_unadded++;
+            }
+            best_triangle = next_unadded;
+        }
+
+        triangle_added[best_triangle] = true;
+
+        // Emit the triangle and take it out of its vertices' adjacency lists
+        GLuint *tri = &indices[best_triangle*3];
+        for (int k=0; k < 3; k++) {
+            GLuint v = tri[k];
+            output.push_back(v);
+
+            size_t *list = &adjacency[adjacency_offset[v]];
+            for (int j=0; j < remaining[v]; j++) {
+                if (list[j] == best_triangle) {
+                    list[j] = list[remaining[v]-1];
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // Push the triangle's vertices to the front of the (LRU) cache
+        new_cache.assign(tri, tri+3);
+        for (size_t c=0; c < cache.size(); c++) {
+            GLuint v = cache[c];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                new_cache.push_back(v);
+            }
+        }
+
+        // Anything that fell off the end is no longer cached
+        for (size_t c=cache_size; c < new_cache.size(); c++) {
+            vertex_scores[new_cache[c]] = vertexScore(-1, remaining[new_cache[c]]);
+        }
+        if (new_cache.size() > (size_t)cache_size) {
+            new_cache.resize(cache_size);
+        }
+        cache.swap(new_cache);
+
+        for (size_t c=0; c < cache.size(); c++) {
+            vertex_scores[cache[c]] = vertexScore(c, remaining[cache[c]]);
+        }
+
+        // Rescore the triangles touching the cache and pick the best one to go next
+        have_best = false;
+        float best_score = 0.0f;
+        for (size_t c=0; c < cache.size(); c++) {
+            GLuint v = cache[c];
+            const size_t *list = &adjacency[adjacency_offset[v]];
+            for (int j=0; j < remaining[v]; j++) {
+                size_t t = list[j];
+                triangle_scores[t] = vertex_scores[indices[t*3]] + vertex_scores[indices[t*3+1]] + vertex_scores[indices[t*3+2]];
+                if (!have_best || triangle_scores[t] > best_score) {
+                    best_triangle = t;
+                    best_score = triangle_scores[t];
+                    have_best = true;
+                }
+            }
+        }
+    }
+
+    // Hang on to any stray indices past the last whole triangle
+    output.insert(output.end(), indices.begin()+triangle_count*3, indices.end());
+    indices.swap(output);
+}
+
+// Reorder vertices into the order the index list first uses them, remapping the indices to match
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<GLuint> &indices) {
+    if (!indicesInRange(indices, vertices.size())) {
+        return;
+    }
+
+    const int unmapped = -1;
+    std::vector<int> remap(vertices.size(), unmapped);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+
+    for (size_t i=0; i < indices.size(); i++) {
+        GLuint &index = indices[i];
+        if (remap[index] == unmapped) {
+            remap[index] = reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    // Keep any vertices the indices never touch, after all the used ones
+    for (size_t v=0; v < vertices.size(); v++) {
+        if (remap[v] == unmapped) {
+            reordered.push_back(vertices[v]);
+        }
+    }
+
+    vertices.swap(reordered);
+}
+
+// Break a triangle list into sub-meshes of at most max_vertices vertices each. Vertices
+// shared by two sub-meshes are duplicated, and each sub-mesh's indices are made relative
+// to its base_vertex. Unused vertices and stray indices past the last whole
+// triangle are dropped.
+void splitMesh(std::vector<Vertex> &vertices, std::vector<GLuint> &indices, std::vector<DrawRange> &ranges, size_t max_vertices) {
+    ranges.clear();
+
+    // Small enough already (or unusable), so draw it in one go
+    if (vertices.size() <= max_vertices || max_vertices < 3 || !indicesInRange(indices, vertices.size())) {
+        DrawRange range = {0, (GLsizei)indices.size(), 0, 0};
+        ranges.push_back(range);
+        return;
+    }
+
+    const int unmapped = -1;
+    std::vector<int> local_index(vertices.size(), unmapped);
+    std::vector<GLuint> sub_mesh_vertices;
+
+    std::vector<Vertex> split_vertices;
+    std::vector<GLuint> split_indices;
+    split_vertices.reserve(vertices.size());
+    split_indices.reserve(indices.size());
+
+    DrawRange range = {0, 0, 0, 0};
+    size_t triangle_count = indices.size() / 3;
+    for (size_t t=0; t < triangle_count; t++) {
+        const GLuint *tri = &indices[t*3];
+
+        // Count the vertices this triangle would add to the current sub-mesh
+        size_t new_vertices = 0;
+        for (int k=0; k < 3; k++) {
+            if (local_index[tri[k]] == unmapped && (k == 0 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1])) {
+                new_vertices++;
+            }
+        }
+
+        // Start a new sub-mesh when this one is full
+        if (sub_mesh_vertices.size() + new_vertices > max_vertices) {
+            range.index_count = split_indices.size() - range.first_index;
+            ranges.push_back(range);
+
+            for (size_t v=0; v < sub_mesh_vertices.size(); v++) {
+                local_index[sub_mesh_vertices[v]] = unmapped;
+            }
+            sub_mesh_vertices.clear();
+
+            range.first_index = split_indices.size();
+            range.base_vertex = split_vertices.size();
+        }
+
+        for (int k=0; k < 3; k++) {
+            if (local_index[tri[k]] == unmapped) {
+                local_index[tri[k]] = sub_mesh_vertices.size();
+                sub_mesh_vertices.push_back(tri[k]);
+                split_vertices.push_back(vertices[tri[k]]);
+            }
+            split_indices.push_back(local_index[tri[k]]);
+        }
+    }
+
+    if (split_indices.size() > range.first_index) {
+        range.index_count = split_indices.size() - range.first_index;
+        ranges.push_back(range);
+    }
+
+    vertices.swap(split_vertices);
+    indices.swap(split_indices);
+}
@@ -1,18 +1,357 @@
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
 #include <cstring>
 #include <fstream>
+#include <iostream>
 #include <map>
+#include <new>
 
 #include "lodepng.h"
 
 #include "yaml-cpp/yaml.h"
 
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
 #include "model.h"
 #include "shader_util.h"
+#include "texture_cache.h"
 #include "vertex.h"
+#include "yaml_model_handler.h"
 
-// Basic constructor that populates the object contents from a YAML file
-Model::Model(const char *filename) {
-    fromYAML(filename);
+namespace {
+    const char *shader_path = "data/shaders/";
+
+    // The smallest layout that holds a PNG's pixels as they are: its own channels
+    // at 8 or 16 bits, with palettes expanded to RGBA and an alpha channel added
+    // for a colour key. The decoder only converts 16-bit images to RGB(A).
+    void nativeLayout(const LodePNG_InfoColor &png, LodePNG_InfoColor &raw) {
+        raw.colorType = png.colorType;
+        raw.bitDepth = png.bitDepth == 16 ? 16 : 8;
+        if (png.colorType == 3) {
+            raw.colorType = 6;
+        } else if (png.key_defined) {
+            raw.colorType = (png.colorType == 2 || png.bitDepth == 16) ? 6 : 4;
+        }
+    }
+
+    // Plain unbuffered file reading, TextureDecoder::decodeStream does its own buffering
+    int openFile(const char *filename) {
+#ifdef _WIN32
+        return _open(filename, _O_RDONLY | _O_BINARY);
+#else
+        return ::open(filename, O_RDONLY);
+#endif
+    }
+
+    long readFile(int fd, unsigned char *buffer, size_t size) {
+#ifdef _WIN32
+        return _read(fd, buffer, (unsigned)size);
+#else
+        return ::read(fd, buffer, size);
+#endif
+    }
+
+    void closeFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    // How much of a PNG TextureDecoder::decodeStream reads at a time
+    const size_t stream_block = 65536;
+
+    // Where the stream callbacks put a texture's rows, and who gets its previews
+    typedef struct {
+        TextureImage *image;
+        bool native_layout;
+        size_t stride;
+        bool too_big;
+        TexturePreview preview;
+        void *preview_user;
+    } StreamTarget;
+
+    // Pick the layout at the first image data, when a colour key would have
+    // been seen, and allocate the pixels
+    void streamHeader(void *user, LodePNG_Decoder *decoder) {
+        StreamTarget *target = (StreamTarget*)user;
+        TextureImage &image = *target->image;
+        LodePNG_InfoColor &raw = decoder->infoRaw.color;
+        if (target->native_layout) {
+            nativeLayout(decoder->infoPng.color, raw);
+        } else {
+            raw.colorType = 6;
+            raw.bitDepth = 8;
+        }
+        image.width = decoder->infoPng.width;
+        image.height = decoder->infoPng.height;
+        image.channels = LodePNG_InfoColor_getChannels(&raw);
+        image.bit_depth = raw.bitDepth;
+
+        // The header alone can claim a size we can't allocate
+        target->stride = (size_t)image.width * image.channels * image.bit_depth / 8;
+        try {
+            image.pixels.resize(target->stride * image.height);
+        } catch (const std::bad_alloc &) {
+            target->too_big = true;
+            decoder->error = 1;
+        }
+    }
+
+    void streamRow(void *user, unsigned y, const unsigned char *row, size_t size) {
+        StreamTarget *target = (StreamTarget*)user;
+        memcpy(&target->image->pixels[y * target->stride], row, size);
+    }
+
+    // The layouts streamHeader picks are all whole bytes per pixel, so the
+    // preview's rows are tightly packed like the image's
+    void streamPreview(void *user, unsigned, const unsigned char *pixels, unsigned width, unsigned height) {
+        StreamTarget *target = (StreamTarget*)user;
+        const TextureImage &image = *target->image;
+
+        TextureImage preview;
+        preview.width = width;
+        preview.height = height;
+        preview.channels = image.channels;
+        preview.bit_depth = image.bit_depth;
+        preview.levels = 1;
+        preview.pixels.assign(pixels, pixels + (size_t)width * height * image.channels * image.bit_depth / 8);
+        target->preview(target->preview_user, preview);
+    }
+
+    bool littleEndian() {
+        const GLushort one = 1;
+        return *(const unsigned char*)&one == 1;
+    }
+
+    // Upload a TextureImage's levels to the bound texture from pixels (its own,
+    // or a texture cache entry's), allocating them first unless the texture
+    // already has this size and layout. Grey textures get one or two channels,
+    // swizzled so shaders still sample (grey, grey, grey, alpha) as from RGBA;
+    // without swizzles they fall back to the old luminance formats.
+    void uploadTexture(const TextureImage &image, const unsigned char *pixels, bool allocate) {
+        bool swizzle = GLEW_VERSION_3_3 || GLEW_ARB_texture_swizzle;
+        GLint internal_format;
+        GLenum format, type;
+        textureFormat(image, swizzle, internal_format, format, type);
+        unsigned levels = image.levels > 1 ? image.levels : 1;
+
+        // The rows are tightly packed, and 16-bit samples big endian as in the PNG
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_SWAP_BYTES, image.bit_depth == 16 && littleEndian() ? GL_TRUE : GL_FALSE);
+        unsigned width = image.width, height = image.height;
+        for (unsigned level=0; level < levels; level++) {
+            if (allocate) {
+                glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, type, pixels);
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, type, pixels);
+            }
+            if (pixels != NULL) {
+                pixels += (size_t)width * height * image.channels * image.bit_depth / 8;
+            }
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        // Only sample the levels there are, so a texture without mip levels is still complete
+        if (allocate) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+
+        if (allocate && swizzle) {
+            GLint grey[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+            GLint grey_alpha[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+            GLint rgba[] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, image.channels == 1 ? grey : (image.channels == 2 ? grey_alpha : rgba));
+        }
+    }
+
+    // Round a file offset up so the arrays that follow stay aligned
+    GLuint alignOffset(GLuint offset) {
+        return (offset + 15) & ~15u;
+    }
+
+    // Find the runs of elements that differ between two equally long arrays as
+    // (first, count) pairs. Runs less than min_gap apart are merged, since one
+    // slightly bigger upload is cheaper than several small ones.
+    template <typename T>
+    void changedRuns(const T *old_items, const T *new_items, size_t count, std::vector<std::pair<size_t,size_t> > &runs) {
+        const size_t min_gap = 16;
+        runs.clear();
+
+        for (size_t i=0; i < count; i++) {
+            if (memcmp(&old_items[i], &new_items[i], sizeof(T)) == 0) {
+                continue;
+            }
+
+            if (!runs.empty() && i - (runs.back().first + runs.back().second) < min_gap) {
+                runs.back().second = i + 1 - runs.back().first;
+            } else {
+                runs.push_back(std::make_pair(i, (size_t)1));
+            }
+        }
+    }
+
+    // Narrow the index list down to index_size bytes per index
+    void packIndices(const std::vector<GLuint> &indices, GLuint index_size, std::vector<unsigned char> &packed) {
+        packed.resize(indices.size() * index_size);
+        for (size_t i=0; i < indices.size(); i++) {
+            if (index_size == 1) {
+                packed[i] = (unsigned char)indices[i];
+            } else if (index_size == 2) {
+                GLushort index = (GLushort)indices[i];
+                memcpy(&packed[i*2], &index, sizeof(index));
+            } else {
+                memcpy(&packed[i*4], &indices[i], sizeof(GLuint));
+            }
+        }
+    }
+}
+
+size_t textureSize(const TextureImage &image) {
+    size_t size = 0;
+    unsigned width = image.width, height = image.height;
+    for (unsigned level=0; level < image.levels || level == 0; level++) {
+        size += (size_t)width * height * image.channels * image.bit_depth / 8;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return size;
+}
+
+void textureFormat(const TextureImage &image, bool swizzle, GLint &internal_format, GLenum &format, GLenum &type) {
+    bool wide = image.bit_depth == 16;
+    switch (image.channels) {
+        case 1:
+            internal_format = swizzle ? (wide ? GL_R16 : GL_R8) : (wide ? GL_LUMINANCE16 : GL_LUMINANCE8);
+            format = swizzle ? GL_RED : GL_LUMINANCE;
+            break;
+        case 2:
+            internal_format = swizzle ? (wide ? GL_RG16 : GL_RG8) : (wide ? GL_LUMINANCE16_ALPHA16 : GL_LUMINANCE8_ALPHA8);
+            format = swizzle ? GL_RG : GL_LUMINANCE_ALPHA;
+            break;
+        case 3:
+            internal_format = wide ? GL_RGB16 : GL_RGB8;
+            format = GL_RGB;
+            break;
+        default:
+            internal_format = wide ? GL_RGBA16 : GL_RGBA8;
+            format = GL_RGBA;
+            break;
+    }
+    type = wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+}
+
+TextureDecoder::TextureDecoder(bool native_layout) : decoder(new LodePNG::Decoder()), native_layout(native_layout), preview(NULL), preview_user(NULL) {
+    // Text chunks would only cost allocations, textures don't use them
+    decoder->getSettings().readTextChunks = 0;
+}
+
+TextureDecoder::~TextureDecoder() {
+    delete decoder;
+}
+
+// Read the size of a PNG from its header
+bool TextureDecoder::size(const char *filename, unsigned &width, unsigned &height) {
+    MappedFile file(filename);
+    decoder->inspect(file.data(), file.size());
+
+    width = decoder->getWidth();
+    height = decoder->getHeight();
+    return file.isOpen() && !decoder->hasError();
+}
+
+// Decode a PNG straight from the mapped file into the caller's RGBA rows
+bool TextureDecoder::decode(const char *filename, unsigned char *pixels, size_t stride, size_t size, bool verify_checksums) {
+    MappedFile file(filename);
+    decoder->getSettings().ignoreCrc = !verify_checksums;
+    decoder->getSettings().zlibsettings.ignoreAdler32 = !verify_checksums;
+    decoder->getInfoRaw().color.colorType = 6;
+    decoder->getInfoRaw().color.bitDepth = 8;
+
+    decoder->decodeInto(pixels, stride, size, file.data(), file.size());
+    return file.isOpen() && !decoder->hasError();
+}
+
+// Load and decode a PNG, reading it a block at a time
+bool TextureDecoder::decode(const char *filename, TextureImage &image, bool verify_checksums) {
+    int fd = openFile(filename);
+    if (fd < 0) {
+        image.pixels.clear();
+        image.width = image.height = 0;
+        return false;
+    }
+
+    bool decoded = decodeStream(fd, image, verify_checksums);
+    closeFile(fd);
+    return decoded;
+}
+
+// Decode a PNG while reading it, each block before the next is read
+bool TextureDecoder::decodeStream(int fd, TextureImage &image, bool verify_checksums) {
+    decoder->getSettings().ignoreCrc = !verify_checksums;
+    decoder->getSettings().zlibsettings.ignoreAdler32 = !verify_checksums;
+
+    image.pixels.clear();
+    image.width = image.height = 0;
+    image.channels = 4;
+    image.bit_depth = 8;
+    image.levels = 1;
+
+    StreamTarget target = {&image, native_layout, 0, false, preview, preview_user};
+    LodePNG_StreamCallbacks callbacks = {&target, streamHeader, streamRow, preview ? streamPreview : NULL};
+    decoder->streamBegin(callbacks);
+
+    read_buffer.resize(stream_block);
+    long count = 0;
+    while (!decoder->hasError() && (count = readFile(fd, &read_buffer[0], read_buffer.size())) > 0) {
+        decoder->streamPush(&read_buffer[0], count);
+    }
+    decoder->streamEnd();
+
+    if (target.too_big) {
+        std::cout << "Error: a " << image.width << "x" << image.height << " texture is too big to decode" << std::endl;
+    }
+    return count >= 0 && !decoder->hasError();
+}
+
+void TextureDecoder::setPreview(TexturePreview callback, void *user) {
+    preview = callback;
+    preview_user = user;
+}
+
+bool decodeTexture(const char *filename, TextureImage &image, bool verify_checksums, bool native_layout) {
+    TextureDecoder decoder(native_layout);
+    return decoder.decode(filename, image, verify_checksums);
+}
+
+Model::Model() : index_size(sizeof(GLuint)), shader_program(0), texture_ids(NULL), texture_count(0), vao(0), buffer_ids(NULL), optimize_mesh(false), split_mesh(false), verify_checksums(true), cache_textures(true), texture_directory("data/images/"), texture_cache_directory("data/cache/"), mesh_file(NULL) {
+    memset(&vertex_format, 0, sizeof(vertex_format));
+}
+
+// Basic constructor that populates the object contents from a model file.
+// Files ending in ".mesh" are binary caches, anything else is YAML.
+Model::Model(const char *filename, bool optimize_mesh, bool split_mesh) : index_size(sizeof(GLuint)), shader_program(0), texture_ids(NULL), texture_count(0), vao(0), buffer_ids(NULL), optimize_mesh(optimize_mesh), split_mesh(split_mesh), verify_checksums(true), cache_textures(true), texture_directory("data/images/"), texture_cache_directory("data/cache/"), mesh_file(NULL) {
+    memset(&vertex_format, 0, sizeof(vertex_format));
+
+    if (read(filename)) {
+        upload();
+    }
+}
+
+Model::~Model() {
+    releaseStaging();
 }
 
 // Load up this object with the contents from a YAML model file
@@ -21,92 +360,494 @@ void Model::fromYAML(const char *filename) {
     // Make sure this object is clean
     //cleanUp();
 
-    // Load up the YAML file
+    if (!readYAML(filename)) {
+        return;
+    }
+    readAssets();
+    upload();
+}
+
+// Load up this object from a binary mesh cache written by toBinary. The
+// vertex and index arrays are uploaded straight out of the file mapping, so
+// vertex_list/index_list stay empty; use draw() or draw_ranges when drawing.
+bool Model::fromBinary(const char *filename) {
+    if (!readBinary(filename)) {
+        return false;
+    }
+
+    readAssets();
+    upload();
+    return true;
+}
+
+// Read a model file and everything it refers to, ready for upload(). Files
+// ending in ".mesh" are binary caches, anything else is YAML.
+bool Model::read(const char *filename, bool read_textures) {
+    size_t filename_len = strlen(filename);
+    if (filename_len > 5 && strcmp(filename+filename_len-5, ".mesh") == 0) {
+        if (!readBinary(filename)) {
+            return false;
+        }
+    } else if (!readYAML(filename)) {
+        return false;
+    }
+
+    readAssets(read_textures);
+    return true;
+}
+
+// Create the textures, shader program and buffer objects from what read()
+// prepared, then let go of the CPU-side copies
+void Model::upload() {
+    loadTextures();
+    loadShaders();
+
+    const GLvoid *vertices, *indices;
+    GLsizeiptr vertex_bytes, index_bytes;
+    stagedBuffers(vertices, vertex_bytes, indices, index_bytes);
+    loadBuffers(vertices, vertex_bytes, indices, index_bytes);
+
+    releaseStaging();
+}
+
+// Drop the CPU-side copies read() made. The texture sizes are kept so that
+// updateTexture can tell whether a new image fits the old texture.
+void Model::releaseStaging() {
+    for (size_t i=0; i < texture_images.size(); i++) {
+        std::vector<unsigned char>().swap(texture_images[i].pixels);
+    }
+    for (size_t i=0; i < texture_files.size(); i++) {
+        delete texture_files[i];
+    }
+    texture_files.clear();
+    std::vector<unsigned char>().swap(packed_vertices);
+    std::vector<unsigned char>().swap(packed_indices);
+    shader_sources.clear();
+
+    delete mesh_file;
+    mesh_file = NULL;
+}
+
+// The vertex/index arrays waiting to be uploaded, either packed by
+// readAssets() or still sitting in the mesh file mapping
+void Model::stagedBuffers(const GLvoid *&vertices, GLsizeiptr &vertex_bytes, const GLvoid *&indices, GLsizeiptr &index_bytes) const {
+    if (mesh_file != NULL) {
+        const unsigned char *data = mesh_file->data();
+        const MeshFileHeader *header = (const MeshFileHeader*)data;
+        vertices = data + header->vertex_offset;
+        vertex_bytes = (GLsizeiptr)header->vertex_count*header->vertex_size;
+        indices = data + header->index_offset;
+        index_bytes = (GLsizeiptr)header->index_count*header->index_size;
+    } else {
+        vertices = packed_vertices.empty() ? NULL : &packed_vertices[0];
+        vertex_bytes = packed_vertices.size();
+        indices = packed_indices.empty() ? NULL : &packed_indices[0];
+        index_bytes = packed_indices.size();
+    }
+}
+
+// Take the geometry from a copy of this model that has been read() again
+// after its file changed. When the layout and sizes match, only the runs of
+// vertices and indices that differ from vertex_list/index_list are sent with
+// glBufferSubData; otherwise the existing buffers are refilled. Either way the
+// VAO and buffer objects are kept.
+void Model::updateGeometry(Model &source) {
+    const GLvoid *vertices, *indices;
+    GLsizeiptr vertex_bytes, index_bytes;
+    source.stagedBuffers(vertices, vertex_bytes, indices, index_bytes);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_map[VERTEX_BUFFER]);
+
+    // The format includes the position scale/bias, so a match also means every
+    // unchanged vertex packs to the same bytes as before
+    bool same_format = memcmp(&vertex_format, &source.vertex_format, sizeof(VertexFormat)) == 0;
+    std::vector<std::pair<size_t,size_t> > runs;
+
+    if (same_format && !vertex_list.empty() && vertex_list.size() == source.vertex_list.size()) {
+        changedRuns(&vertex_list[0], &source.vertex_list[0], vertex_list.size(), runs);
+        for (size_t i=0; i < runs.size(); i++) {
+            GLintptr offset = runs[i].first * vertex_format.stride;
+            glBufferSubData(GL_ARRAY_BUFFER, offset, runs[i].second * vertex_format.stride, (const unsigned char*)vertices + offset);
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertices, GL_STATIC_DRAW);
+        if (!same_format) {
+            vertex_format = source.vertex_format;
+            setVertexAttributes(vertex_format);
+
+            glUseProgram(shader_program);
+            glUniform3fv(glGetUniformLocation(shader_program, "PositionScale"), 1, vertex_format.position_scale);
+            glUniform3fv(glGetUniformLocation(shader_program, "PositionBias"), 1, vertex_format.position_bias);
+        }
+    }
+
+    // The element buffer binding lives in the VAO, which is still bound
+    if (index_size == source.index_size && !index_list.empty() && index_list.size() == source.index_list.size()) {
+        changedRuns(&index_list[0], &source.index_list[0], index_list.size(), runs);
+        for (size_t i=0; i < runs.size(); i++) {
+            GLintptr offset = runs[i].first * index_size;
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, runs[i].second * index_size, (const unsigned char*)indices + offset);
+        }
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices, GL_STATIC_DRAW);
+    }
+
+    vertex_list.swap(source.vertex_list);
+    index_list.swap(source.index_list);
+    draw_ranges.swap(source.draw_ranges);
+    index_size = source.index_size;
+
+    source.releaseStaging();
+}
+
+// Replace the pixels of one texture, in place if the size and levels haven't changed
+void Model::updateTexture(size_t index, const TextureImage &image) {
+    if (index >= (size_t)texture_count || image.pixels.empty()) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture_ids[index]);
+    TextureImage &current = texture_images[index];
+    bool same_layout = image.channels == current.channels && image.bit_depth == current.bit_depth && image.levels == current.levels;
+    if (image.width == current.width && image.height == current.height && same_layout) {
+        uploadTexture(image, &image.pixels[0], false);
+    } else {
+        uploadTexture(image, &image.pixels[0], true);
+        current.width = image.width;
+        current.height = image.height;
+        current.channels = image.channels;
+        current.bit_depth = image.bit_depth;
+        current.levels = image.levels;
+    }
+}
+
+// Map a binary mesh cache written by toBinary and check it over. The mapping
+// is kept open until upload() so the arrays can be uploaded straight out of it.
+bool Model::readBinary(const char *filename) {
+    source_filename = filename;
+
+    delete mesh_file;
+    mesh_file = new MappedFile(filename);
+
+    const char *error = NULL;
+    const unsigned char *data = mesh_file->data();
+    const MeshFileHeader *header = (const MeshFileHeader*)data;
+    size_t file_size = mesh_file->size();
+
+    if (!mesh_file->isOpen() || file_size < sizeof(MeshFileHeader)) {
+        error = "could not be read";
+
+    // Make sure the file was written by a compatible build
+    } else if (memcmp(header->magic, MESH_FILE_MAGIC, 4) != 0 ||
+               header->version != MESH_FILE_VERSION ||
+               header->vertex_size != header->vertex_format.stride ||
+               (header->index_size != 1 && header->index_size != 2 && header->index_size != 4)) {
+        error = "is not compatible";
+
+    // Make sure every attribute is read from within a vertex
+    } else if (!vertexFormatFits(header->vertex_format)) {
+        error = "has a bad vertex format";
+
+    // Make sure every section lies within the file
+    } else if ((size_t)header->vertex_offset + (size_t)header->vertex_count*header->vertex_size > file_size ||
+               (size_t)header->index_offset + (size_t)header->index_count*header->index_size > file_size ||
+               (size_t)header->range_offset + (size_t)header->range_count*sizeof(DrawRange) > file_size ||
+               (size_t)header->string_offset + header->string_size > file_size ||
+               header->string_size == 0 || data[header->string_offset+header->string_size-1] != '\0') {
+        error = "is truncated";
+
+    // Make sure every draw range lies within the index buffer and only uses
+    // existing vertices. The indices themselves are trusted to be no higher
+    // than their range's max_index, so they can be uploaded without a pass over them.
+    } else {
+        const DrawRange *ranges = (const DrawRange*)(data + header->range_offset);
+        for (GLuint i=0; i < header->range_count; i++) {
+            const DrawRange &range = ranges[i];
+            if (range.index_count < 0 || (size_t)range.first_index + range.index_count > header->index_count ||
+                (range.index_count > 0 && (range.base_vertex < 0 || (size_t)range.base_vertex + range.max_index >= header->vertex_count))) {
+                error = "has a bad draw range";
+            }
+        }
+    }
+
+    if (error != NULL) {
+        std::cout << "Error: mesh file " << filename << " " << error << std::endl;
+        delete mesh_file;
+        mesh_file = NULL;
+        return false;
+    }
+
+    // Pull out the shader and texture names
+    const char *names = (const char*)data + header->string_offset;
+    const char *names_end = names + header->string_size;
+
+    shader_types shader_order[] = {VERTEX, FRAGMENT, GEOMETRY};
+    for (int i=0; i < 3 && names < names_end; i++) {
+        shader_filenames[shader_order[i]] = names;
+        names += strlen(names) + 1;
+    }
+
+    texture_filenames.clear();
+    for (GLuint i=0; i < header->texture_count && names < names_end; i++) {
+        texture_filenames.push_back(names);
+        names += strlen(names) + 1;
+    }
+
+    const DrawRange *ranges = (const DrawRange*)(data + header->range_offset);
+    draw_ranges.assign(ranges, ranges + header->range_count);
+
+    vertex_format = header->vertex_format;
+    index_size = header->index_size;
+
+    return true;
+}
+
+// Where the index'th texture is loaded from
+std::string Model::texturePath(size_t index) const {
+    return texture_directory + texture_filenames[index];
+}
+
+// Decode the textures (or map their texture cache entries), read the shader
+// sources and pack the vertex/index arrays (unless they are coming straight
+// from a mesh file) for upload()
+void Model::readAssets(bool read_textures) {
+    texture_images.clear();
+    texture_images.resize(texture_filenames.size());
+    for (size_t i=0; i < texture_files.size(); i++) {
+        delete texture_files[i];
+    }
+    texture_files.assign(texture_filenames.size(), (MappedFile*)NULL);
+
+    if (read_textures && cache_textures) {
+        TextureCache cache(texture_cache_directory.c_str());
+        for (size_t i=0; i < texture_filenames.size(); i++) {
+            texture_files[i] = new MappedFile();
+            cache.load(texturePath(i).c_str(), texture_images[i], *texture_files[i], verify_checksums);
+        }
+    } else if (read_textures) {
+        TextureDecoder decoder(true);
+        for (size_t i=0; i < texture_filenames.size(); i++) {
+            decoder.decode(texturePath(i).c_str(), texture_images[i], verify_checksums);
+        }
+    }
+
+    // Only the vertex and fragment shaders get used for now
+    shader_sources.clear();
+    shader_types shader_order[] = {VERTEX, FRAGMENT};
+    for (int i=0; i < 2; i++) {
+        std::string shader_fullpath = std::string(shader_path) + shader_filenames[shader_order[i]];
+
+        const char *shader_source = loadShader(shader_fullpath.c_str());
+        shader_sources[shader_order[i]] = shader_source;
+        delete[] shader_source;
+    }
+
+    if (mesh_file == NULL) {
+        packVertices(vertex_format, vertex_list.empty() ? NULL : &vertex_list[0], vertex_list.size(), packed_vertices);
+        packIndices(index_list, index_size, packed_indices);
+    }
+}
+
+// Parse a YAML model file into vertex_list, index_list, vertex_format and the
+// shader/texture names. Returns false if the file can't be opened or holds no document.
+bool Model::readYAML(const char *filename) {
+
+    // Set up the defaults for anything the file leaves out
+    vertex_list.clear();
+    index_list.clear();
+    texture_filenames.clear();
+
+    source_filename = filename;
+
+    delete mesh_file;
+    mesh_file = NULL;
+
+    shader_filenames[VERTEX] = "simple_shader.vert";
+    shader_filenames[FRAGMENT] = "simple_shader.frag";
+    shader_filenames[GEOMETRY] = "simple_shader.geom";
+
+    // Stream the YAML file straight into this object
     std::ifstream model_file(filename);
+    if (!model_file.is_open()) {
+        std::cout << "Error: unable to read model file " << filename << std::endl;
+        return false;
+    }
     YAML::Parser yaml_parser(model_file);
 
-    YAML::Node doc;
-    yaml_parser.GetNextDocument(doc);
-    const YAML::Node &mesh = doc["mesh"];
+    YAMLModelHandler handler(*this);
+    if (!yaml_parser.HandleNextDocument(handler)) {
+        std::cout << "Error: model file " << filename << " is empty" << std::endl;
+        return false;
+    }
 
-    // Load in the vertices
-    const YAML::Node &vertices = mesh["vertices"];
-    for (int i=0; i < vertices.size(); i++) {
-        // FIXME: Ensure the index order is correct
-        int index;
-        vertices[i]["index"] >> index;
+    if (optimize_mesh) {
+        optimizeMesh(filename);
+    }
 
-        Vertex vert;
-        vertices[i]["pos"][0] >> vert.x;
-        vertices[i]["pos"][1] >> vert.y;
-        vertices[i]["pos"][2] >> vert.z;
+    buildDrawRanges();
+    layoutVertexFormat(vertex_format, vertex_list);
+    return true;
+}
 
-        vertices[i]["tex"][0] >> vert.u0;
-        vertices[i]["tex"][1] >> vert.v0;
+// Reorder the triangles for vertex cache locality, then the vertices for fetch
+// locality, and report the cache statistics before and after
+void Model::optimizeMesh(const char *name) {
+    CacheStats before = analyzeVertexCache(index_list, vertex_list.size());
 
-        vertex_list.push_back(vert);
-    }
+    optimizeVertexCache(index_list, vertex_list.size());
+    optimizeVertexFetch(vertex_list, index_list);
+
+    CacheStats after = analyzeVertexCache(index_list, vertex_list.size());
 
-    // Load in the indices
-    const YAML::Node &indices = mesh["indices"];
-    for (int i=0; i < indices.size(); i++) {
-        // XXX: Shorten this
-        int i0, i1, i2;
-        indices[i][0] >> i0;
-        indices[i][1] >> i1;
-        indices[i][2] >> i2;
+    std::cout << name << ": ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
 
-        index_list.push_back(i0);
-        index_list.push_back(i1);
-        index_list.push_back(i2);
+// Pick the smallest index type that can address the mesh. With split_mesh set,
+// meshes too big for 16-bit indices are broken into sub-meshes first, each
+// drawn with its own base vertex, rather than falling back to 32-bit indices.
+void Model::buildDrawRanges() {
+    draw_ranges.clear();
+    if (split_mesh) {
+        splitMesh(vertex_list, index_list, draw_ranges);
+    } else {
+        DrawRange range = {0, (GLsizei)index_list.size(), 0, 0};
+        draw_ranges.push_back(range);
     }
 
-    // Load the texture filenames
-    if (const YAML::Node *textures = mesh.FindValue("textures")) {
-        const char *texture_path = "data/images/";
-        texture_count = textures->size();
-        texture_ids = new GLuint[texture_count];
-        glGenTextures(texture_count, texture_ids);
-        for (int i=0; i < texture_count; i++) {
-            std::string texture_filename;
-            (*textures)[i] >> texture_filename;
+    // Mesh files keep each range's highest index, so they can be checked against the vertices when loaded
+    GLuint max_index = 0;
+    for (size_t r=0; r < draw_ranges.size(); r++) {
+        DrawRange &range = draw_ranges[r];
+        range.max_index = 0;
+        for (GLsizei i=0; i < range.index_count; i++) {
+            GLuint index = index_list[range.first_index + i];
+            range.max_index = index > range.max_index ? index : range.max_index;
+        }
+        max_index = range.max_index > max_index ? range.max_index : max_index;
+    }
 
-            char *texture_fullpath = new char[texture_filename.size()+strlen(texture_path)+1];
-            strcpy(texture_fullpath, texture_path);
-            strcat(texture_fullpath, texture_filename.c_str());
+    if (max_index <= 0xff) {
+        index_size = sizeof(GLubyte);
+    } else if (max_index <= 0xffff) {
+        index_size = sizeof(GLushort);
+    } else {
+        index_size = sizeof(GLuint);
+    }
+}
 
-            std::vector<unsigned char> buffer, image;
-            LodePNG::Decoder decoder;
+// Draw every range of the index buffer with the bound shader program
+void Model::draw(GLenum mode) const {
+    GLenum index_type = GL_UNSIGNED_INT;
+    if (index_size == sizeof(GLubyte)) {
+        index_type = GL_UNSIGNED_BYTE;
+    } else if (index_size == sizeof(GLushort)) {
+        index_type = GL_UNSIGNED_SHORT;
+    }
 
-            LodePNG::loadFile(buffer, texture_fullpath);
-            decoder.decode(image, buffer.empty() ? 0 : &buffer[0], (unsigned)buffer.size());
+    glBindVertexArray(vao);
+    for (size_t i=0; i < draw_ranges.size(); i++) {
+        const DrawRange &range = draw_ranges[i];
+        glDrawElementsBaseVertex(mode, range.index_count, index_type,
+                                 (GLvoid*)((size_t)range.first_index*index_size), range.base_vertex);
+    }
+}
 
-            glBindTexture(GL_TEXTURE_2D, texture_ids[i]);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, decoder.getWidth(), decoder.getHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, &(image)[0]);
+// Write the loaded mesh out as a binary mesh cache that fromBinary can map
+bool Model::toBinary(const char *filename) const {
+    std::ofstream mesh_file(filename, std::ios::out | std::ios::binary);
+    if (!mesh_file.is_open()) {
+        return false;
+    }
 
-            buffer.clear();
-            image.clear();
+    // Gather the shader and texture names into one NUL separated block
+    std::string names;
+    shader_types shader_order[] = {VERTEX, FRAGMENT, GEOMETRY};
+    for (int i=0; i < 3; i++) {
+        std::map<shader_types,std::string>::const_iterator name_it = shader_filenames.find(shader_order[i]);
+        if (name_it != shader_filenames.end()) {
+            names += name_it->second;
         }
+        names += '\0';
+    }
+    for (size_t i=0; i < texture_filenames.size(); i++) {
+        names += texture_filenames[i];
+        names += '\0';
     }
 
-    // Load the shader filenames
-    const YAML::Node &shaders = mesh["shaders"];
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_FILE_MAGIC, 4);
+    header.version = MESH_FILE_VERSION;
+
+    std::vector<unsigned char> packed_vertices;
+    packVertices(vertex_format, vertex_list.empty() ? NULL : &vertex_list[0], vertex_list.size(), packed_vertices);
+
+    header.vertex_format = vertex_format;
+    header.vertex_size = vertex_format.stride;
+    header.vertex_count = vertex_list.size();
+    header.vertex_offset = alignOffset(sizeof(MeshFileHeader));
+
+    std::vector<unsigned char> packed_indices;
+    packIndices(index_list, index_size, packed_indices);
+
+    header.index_size = index_size;
+    header.index_count = index_list.size();
+    header.index_offset = alignOffset(header.vertex_offset + packed_vertices.size());
 
-    std::string vert_shader_filename = "simple_shader.vert";
-    std::string frag_shader_filename = "simple_shader.frag";
-    std::string geom_shader_filename = "simple_shader.geom";
+    header.texture_count = texture_filenames.size();
+    header.range_count = draw_ranges.size();
+    header.range_offset = alignOffset(header.index_offset + packed_indices.size());
 
-    if (const YAML::Node *vert_shader = shaders.FindValue("vertex")) {
-        *vert_shader >> vert_shader_filename;
+    header.string_offset = alignOffset(header.range_offset + header.range_count*sizeof(DrawRange));
+    header.string_size = names.size();
+
+    // Lay out each section at its offset, zero padding in between
+    std::vector<char> file_data(header.string_offset + header.string_size, 0);
+    memcpy(&file_data[0], &header, sizeof(header));
+    if (!packed_vertices.empty()) {
+        memcpy(&file_data[header.vertex_offset], &packed_vertices[0], packed_vertices.size());
+    }
+    if (!packed_indices.empty()) {
+        memcpy(&file_data[header.index_offset], &packed_indices[0], packed_indices.size());
+    }
+    if (!draw_ranges.empty()) {
+        memcpy(&file_data[header.range_offset], &draw_ranges[0], header.range_count*sizeof(DrawRange));
     }
-    if (const YAML::Node *frag_shader = shaders.FindValue("fragment")) {
-        *frag_shader >> frag_shader_filename;
+    memcpy(&file_data[header.string_offset], names.data(), names.size());
+
+    mesh_file.write(&file_data[0], file_data.size());
+    return mesh_file.good();
+}
+
+// Upload each of the textures readAssets() decoded or mapped
+void Model::loadTextures() {
+    texture_count = texture_images.size();
+    if (texture_count == 0) {
+        return;
     }
-    if (const YAML::Node *geom_shader = shaders.FindValue("geometry")) {
-        *geom_shader >> geom_shader_filename;
+
+    texture_ids = new GLuint[texture_count];
+    glGenTextures(texture_count, texture_ids);
+    for (int i=0; i < texture_count; i++) {
+        const TextureImage &image = texture_images[i];
+
+        // Straight from the texture cache entry's mapping when there is one
+        const unsigned char *pixels = image.pixels.empty() ? NULL : &image.pixels[0];
+        if (i < (int)texture_files.size() && texture_files[i] != NULL && texture_files[i]->isOpen()) {
+            const unsigned char *data = texture_files[i]->data();
+            pixels = data + ((const TextureFileHeader*)data)->data_offset;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, texture_ids[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        uploadTexture(image, pixels, true);
     }
+}
+
+// Compile and link the shader sources readAssets() read
+void Model::loadShaders() {
 
     // Create the shader program
     shader_program = glCreateProgramObjectARB();
@@ -115,26 +856,9 @@ void Model::fromYAML(const char *filename) {
     shader_map[VERTEX] = glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB);
     shader_map[FRAGMENT] = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
 
-    // Load the source for the vertex/fragment shaders
-    const char *shader_path = "data/shaders/";
-
-    char *vert_shader_fullpath = new char[vert_shader_filename.size()+strlen(shader_path)+1];
-    char *frag_shader_fullpath = new char[frag_shader_filename.size()+strlen(shader_path)+1];
-    char *geom_shader_fullpath = new char[geom_shader_filename.size()+strlen(shader_path)+1];
-
-    strcpy(vert_shader_fullpath, shader_path);
-    strcat(vert_shader_fullpath, vert_shader_filename.c_str());
+    const char *vert_shader_source = shader_sources[VERTEX].c_str();
+    const char *frag_shader_source = shader_sources[FRAGMENT].c_str();
 
-    strcpy(frag_shader_fullpath, shader_path);
-    strcat(frag_shader_fullpath, frag_shader_filename.c_str());
-
-    strcpy(geom_shader_fullpath, shader_path);
-    strcat(geom_shader_fullpath, geom_shader_filename.c_str());
-
-    const char *vert_shader_source = loadShader(vert_shader_fullpath);
-    const char *frag_shader_source = loadShader(frag_shader_fullpath);
-    //const char *geom_shader_source = loadShader(geom_shader_fullpath);
-    
     // Assign the shader source to the shader objects
     glShaderSource(shader_map[VERTEX], 1, &vert_shader_source, NULL);
     glShaderSource(shader_map[FRAGMENT], 1, &frag_shader_source, NULL);
@@ -143,9 +867,13 @@ void Model::fromYAML(const char *filename) {
     glCompileShader(shader_map[VERTEX]);
     glCompileShader(shader_map[FRAGMENT]);
 
-    // Bind vertex attributes to the vertex shader
-    glBindAttribLocation(shader_program, 0, "Vertex");
-    glBindAttribLocation(shader_program, 1, "TexCoord0");
+    // Bind vertex attributes to the vertex shader, at the locations setVertexAttributes uses
+    glBindAttribLocation(shader_program, ATTRIB_POSITION, "Vertex");
+    glBindAttribLocation(shader_program, ATTRIB_NORMAL, "Normal");
+    glBindAttribLocation(shader_program, ATTRIB_COLOR, "Color");
+    glBindAttribLocation(shader_program, ATTRIB_TEXCOORD0, "TexCoord0");
+    glBindAttribLocation(shader_program, ATTRIB_TEXCOORD1, "TexCoord1");
+    glBindAttribLocation(shader_program, ATTRIB_TEXCOORD2, "TexCoord2");
 
     // Bind the first draw buffer to the "FragColor" out variable for the frag shader
     glBindFragDataLocation(shader_program, GL_DRAW_BUFFER0, "FragColor");
@@ -157,6 +885,15 @@ void Model::fromYAML(const char *filename) {
     // Link the shader program to finalize the attachment process
     glLinkProgram(shader_program);
 
+    // Tell the vertex shader how to expand quantised positions
+    glUseProgram(shader_program);
+    glUniform3fv(glGetUniformLocation(shader_program, "PositionScale"), 1, vertex_format.position_scale);
+    glUniform3fv(glGetUniformLocation(shader_program, "PositionBias"), 1, vertex_format.position_bias);
+}
+
+// Create the vertex array and buffer objects and fill them from the given arrays
+void Model::loadBuffers(const GLvoid *vertices, GLsizeiptr vertex_bytes, const GLvoid *indices, GLsizeiptr index_bytes) {
+
     // Create the Vertex Array Object
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -168,28 +905,23 @@ void Model::fromYAML(const char *filename) {
     buffer_map[INDEX_BUFFER] = buffer_ids[1];
 
     glBindBuffer(GL_ARRAY_BUFFER, buffer_map[VERTEX_BUFFER]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex)*vertex_list.size(), &(vertex_list)[0], GL_STATIC_DRAW);
-
-    // Set up the vertex attribute for the vertex position (xyz)
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+    glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertices, GL_STATIC_DRAW);
 
-    // Set up the texcoord attribute for the vertex texture position (uv)
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, u0));
+    // Set up the attributes (position, texcoords, ...) the vertex format packs
+    setVertexAttributes(vertex_format);
 
     // Create an index buffer object for the cube, bind it, and populate it with index data
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_map[INDEX_BUFFER]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*index_list.size(), &(index_list)[0], GL_STATIC_DRAW);
-
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices, GL_STATIC_DRAW);
 }
 
 // Erase the contents of this object, essentially making it a blank slate
 void Model::cleanUp() {
     glUseProgramObjectARB(shader_program);
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        glDisableVertexAttribArray(i);
+    }
 
     // Clean up the shaders
     std::map<shader_types,GLuint>::iterator shader_map_it;
@@ -198,6 +930,7 @@ void Model::cleanUp() {
         glDeleteShader(shader_map_it->second);
     }
     shader_map.clear();
+    shader_filenames.clear();
 
     // Delete the shader program
     glDeleteProgram(shader_program);
@@ -211,8 +944,10 @@ void Model::cleanUp() {
     // Clear the vertex/index vectors
     vertex_list.clear();
     index_list.clear();
-    
+    draw_ranges.clear();
+
     // Delete the textures
     glDeleteTextures(texture_count, texture_ids);
     texture_ids = NULL;
+    texture_filenames.clear();
 }
@@ -0,0 +1,264 @@
+#include <exception>
+#include <iostream>
+#include <utility>
+
+#include "model_loader.h"
+#include "texture_cache.h"
+
+namespace {
+    // The indices a model's draw ranges cover, as index_list is empty for mesh files
+    size_t indexCount(const Model &model) {
+        size_t count = 0;
+        for (size_t i=0; i < model.draw_ranges.size(); i++) {
+            count += model.draw_ranges[i].index_count;
+        }
+        return count;
+    }
+}
+
+ModelLoader::ModelLoader(unsigned thread_count, bool progressive_textures) : pending_count(0), stopping(false), progressive_textures(progressive_textures) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+
+    for (unsigned i=0; i < thread_count; i++) {
+        workers.push_back(std::thread(&ModelLoader::workerLoop, this));
+    }
+}
+
+// Let the workers finish reading whatever is queued, then stop them. Models
+// that were read but never uploaded are left without GL objects.
+ModelLoader::~ModelLoader() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+
+    for (size_t i=0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    for (size_t i=0; i < read_models.size(); i++) {
+        if (read_models[i].reloaded_model != NULL) {
+            read_models[i].reloaded_model->releaseStaging();
+            delete read_models[i].reloaded_model;
+        }
+    }
+}
+
+// Queue a model file to be read on one of the workers
+void ModelLoader::load(Model *model, const char *filename) {
+    LoadJob job;
+    job.type = LOAD_MODEL;
+    job.model = model;
+    job.filename = filename;
+    job.read_ok = false;
+    job.reloaded_model = NULL;
+    job.texture_index = 0;
+
+    queueJob(job);
+}
+
+// Match changed files up with the models and textures loaded from them
+void ModelLoader::reloadChanged(const std::vector<std::string> &filenames, const std::vector<Model*> &models) {
+    for (size_t f=0; f < filenames.size(); f++) {
+        for (size_t m=0; m < models.size(); m++) {
+            Model *model = models[m];
+
+            LoadJob job;
+            job.model = model;
+            job.filename = filenames[f];
+            job.read_ok = false;
+            job.reloaded_model = NULL;
+            job.texture_index = 0;
+
+            if (model->source_filename == filenames[f]) {
+                job.type = RELOAD_MODEL;
+                queueJob(job);
+            }
+
+            job.type = RELOAD_TEXTURE;
+            for (size_t t=0; t < model->texture_filenames.size(); t++) {
+                if (model->texturePath(t) == filenames[f]) {
+                    job.texture_index = t;
+                    queueJob(job);
+                }
+            }
+        }
+    }
+}
+
+void ModelLoader::queueJob(const LoadJob &job) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        jobs.push_back(job);
+        pending_count++;
+    }
+    job_ready.notify_one();
+}
+
+// Hand a texture's preview to the GL thread; it is uploaded like a finished
+// texture, which replaces it later
+void ModelLoader::queuePreview(void *user, const TextureImage &preview) {
+    PreviewTarget *target = (PreviewTarget*)user;
+    ModelLoader *loader = target->loader;
+
+    LoadJob job;
+    job.type = TEXTURE_PREVIEW;
+    job.model = target->job->model;
+    job.filename = target->job->filename;
+    job.read_ok = true;
+    job.reloaded_model = NULL;
+    job.texture_index = target->job->texture_index;
+    job.texture_image = preview;
+
+    {
+        std::lock_guard<std::mutex> lock(loader->queue_mutex);
+        loader->read_models.push_back(std::move(job));
+        loader->pending_count++;
+    }
+    loader->model_ready.notify_one();
+}
+
+// Upload the models the workers have finished with, on the calling (GL) thread
+size_t ModelLoader::uploadReady(size_t max_models) {
+    size_t uploaded = 0;
+    while (max_models == 0 || uploaded < max_models) {
+        LoadJob job;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (read_models.empty()) {
+                break;
+            }
+            job = std::move(read_models.front());
+            read_models.pop_front();
+            pending_count--;
+        }
+
+        if (!job.read_ok) {
+            delete job.reloaded_model;
+            continue;
+        }
+
+        if (job.type == LOAD_MODEL) {
+            job.model->upload();
+        } else if (job.type == RELOAD_MODEL) {
+            // A model file caught half written, or emptied, would make the model
+            // vanish, so the old geometry stays until there is something to draw
+            if (indexCount(*job.reloaded_model) == 0) {
+                std::cout << "Error: " << job.filename << " has no triangles, keeping the old geometry" << std::endl;
+                delete job.reloaded_model;
+                continue;
+            }
+            job.model->updateGeometry(*job.reloaded_model);
+            delete job.reloaded_model;
+        } else {
+            job.model->updateTexture(job.texture_index, job.texture_image);
+        }
+        uploaded++;
+    }
+    return uploaded;
+}
+
+// Upload models as they come off the workers until none are left
+void ModelLoader::finish() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (read_models.empty() && pending_count > 0) {
+                model_ready.wait(lock);
+            }
+            if (pending_count == 0) {
+                return;
+            }
+        }
+        uploadReady();
+    }
+}
+
+size_t ModelLoader::pending() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return pending_count;
+}
+
+// Read queued models until the loader is destroyed
+void ModelLoader::workerLoop() {
+    // Texture reloads share one decoder, so its buffers get reused
+    TextureDecoder texture_decoder(true);
+
+    while (true) {
+        LoadJob job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (jobs.empty() && !stopping) {
+                job_ready.wait(lock);
+            }
+            if (jobs.empty()) {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        // A malformed model file throws out of the YAML parser. Reloads
+        // leave the textures alone, they get their own reload when changed.
+        try {
+            if (job.type == LOAD_MODEL) {
+                job.read_ok = job.model->read(job.filename.c_str(), !progressive_textures);
+            } else if (job.type == RELOAD_MODEL) {
+                job.reloaded_model = new Model();
+                job.reloaded_model->optimize_mesh = job.model->optimize_mesh;
+                job.reloaded_model->split_mesh = job.model->split_mesh;
+                job.reloaded_model->verify_checksums = job.model->verify_checksums;
+                job.reloaded_model->texture_directory = job.model->texture_directory;
+                job.reloaded_model->texture_cache_directory = job.model->texture_cache_directory;
+                job.read_ok = job.reloaded_model->read(job.filename.c_str(), false);
+            } else if (job.type == LOAD_TEXTURE) {
+                PreviewTarget target = {this, &job};
+                texture_decoder.setPreview(queuePreview, &target);
+                job.read_ok = texture_decoder.decode(job.filename.c_str(), job.texture_image, job.model->verify_checksums);
+                texture_decoder.setPreview(NULL);
+            } else {
+                job.read_ok = texture_decoder.decode(job.filename.c_str(), job.texture_image, job.model->verify_checksums);
+            }
+
+            // Give textures the mip levels they get from the texture cache when loaded whole
+            if ((job.type == LOAD_TEXTURE || job.type == RELOAD_TEXTURE) && job.read_ok && job.model->cache_textures) {
+                buildMipmaps(job.texture_image);
+            }
+        } catch (const std::exception &e) {
+            texture_decoder.setPreview(NULL);
+            std::cout << "Error: unable to load " << job.filename << ": " << e.what() << std::endl;
+        }
+
+        // A progressively loaded model goes up before its textures, which
+        // are queued behind it so their uploads can't overtake it
+        bool queued_textures = false;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (job.type == LOAD_MODEL && job.read_ok && progressive_textures) {
+                LoadJob texture_job;
+                texture_job.type = LOAD_TEXTURE;
+                texture_job.model = job.model;
+                texture_job.read_ok = false;
+                texture_job.reloaded_model = NULL;
+                for (size_t t=0; t < job.model->texture_filenames.size(); t++) {
+                    texture_job.filename = job.model->texturePath(t);
+                    texture_job.texture_index = t;
+                    jobs.push_back(texture_job);
+                    pending_count++;
+                    queued_textures = true;
+                }
+            }
+            read_models.push_back(std::move(job));
+        }
+        model_ready.notify_one();
+        if (queued_textures) {
+            job_ready.notify_all();
+        }
+    }
+}
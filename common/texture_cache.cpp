@@ -0,0 +1,303 @@
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "texture_cache.h"
+
+namespace {
+    typedef unsigned long long Hash;
+
+    // MurmurHash64A, eight bytes at a time; PNGs are hashed on every load, so
+    // it has to be a lot cheaper than decoding them
+    Hash hashBytes(const unsigned char *data, size_t size, Hash seed) {
+        const Hash m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        Hash h = seed ^ (size * m);
+
+        const unsigned char *end = data + (size & ~(size_t)7);
+        for (; data != end; data += 8) {
+            Hash k;
+            memcpy(&k, data, 8);
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        size_t tail = size & 7;
+        if (tail > 0) {
+            for (size_t i=tail; i > 0; i--) {
+                h ^= (Hash)data[i-1] << (8*(i-1));
+            }
+            h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+    // The key of a PNG's entry covers everything that changes what ends up in it
+    Hash textureKey(const MappedFile &png, bool mipmaps) {
+        const GLuint settings[] = {TEXTURE_FILE_VERSION, 1, mipmaps ? 1u : 0u};
+        Hash seed = hashBytes((const unsigned char*)settings, sizeof(settings), 0);
+        return hashBytes(png.data(), png.size(), seed);
+    }
+
+    // How many levels a full mip chain of this size has
+    unsigned levelCount(unsigned width, unsigned height) {
+        unsigned levels = 1;
+        while (width > 1 || height > 1) {
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            levels++;
+        }
+        return levels;
+    }
+
+    // Round a file offset up so the pixels that follow stay aligned
+    GLuint alignOffset(GLuint offset) {
+        return (offset + 15) & ~15u;
+    }
+
+    void makeDirectory(const std::string &directory) {
+        std::string path = directory;
+        while (path.size() > 1 && path[path.size()-1] == '/') {
+            path.erase(path.size()-1);
+        }
+#ifdef _WIN32
+        _mkdir(path.c_str());
+#else
+        mkdir(path.c_str(), 0755);
+#endif
+    }
+}
+
+// Average each 2x2 block of a level into a pixel of the next. Along an odd
+// edge the last row or column is left out, as the level sizes round down.
+void buildMipmaps(TextureImage &image) {
+    image.levels = 1;
+    if (image.width == 0 || image.height == 0) {
+        return;
+    }
+
+    image.levels = levelCount(image.width, image.height);
+    image.pixels.resize(textureSize(image));
+
+    bool wide = image.bit_depth == 16;
+    size_t pixel_size = image.channels * (wide ? 2 : 1);
+    unsigned char *source = &image.pixels[0];
+    unsigned width = image.width, height = image.height;
+
+    for (unsigned level=1; level < image.levels; level++) {
+        unsigned char *target = source + (size_t)width * height * pixel_size;
+        unsigned target_width = width > 1 ? width / 2 : 1;
+        unsigned target_height = height > 1 ? height / 2 : 1;
+        size_t row_size = width * pixel_size;
+
+        for (unsigned y=0; y < target_height; y++) {
+            const unsigned char *row0 = source + (size_t)(y*2) * row_size;
+            const unsigned char *row1 = height > 1 ? row0 + row_size : row0;
+            unsigned char *out = target + (size_t)y * target_width * pixel_size;
+
+            for (unsigned x=0; x < target_width; x++) {
+                size_t left = (size_t)(x*2) * pixel_size;
+                size_t right = width > 1 ? left + pixel_size : left;
+
+                if (wide) {
+                    // 16-bit samples are big endian
+                    for (size_t c=0; c < pixel_size; c += 2) {
+                        unsigned sum = ((row0[left+c] << 8) | row0[left+c+1]) + ((row0[right+c] << 8) | row0[right+c+1]) +
+                                       ((row1[left+c] << 8) | row1[left+c+1]) + ((row1[right+c] << 8) | row1[right+c+1]);
+                        unsigned average = (sum + 2) / 4;
+                        out[c] = (unsigned char)(average >> 8);
+                        out[c+1] = (unsigned char)average;
+                    }
+                } else {
+                    for (size_t c=0; c < pixel_size; c++) {
+                        out[c] = (unsigned char)((row0[left+c] + row0[right+c] + row1[left+c] + row1[right+c] + 2) / 4);
+                    }
+                }
+                out += pixel_size;
+            }
+        }
+
+        source = target;
+        width = target_width;
+        height = target_height;
+    }
+}
+
+TextureCache::TextureCache(const char *directory, bool mipmaps) : directory(directory), mipmaps(mipmaps), decoder(true) {
+    if (!this->directory.empty() && this->directory[this->directory.size()-1] != '/') {
+        this->directory += '/';
+    }
+}
+
+// Entries are named after the hex digits of their key
+std::string TextureCache::entryPath(const char *filename) {
+    MappedFile png(filename);
+    if (!png.isOpen()) {
+        return std::string();
+    }
+
+    char name[32];
+    sprintf(name, "%016llx.tex", textureKey(png, mipmaps));
+    return directory + name;
+}
+
+// Use the PNG's entry if it checks out, or decode the PNG and write a new one
+bool TextureCache::load(const char *filename, TextureImage &image, MappedFile &file, bool verify_checksums) {
+    file.close();
+
+    Hash key_hash;
+    {
+        MappedFile png(filename);
+        if (!png.isOpen()) {
+            image.pixels.clear();
+            image.width = image.height = 0;
+            image.levels = 1;
+            std::cout << "Error: unable to read texture " << filename << std::endl;
+            return false;
+        }
+        key_hash = textureKey(png, mipmaps);
+    }
+
+    GLuint key[2] = {(GLuint)key_hash, (GLuint)(key_hash >> 32)};
+    char name[32];
+    sprintf(name, "%016llx.tex", key_hash);
+    std::string path = directory + name;
+
+    if (readEntry(path, key, image, file)) {
+        return true;
+    }
+
+    if (!decoder.decode(filename, image, verify_checksums)) {
+        return false;
+    }
+    if (mipmaps) {
+        buildMipmaps(image);
+    }
+
+    if (!writeEntry(path, key, image)) {
+        std::cout << "Error: unable to write texture cache entry " << path << std::endl;
+    }
+    return true;
+}
+
+// Map an entry and make sure it was written by a compatible build, for this
+// key, and holds all the pixels its header promises
+bool TextureCache::readEntry(const std::string &path, const GLuint key[2], TextureImage &image, MappedFile &file) {
+    if (!file.open(path.c_str()) || file.size() < sizeof(TextureFileHeader)) {
+        file.close();
+        return false;
+    }
+
+    const TextureFileHeader *header = (const TextureFileHeader*)file.data();
+    TextureImage described;
+    described.width = header->width;
+    described.height = header->height;
+    described.channels = header->channels;
+    described.bit_depth = header->bit_depth;
+    described.levels = header->level_count;
+
+    bool valid = memcmp(header->magic, TEXTURE_FILE_MAGIC, 4) == 0 &&
+                 header->version == TEXTURE_FILE_VERSION &&
+                 header->key[0] == key[0] && header->key[1] == key[1] &&
+                 header->width > 0 && header->height > 0 &&
+                 header->channels >= 1 && header->channels <= 4 &&
+                 (header->bit_depth == 8 || header->bit_depth == 16) &&
+                 header->level_count == (mipmaps ? levelCount(header->width, header->height) : 1);
+
+    if (valid) {
+        GLint internal_format;
+        GLenum format, type;
+        textureFormat(described, true, internal_format, format, type);
+        valid = header->internal_format == (GLenum)internal_format && header->format == format && header->type == type &&
+                header->data_size == textureSize(described) &&
+                header->data_offset >= alignOffset(sizeof(TextureFileHeader)) &&
+                (size_t)header->data_offset + header->data_size <= file.size();
+    }
+
+    if (!valid) {
+        file.close();
+        return false;
+    }
+
+    image.width = described.width;
+    image.height = described.height;
+    image.channels = described.channels;
+    image.bit_depth = described.bit_depth;
+    image.levels = described.levels;
+    image.pixels.clear();
+    return true;
+}
+
+// Write the entry under a name of its own first and rename it into place, so
+// other threads or programs loading the same texture never see half an entry
+bool TextureCache::writeEntry(const std::string &path, const GLuint key[2], const TextureImage &image) {
+    TextureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TEXTURE_FILE_MAGIC, 4);
+    header.version = TEXTURE_FILE_VERSION;
+    header.key[0] = key[0];
+    header.key[1] = key[1];
+    header.width = image.width;
+    header.height = image.height;
+    header.channels = image.channels;
+    header.bit_depth = image.bit_depth;
+    header.level_count = image.levels;
+
+    GLint internal_format;
+    textureFormat(image, true, internal_format, header.format, header.type);
+    header.internal_format = internal_format;
+
+    header.data_offset = alignOffset(sizeof(header));
+    header.data_size = image.pixels.size();
+
+    makeDirectory(directory);
+
+    // Named after the process and thread, so no two writers share a temporary file
+    std::ostringstream temporary;
+#ifdef _WIN32
+    temporary << path << "." << _getpid() << "." << std::this_thread::get_id() << ".tmp";
+#else
+    temporary << path << "." << getpid() << "." << std::this_thread::get_id() << ".tmp";
+#endif
+    std::string temporary_path = temporary.str();
+
+    {
+        std::ofstream entry(temporary_path.c_str(), std::ios::out | std::ios::binary);
+        std::vector<char> padding(header.data_offset - sizeof(header), 0);
+        entry.write((const char*)&header, sizeof(header));
+        if (!padding.empty()) {
+            entry.write(&padding[0], padding.size());
+        }
+        entry.write((const char*)&image.pixels[0], image.pixels.size());
+        if (!entry.good()) {
+            entry.close();
+            remove(temporary_path.c_str());
+            return false;
+        }
+    }
+
+    // Windows won't rename over an existing file; then another loader got there first
+    if (rename(temporary_path.c_str(), path.c_str()) != 0) {
+        remove(temporary_path.c_str());
+    }
+    return true;
+}
@@ -0,0 +1,251 @@
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "vertex_format.h"
+
+namespace {
+    // How each attribute appears in model files, how many components it
+    // has, and where those components live in a Vertex
+    typedef struct {
+        const char *name;
+        int components;
+        size_t vertex_offset;
+    } AttributeInfo;
+
+    const AttributeInfo attribute_info[ATTRIB_COUNT] = {
+        {"pos",    3, offsetof(Vertex, x)},
+        {"normal", 3, offsetof(Vertex, nx)},
+        {"color",  4, offsetof(Vertex, r)},
+        {"tex",    2, offsetof(Vertex, u0)},
+        {"tex1",   2, offsetof(Vertex, u1)},
+        {"tex2",   2, offsetof(Vertex, u2)},
+    };
+
+    const char *type_names[] = {"none", "float", "half", "snorm16", "int_2_10_10_10", "unorm8"};
+
+    // Bytes an attribute takes up, padded so the next one stays 4-byte aligned
+    GLuint attributeSize(GLuint type, int components) {
+        GLuint size = 0;
+        switch (type) {
+            case ATTRIB_FLOAT:          size = 4*components; break;
+            case ATTRIB_HALF:           size = 2*components; break;
+            case ATTRIB_SNORM16:        size = 2*components; break;
+            case ATTRIB_INT_2_10_10_10: size = 4; break;
+            case ATTRIB_UNORM8:         size = components; break;
+        }
+        return (size + 3) & ~3u;
+    }
+
+    // Round to nearest even float -> IEEE half conversion
+    GLushort floatToHalf(float value) {
+        GLuint bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        GLuint sign = (bits >> 16) & 0x8000;
+        int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+        GLuint mantissa = bits & 0x7fffff;
+
+        // Infinity and NaN
+        if (((bits >> 23) & 0xff) == 0xff) {
+            return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+        }
+
+        // Too large for a half
+        if (exponent >= 31) {
+            return sign | 0x7c00;
+        }
+
+        // Denormal (or too small, flushing to zero)
+        if (exponent <= 0) {
+            if (exponent < -10) {
+                return sign;
+            }
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            GLuint half = mantissa >> shift;
+            GLuint remainder = mantissa & ((1u << shift) - 1);
+            GLuint halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (half & 1))) {
+                half++;
+            }
+            return sign | half;
+        }
+
+        // A carry out of the mantissa correctly bumps the exponent
+        GLuint half = sign | (exponent << 10) | (mantissa >> 13);
+        GLuint remainder = mantissa & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+            half++;
+        }
+        return half;
+    }
+
+    float clampUnit(float value, float low) {
+        return value < low ? low : (value > 1.0f ? 1.0f : value);
+    }
+
+    // Pack up to 4 signed normalised components into GL_INT_2_10_10_10_REV
+    GLuint packInt2101010(const GLfloat *components, int count) {
+        GLuint packed = 0;
+        for (int i=0; i < 3; i++) {
+            float value = i < count ? clampUnit(components[i], -1.0f) : 0.0f;
+            packed |= ((GLuint)(GLint)floorf(value * 511.0f + 0.5f) & 0x3ff) << (i*10);
+        }
+        float w = count > 3 ? clampUnit(components[3], -1.0f) : 0.0f;
+        packed |= ((GLuint)(GLint)floorf(w + 0.5f) & 0x3) << 30;
+        return packed;
+    }
+}
+
+// Look up an attribute name as written in model files, or -1 if unknown
+int attributeFromName(const char *name) {
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        if (strcmp(name, attribute_info[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Look up an attribute type name as written in model files, or -1 if unknown
+int attributeTypeFromName(const char *name) {
+    for (int i=ATTRIB_FLOAT; i <= ATTRIB_UNORM8; i++) {
+        if (strcmp(name, type_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Work out the offsets, stride and (for quantised positions) scale/bias of a format
+void layoutVertexFormat(VertexFormat &format, const std::vector<Vertex> &vertices) {
+    format.stride = 0;
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        // Packed 10-bit components need at least xyz
+        if (format.types[i] == ATTRIB_INT_2_10_10_10 && attribute_info[i].components < 3) {
+            format.types[i] = ATTRIB_HALF;
+        }
+
+        format.offsets[i] = format.stride;
+        format.stride += attributeSize(format.types[i], attribute_info[i].components);
+    }
+
+    for (int k=0; k < 3; k++) {
+        format.position_scale[k] = 1.0f;
+        format.position_bias[k] = 0.0f;
+    }
+
+    // Quantised positions cover the mesh's bounding box
+    if (format.types[ATTRIB_POSITION] == ATTRIB_SNORM16 && !vertices.empty()) {
+        for (int k=0; k < 3; k++) {
+            float low = (&vertices[0].x)[k];
+            float high = low;
+            for (size_t v=1; v < vertices.size(); v++) {
+                float value = (&vertices[v].x)[k];
+                low = value < low ? value : low;
+                high = value > high ? value : high;
+            }
+
+            format.position_bias[k] = (low + high) * 0.5f;
+            if (high > low) {
+                format.position_scale[k] = (high - low) * 0.5f;
+            }
+        }
+    }
+}
+
+// Check that every attribute of a format read from a file has a known type and
+// lies within the stride
+bool vertexFormatFits(const VertexFormat &format) {
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        if (format.types[i] > ATTRIB_UNORM8) {
+            return false;
+        }
+        if (format.types[i] != ATTRIB_NONE &&
+            (size_t)format.offsets[i] + attributeSize(format.types[i], attribute_info[i].components) > format.stride) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Convert vertices into the packed layout described by the format
+void packVertices(const VertexFormat &format, const Vertex *vertices, size_t vertex_count, std::vector<unsigned char> &packed) {
+    packed.assign(format.stride * vertex_count, 0);
+
+    for (size_t v=0; v < vertex_count; v++) {
+        unsigned char *dest_vertex = &packed[0] + format.stride * v;
+
+        for (int i=0; i < ATTRIB_COUNT; i++) {
+            const GLfloat *source = (const GLfloat*)((const char*)&vertices[v] + attribute_info[i].vertex_offset);
+            unsigned char *dest = dest_vertex + format.offsets[i];
+            int components = attribute_info[i].components;
+
+            switch (format.types[i]) {
+                case ATTRIB_NONE:
+                    break;
+                case ATTRIB_FLOAT:
+                    memcpy(dest, source, components*sizeof(GLfloat));
+                    break;
+                case ATTRIB_HALF:
+                    for (int k=0; k < components; k++) {
+                        GLushort half = floatToHalf(source[k]);
+                        memcpy(dest + k*sizeof(half), &half, sizeof(half));
+                    }
+                    break;
+                case ATTRIB_SNORM16:
+                    for (int k=0; k < components; k++) {
+                        float value = source[k];
+                        if (i == ATTRIB_POSITION) {
+                            value = (value - format.position_bias[k]) / format.position_scale[k];
+                        }
+                        GLshort snorm = (GLshort)floorf(clampUnit(value, -1.0f) * 32767.0f + 0.5f);
+                        memcpy(dest + k*sizeof(snorm), &snorm, sizeof(snorm));
+                    }
+                    break;
+                case ATTRIB_INT_2_10_10_10: {
+                    GLuint packed_value = packInt2101010(source, components);
+                    memcpy(dest, &packed_value, sizeof(packed_value));
+                    break;
+                }
+                case ATTRIB_UNORM8:
+                    for (int k=0; k < components; k++) {
+                        dest[k] = (unsigned char)floorf(clampUnit(source[k], 0.0f) * 255.0f + 0.5f);
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+// Point the attribute arrays of the bound VAO at the bound vertex buffer
+void setVertexAttributes(const VertexFormat &format) {
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        int components = attribute_info[i].components;
+        const GLvoid *offset = (const GLvoid*)(size_t)format.offsets[i];
+
+        switch (format.types[i]) {
+            case ATTRIB_NONE:
+                glDisableVertexAttribArray(i);
+                continue;
+            case ATTRIB_FLOAT:
+                glVertexAttribPointer(i, components, GL_FLOAT, GL_FALSE, format.stride, offset);
+                break;
+            case ATTRIB_HALF:
+                glVertexAttribPointer(i, components, GL_HALF_FLOAT, GL_FALSE, format.stride, offset);
+                break;
+            case ATTRIB_SNORM16:
+                glVertexAttribPointer(i, components, GL_SHORT, GL_TRUE, format.stride, offset);
+                break;
+            case ATTRIB_INT_2_10_10_10:
+                glVertexAttribPointer(i, 4, GL_INT_2_10_10_10_REV, GL_TRUE, format.stride, offset);
+                break;
+            case ATTRIB_UNORM8:
+                glVertexAttribPointer(i, components, GL_UNSIGNED_BYTE, GL_TRUE, format.stride, offset);
+                break;
+        }
+        glEnableVertexAttribArray(i);
+    }
+}
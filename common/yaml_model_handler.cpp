@@ -0,0 +1,199 @@
+#include "yaml-cpp/conversion.h"
+#include "yaml-cpp/exceptions.h"
+#include "yaml-cpp/mark.h"
+
+#include "model.h"
+#include "vertex.h"
+#include "yaml_model_handler.h"
+
+// Depth of each collection in the model file:
+//   0 - the document map          ("mesh")
+//   1 - the mesh map              ("vertices", "indices", "shaders", "textures", "format")
+//   2 - a section                 (sequence of vertices/triangles, map of shaders, ...)
+//   3 - a single vertex/triangle  (map with "index", "pos", "tex", ... / sequence of 3 indices)
+//   4 - a vertex field            ("pos", "normal", "color", "tex", "tex1" or "tex2" sequence)
+namespace {
+    enum {DOCUMENT_DEPTH, MESH_DEPTH, SECTION_DEPTH, ELEMENT_DEPTH, FIELD_DEPTH};
+}
+
+YAMLModelHandler::YAMLModelHandler(Model &model) : model(model), section(NO_SECTION), field(-1) {
+}
+
+void YAMLModelHandler::OnDocumentStart(const YAML::Mark&) {
+    collections.clear();
+    section = NO_SECTION;
+    field = -1;
+
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        attribute_present[i] = false;
+        attribute_types[i] = ATTRIB_FLOAT;
+    }
+}
+
+// Upload only the attributes the vertices actually had, in the requested types
+void YAMLModelHandler::OnDocumentEnd() {
+    for (int i=0; i < ATTRIB_COUNT; i++) {
+        model.vertex_format.types[i] = attribute_present[i] ? attribute_types[i] : (GLuint)ATTRIB_NONE;
+    }
+}
+
+void YAMLModelHandler::OnNull(const YAML::Mark& mark, YAML::anchor_t) {
+    OnScalar(mark, "", YAML::NullAnchor, "~");
+}
+
+// Aliased nodes aren't expanded, they just take up their slot
+void YAMLModelHandler::OnAlias(const YAML::Mark&, YAML::anchor_t) {
+    skipNode();
+}
+
+void YAMLModelHandler::OnScalar(const YAML::Mark& mark, const std::string&, YAML::anchor_t, const std::string& value) {
+    if (collections.empty()) {
+        return;
+    }
+
+    Collection &parent = collections.back();
+    if (parent.is_map && parent.expecting_key) {
+        parent.key = value;
+        parent.expecting_key = false;
+        return;
+    }
+
+    handleValue(mark, value);
+    nextEntry();
+}
+
+void YAMLModelHandler::OnSequenceStart(const YAML::Mark&, const std::string&, YAML::anchor_t) {
+    openCollection(false);
+}
+
+void YAMLModelHandler::OnSequenceEnd() {
+    closeCollection();
+}
+
+void YAMLModelHandler::OnMapStart(const YAML::Mark&, const std::string&, YAML::anchor_t) {
+    openCollection(true);
+}
+
+void YAMLModelHandler::OnMapEnd() {
+    closeCollection();
+}
+
+// Push a new collection, working out which part of the model it holds
+void YAMLModelHandler::openCollection(bool is_map) {
+    size_t depth = collections.size();
+
+    if (depth == SECTION_DEPTH && collections[DOCUMENT_DEPTH].key == "mesh") {
+        const std::string &key = collections[MESH_DEPTH].key;
+        if (key == "vertices") {
+            section = VERTICES;
+        } else if (key == "indices") {
+            section = INDICES;
+        } else if (key == "shaders") {
+            section = SHADERS;
+        } else if (key == "textures") {
+            section = TEXTURES;
+        } else if (key == "format") {
+            section = FORMAT;
+        }
+    } else if (depth == ELEMENT_DEPTH && section == VERTICES && is_map) {
+        model.vertex_list.push_back(Vertex());
+    } else if (depth == FIELD_DEPTH && section == VERTICES) {
+        field = attributeFromName(collections[ELEMENT_DEPTH].key.c_str());
+        if (field >= 0) {
+            attribute_present[field] = true;
+        }
+    }
+
+    Collection collection;
+    collection.is_map = is_map;
+    collection.expecting_key = true;
+    collection.index = 0;
+    collections.push_back(collection);
+}
+
+void YAMLModelHandler::closeCollection() {
+    collections.pop_back();
+
+    size_t depth = collections.size();
+    if (depth == SECTION_DEPTH) {
+        section = NO_SECTION;
+    } else if (depth == FIELD_DEPTH) {
+        field = -1;
+    }
+
+    skipNode();
+}
+
+// Store a scalar value in the model according to where it sits in the file
+void YAMLModelHandler::handleValue(const YAML::Mark& mark, const std::string& value) {
+    size_t depth = collections.size();
+
+    if (section == VERTICES && depth == FIELD_DEPTH+1 && field >= 0) {
+        // FIXME: Ensure the index order is correct
+        static const int component_counts[ATTRIB_COUNT] = {3, 3, 4, 2, 2, 2};
+        Vertex &vert = model.vertex_list.back();
+        GLfloat *components[ATTRIB_COUNT] = {&vert.x, &vert.nx, &vert.r, &vert.u0, &vert.u1, &vert.u2};
+
+        int component = collections[FIELD_DEPTH].index;
+        if (component >= component_counts[field]) {
+            return;
+        }
+
+        if (!YAML::Convert(value, components[field][component])) {
+            throw YAML::InvalidScalar(mark);
+        }
+    } else if (section == INDICES && depth == ELEMENT_DEPTH+1) {
+        // We assume triangles everywhere
+        if (collections[ELEMENT_DEPTH].index >= 3) {
+            return;
+        }
+
+        int index;
+        if (!YAML::Convert(value, index) || index < 0) {
+            throw YAML::InvalidScalar(mark);
+        }
+        model.index_list.push_back(index);
+    } else if (section == SHADERS && depth == SECTION_DEPTH+1) {
+        const std::string &key = collections[SECTION_DEPTH].key;
+        if (key == "vertex") {
+            model.shader_filenames[VERTEX] = value;
+        } else if (key == "fragment") {
+            model.shader_filenames[FRAGMENT] = value;
+        } else if (key == "geometry") {
+            model.shader_filenames[GEOMETRY] = value;
+        }
+    } else if (section == TEXTURES && depth == SECTION_DEPTH+1) {
+        model.texture_filenames.push_back(value);
+    } else if (section == FORMAT && depth == SECTION_DEPTH+1) {
+        int attribute = attributeFromName(collections[SECTION_DEPTH].key.c_str());
+        int type = attributeTypeFromName(value.c_str());
+        if (attribute < 0 || type < 0) {
+            throw YAML::InvalidScalar(mark);
+        }
+        attribute_types[attribute] = type;
+    }
+}
+
+// Step over a node we don't store, which may be a (complex) map key
+void YAMLModelHandler::skipNode() {
+    if (!collections.empty() && collections.back().is_map && collections.back().expecting_key) {
+        collections.back().key.clear();
+        collections.back().expecting_key = false;
+        return;
+    }
+    nextEntry();
+}
+
+// Move the innermost collection on to its next entry
+void YAMLModelHandler::nextEntry() {
+    if (collections.empty()) {
+        return;
+    }
+
+    Collection &parent = collections.back();
+    if (parent.is_map) {
+        parent.expecting_key = true;
+    } else {
+        parent.index++;
+    }
+}
@@ -3,9 +3,12 @@
 uniform mat4 Model;
 uniform mat4 View;
 uniform mat4 Projection;
+uniform vec3 PositionScale = vec3(1.0);
+uniform vec3 PositionBias = vec3(0.0);
 in vec3 Vertex;
 
 void main(void) {
-    gl_Position = Projection * ((View * Model) * vec4(Vertex, 1.0));
+    vec3 Position = Vertex * PositionScale + PositionBias;
+    gl_Position = Projection * ((View * Model) * vec4(Position, 1.0));
 }
 
@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include <SDL.h>
@@ -13,8 +14,11 @@
 
 #include "yaml-cpp/yaml.h"
 
+#include "asset_watcher.h"
+#include "frame_capture.h"
 #include "light.h"
 #include "model.h"
+#include "model_loader.h"
 #include "shader_util.h"
 #include "vertex.h"
 
@@ -109,6 +113,13 @@ int main(int argc, char **argv) {
     // Initialize our window
     initWindow(640, 480);
 
+    // With -c pattern, every frame is saved to pattern's printf of the frame
+    // number (e.g. -c capture/frame_%05d.png) in the background
+    FrameCapture *frame_capture = NULL;
+    if (argc > 2 && std::string(argv[1]) == "-c") {
+        frame_capture = new FrameCapture(argv[2]);
+    }
+
     // Create our vertex and index vectors
     std::vector<Vertex> vert_list;
     std::vector<GLushort> index_list;
@@ -116,6 +127,13 @@ int main(int argc, char **argv) {
     // Load up our model file
     Model cube("data/models/cube.yml");
 
+    // Watch the data directory so edited models and textures show up without a
+    // restart, leaving out the texture cache the loads write to
+    AssetWatcher asset_watcher("data", cube.texture_cache_directory.c_str());
+    ModelLoader model_loader(1);
+    std::vector<Model*> loaded_models(1, &cube);
+    std::vector<std::string> changed_files;
+
     // Create the lights in the scene
     Light light0;
     light0.pos[0] = 1.0f; light0.pos[1] = 0.6f; light0.pos[2] = 0.6f;
@@ -149,6 +167,11 @@ int main(int argc, char **argv) {
         // Call some generic window update functions
         updateWindow();
 
+        // Re-read any changed assets in the background, and apply one finished reload a frame
+        asset_watcher.changedFiles(changed_files);
+        model_loader.reloadChanged(changed_files, loaded_models);
+        model_loader.uploadReady(1);
+
         // Bind the "view_matrix" variable in our C++ program to the "View" variable in the shader
         glUniformMatrix4fv(
                 glGetUniformLocation(cube.shader_program, "View"),
@@ -182,14 +205,18 @@ int main(int argc, char **argv) {
         glUniform4fv(glGetUniformLocation(cube.shader_program, "light0_col"), 1, glm::value_ptr(light0.color));
         glUniform1f(glGetUniformLocation(cube.shader_program, "light0_int"), light0.intensity);
 
-        // Make our vertex array active
-        glBindVertexArray(cube.vao);
-
         // Tell the renderer to use our shader program when rendering our object
         glUseProgramObjectARB(cube.shader_program);
 
-        // Render the vao on the screen using "GL_LINE_LOOP"
-        glDrawElements(GL_TRIANGLES, cube.index_list.size(), GL_UNSIGNED_SHORT, (void*)0);
+        // Render each of the cube's index ranges on the screen
+        cube.draw(GL_TRIANGLES);
+
+        // Read the finished frame back before it's swapped away
+        if (frame_capture != NULL) {
+            int win_x, win_y;
+            SDL_GetWindowSize(main_window, &win_x, &win_y);
+            frame_capture->capture(win_x, win_y);
+        }
 
         // All the previous rendering was done on a buffer that's not being displayed on the screen.
         // SDL_GL_SwapWindow displays that buffer in our window.
@@ -199,6 +226,13 @@ int main(int argc, char **argv) {
         SDL_Delay(10);
     }
 
+    // Write out the last frames while the context is still around
+    if (frame_capture != NULL) {
+        frame_capture->finish();
+        std::cout << "Captured " << frame_capture->framesWritten() << " of " << frame_capture->framesCaptured() << " frames" << std::endl;
+        delete frame_capture;
+    }
+
     //Deinit SDL
     SDL_GL_DeleteContext(main_context);
     SDL_DestroyWindow(main_window);
@@ -26,10 +26,12 @@ freely, subject to the following restrictions:
 /*
 The manual and changelog can be found in the header file "lodepng.h"
 Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for C.
+This copy has been altered for GL-Playground, see the "GL-Playground" entries in the changes.
 */
 
 #include "lodepng.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -37,6 +39,71 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <fstream>
 #endif /*__cplusplus*/
 
+/*
+SIMD instruction sets used for unfiltering scanlines and computing checksums. SSE2
+and NEON are used whenever the compiler targets them; the SSSE3, AVX2 and PCLMULQDQ
+kernels are compiled alongside SSE2 and only picked at runtime when the CPU supports
+them (see cpuFeatures). The ARMv8 CRC32 instructions are used if the compiler
+targets them.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_SSE2
+#include <emmintrin.h>
+#if (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || defined(__clang__)
+#define LODEPNG_X86_RUNTIME
+#define LODEPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LODEPNG_TARGET_AVX2 __attribute__((target("avx2")))
+#define LODEPNG_TARGET_PCLMUL __attribute__((target("pclmul")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1700
+#define LODEPNG_X86_RUNTIME
+#define LODEPNG_TARGET_SSSE3
+#define LODEPNG_TARGET_AVX2
+#define LODEPNG_TARGET_PCLMUL
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LODEPNG_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#define LODEPNG_ARM_CRC32
+#include <arm_acle.h>
+#endif
+
+/*on little endian CPUs the inflate bit reader can load whole words of the stream at once*/
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64)
+#define LODEPNG_LITTLE_ENDIAN
+#endif
+
+/*
+The encoder can deflate and filter on several threads (LodeZlib_CompressSettings::threads),
+with Win32 or POSIX threads. They also guard the one-time setup (CPU detection, the CRC
+tables), so LodePNG can be used from several threads at once. Define LODEPNG_NO_THREADS
+to build without them, the work is then all done on the calling thread and LodePNG must
+only be used from one thread at a time.
+*/
+#if !defined(LODEPNG_NO_THREADS)
+#if defined(_WIN32)
+#define LODEPNG_WIN32_THREADS
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600 /*Vista, for InitOnceExecuteOnce*/
+#endif
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define LODEPNG_POSIX_THREADS
+#include <pthread.h>
+#endif
+#endif
+
+#if defined(LODEPNG_COMPILE_ENCODER) && (defined(LODEPNG_WIN32_THREADS) || defined(LODEPNG_POSIX_THREADS))
+#define LODEPNG_THREADS
+#endif
+
 #define VERSION_STRING "20110417"
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -63,6 +130,154 @@ Example: if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(9924);
 /*version of CERROR_BREAK that assumes the common case where the error variable is named "error"*/
 #define ERROR_BREAK(code) CERROR_BREAK(error, code)
 
+#define LODEPNG_CPU_SSE2 1
+#define LODEPNG_CPU_SSSE3 2
+#define LODEPNG_CPU_AVX2 4
+#define LODEPNG_CPU_PCLMUL 8
+#define LODEPNG_CPU_NEON 16
+
+/*
+runOnce(&once, function) calls function the first time it is reached with once, and
+makes any other thread getting there meanwhile wait until it has returned. once starts
+out as LODEPNG_ONCE_INIT.
+*/
+#if defined(LODEPNG_WIN32_THREADS)
+typedef INIT_ONCE LodeOnce;
+#define LODEPNG_ONCE_INIT INIT_ONCE_STATIC_INIT
+
+static BOOL CALLBACK runOnceFunction(PINIT_ONCE once, PVOID function, PVOID* context)
+{
+  (void)once;
+  (void)context;
+  (*(void (**)(void))function)();
+  return TRUE;
+}
+
+static void runOnce(LodeOnce* once, void (*function)(void))
+{
+  InitOnceExecuteOnce(once, runOnceFunction, &function, 0);
+}
+#elif defined(LODEPNG_POSIX_THREADS)
+typedef pthread_once_t LodeOnce;
+#define LODEPNG_ONCE_INIT PTHREAD_ONCE_INIT
+
+static void runOnce(LodeOnce* once, void (*function)(void))
+{
+  pthread_once(once, function);
+}
+#else /*no threads, a flag will do*/
+typedef int LodeOnce;
+#define LODEPNG_ONCE_INIT 0
+
+static void runOnce(LodeOnce* once, void (*function)(void))
+{
+  if(!*once)
+  {
+    *once = 1;
+    function();
+  }
+}
+#endif
+
+static LodeOnce cpuFeatures_detected = LODEPNG_ONCE_INIT;
+static unsigned cpuFeatures_found = 0;
+
+static void detectCpuFeatures(void)
+{
+  unsigned found = 0;
+#if defined(LODEPNG_X86_RUNTIME) && defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  if(info[2] & (1 << 9)) found |= LODEPNG_CPU_SSSE3;
+  if(info[2] & (1 << 1)) found |= LODEPNG_CPU_PCLMUL;
+  /*AVX2 also needs the OS to save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)*/
+  if((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6)
+  {
+    __cpuid(info, 0);
+    if(info[0] >= 7)
+    {
+      __cpuidex(info, 7, 0);
+      if(info[1] & (1 << 5)) found |= LODEPNG_CPU_AVX2;
+    }
+  }
+#elif defined(LODEPNG_X86_RUNTIME)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("ssse3")) found |= LODEPNG_CPU_SSSE3;
+  if(__builtin_cpu_supports("avx2")) found |= LODEPNG_CPU_AVX2;
+  if(__builtin_cpu_supports("pclmul")) found |= LODEPNG_CPU_PCLMUL;
+#endif /*LODEPNG_X86_RUNTIME*/
+#ifdef LODEPNG_SSE2
+  found |= LODEPNG_CPU_SSE2;
+#endif /*LODEPNG_SSE2*/
+#ifdef LODEPNG_NEON
+  found |= LODEPNG_CPU_NEON;
+#endif /*LODEPNG_NEON*/
+  cpuFeatures_found = found;
+}
+
+/*which of the instruction sets compiled in above this CPU supports, detected once*/
+static unsigned cpuFeatures(void)
+{
+  runOnce(&cpuFeatures_detected, detectCpuFeatures);
+  return cpuFeatures_found;
+}
+
+#ifdef LODEPNG_THREADS
+/*a thread running function(data), for the encoder's workers*/
+typedef struct LodeThread
+{
+  void (*function)(void*);
+  void* data;
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+} LodeThread;
+
+#ifdef _WIN32
+static DWORD WINAPI runThread(LPVOID thread)
+{
+  ((LodeThread*)thread)->function(((LodeThread*)thread)->data);
+  return 0;
+}
+
+/*returns 1 if the thread started, 0 if the caller should run function(data) itself*/
+static unsigned startThread(LodeThread* thread, void (*function)(void*), void* data)
+{
+  thread->function = function;
+  thread->data = data;
+  thread->handle = CreateThread(0, 0, runThread, thread, 0, 0);
+  return thread->handle != 0;
+}
+
+static void joinThread(LodeThread* thread)
+{
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+}
+#else /*_WIN32*/
+static void* runThread(void* thread)
+{
+  ((LodeThread*)thread)->function(((LodeThread*)thread)->data);
+  return 0;
+}
+
+/*returns 1 if the thread started, 0 if the caller should run function(data) itself*/
+static unsigned startThread(LodeThread* thread, void (*function)(void*), void* data)
+{
+  thread->function = function;
+  thread->data = data;
+  return pthread_create(&thread->handle, 0, runThread, thread) == 0;
+}
+
+static void joinThread(LodeThread* thread)
+{
+  pthread_join(thread->handle, 0);
+}
+#endif /*_WIN32*/
+#endif /*LODEPNG_THREADS*/
+
 /*
 About these tools (vector, uivector, ucvector and string):
 -LodePNG was originally written in C++. The vectors replace the std::vectors that were used in the C++ version.
@@ -376,25 +591,97 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+The decoder reads the bit stream through a buffer of up to a size_t worth of bits,
+the next one in the lowest bit, refilled a word at a time where possible. Past the
+end of the data the stream reads as zero bits: the callers check BitReader_position
+against the size where that matters.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t pos; /*next byte of data to load into the buffer*/
+  size_t buffer; /*bits loaded from data but not used yet*/
+  unsigned count; /*amount of bits in the buffer*/
+} BitReader;
+
+#define BITBUFFER_BITS (sizeof(size_t) * 8)
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  (*bitpointer)++;
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->pos = 0;
+  reader->buffer = 0;
+  reader->count = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*tops the buffer up to at least BITBUFFER_BITS - 7 bits*/
+static void BitReader_refill(BitReader* reader)
 {
-  unsigned result = 0, i;
-  for(i = 0; i < nbits; i++)
+#ifdef LODEPNG_LITTLE_ENDIAN
+  if(reader->pos + sizeof(size_t) <= reader->size)
+  {
+    /*load a whole word and keep the bytes that fit; the bits above count are always the right stream bits, so ORing them again is harmless*/
+    size_t word;
+    memcpy(&word, &reader->data[reader->pos], sizeof(word));
+    reader->buffer |= word << reader->count;
+    reader->pos += (BITBUFFER_BITS - 1 - reader->count) >> 3;
+    reader->count |= BITBUFFER_BITS - 8;
+    return;
+  }
+#endif /*LODEPNG_LITTLE_ENDIAN*/
+  while(reader->count <= BITBUFFER_BITS - 8)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    (*bitpointer)++;
+    size_t byte = reader->pos < reader->size ? reader->data[reader->pos] : 0;
+    reader->buffer |= byte << reader->count;
+    reader->pos++;
+    reader->count += 8;
   }
+}
+
+/*makes sure the buffer holds at least nbits bits, nbits must be at most 25*/
+static void BitReader_ensure(BitReader* reader, unsigned nbits)
+{
+  if(reader->count < nbits) BitReader_refill(reader);
+}
+
+/*the next nbits bits, which must be in the buffer already, without using them*/
+static unsigned BitReader_peek(const BitReader* reader, unsigned nbits)
+{
+  return (unsigned)(reader->buffer & (((size_t)1 << nbits) - 1));
+}
+
+static void BitReader_skip(BitReader* reader, unsigned nbits)
+{
+  reader->buffer >>= nbits;
+  reader->count -= nbits;
+}
+
+static unsigned BitReader_read(BitReader* reader, unsigned nbits)
+{
+  unsigned result;
+  BitReader_ensure(reader, nbits);
+  result = BitReader_peek(reader, nbits);
+  BitReader_skip(reader, nbits);
   return result;
 }
+
+/*the amount of bits used so far, this can go past the end of the data*/
+static size_t BitReader_position(const BitReader* reader)
+{
+  return reader->pos * 8 - reader->count;
+}
+
+/*skips to the start of the next byte and returns its position; the caller moves pos past what it reads from there*/
+static size_t BitReader_alignToByte(BitReader* reader)
+{
+  reader->pos = (BitReader_position(reader) + 7) / 8;
+  reader->buffer = 0;
+  reader->count = 0;
+  return reader->pos;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -406,6 +693,7 @@ static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bits
 #define NUM_DEFLATE_CODE_SYMBOLS 288 /*256 literals, the end code, some length codes, and 2 unused codes*/
 #define NUM_DISTANCE_SYMBOLS 32 /*the distance codes have their own symbols, 30 used, 2 unused*/
 #define NUM_CODE_LENGTH_CODES 19 /*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros*/
+#define MAX_HUFFMAN_BITLEN 15 /*the longest code deflate allows*/
 
 /*the base lengths represented by codes 257-285*/
 static const unsigned LENGTHBASE[29]
@@ -504,6 +792,8 @@ typedef struct HuffmanTree
   uivector lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  ucvector table_len; /*lookup table for the decoder, see HuffmanTree_makeTable: bits used by each entry*/
+  uivector table_value; /*lookup table for the decoder: symbol, or start of the subtable*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art*/
@@ -524,6 +814,8 @@ static void HuffmanTree_init(HuffmanTree* tree)
   uivector_init(&tree->tree2d);
   uivector_init(&tree->tree1d);
   uivector_init(&tree->lengths);
+  ucvector_init(&tree->table_len);
+  uivector_init(&tree->table_value);
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -531,6 +823,8 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   uivector_cleanup(&tree->tree2d);
   uivector_cleanup(&tree->tree1d);
   uivector_cleanup(&tree->lengths);
+  ucvector_cleanup(&tree->table_len);
+  uivector_cleanup(&tree->table_value);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -596,32 +890,22 @@ return value is error.
 */
 static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
 {
-  uivector blcount;
-  uivector nextcode;
-  unsigned bits, n, error = 0;
+  unsigned blcount[MAX_HUFFMAN_BITLEN + 1];
+  unsigned nextcode[MAX_HUFFMAN_BITLEN + 1];
+  unsigned bits, n;
 
-  uivector_init(&blcount);
-  uivector_init(&nextcode);
-  if(!uivector_resize(&tree->tree1d, tree->numcodes)
-  || !uivector_resizev(&blcount, tree->maxbitlen + 1, 0)
-  || !uivector_resizev(&nextcode, tree->maxbitlen + 1, 0))
-    error = 9902; /*alloc fail*/
-
-  if(!error)
-  {
-    /*step 1: count number of instances of each code length*/
-    for(bits = 0; bits < tree->numcodes; bits++) blcount.data[tree->lengths.data[bits]]++;
-    /*step 2: generate the nextcode values*/
-    for(bits = 1; bits <= tree->maxbitlen; bits++) nextcode.data[bits] = (nextcode.data[bits - 1] + blcount.data[bits - 1]) << 1;
-    /*step 3: generate all the codes*/
-    for(n = 0; n < tree->numcodes; n++) if(tree->lengths.data[n] != 0) tree->tree1d.data[n] = nextcode.data[tree->lengths.data[n]]++;
-  }
+  if(tree->maxbitlen > MAX_HUFFMAN_BITLEN) return 9902;
+  if(!uivector_resize(&tree->tree1d, tree->numcodes)) return 9902; /*alloc fail*/
 
-  uivector_cleanup(&blcount);
-  uivector_cleanup(&nextcode);
+  /*step 1: count number of instances of each code length*/
+  for(bits = 0; bits <= tree->maxbitlen; bits++) blcount[bits] = nextcode[bits] = 0;
+  for(bits = 0; bits < tree->numcodes; bits++) blcount[tree->lengths.data[bits]]++;
+  /*step 2: generate the nextcode values*/
+  for(bits = 1; bits <= tree->maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
+  /*step 3: generate all the codes*/
+  for(n = 0; n < tree->numcodes; n++) if(tree->lengths.data[n] != 0) tree->tree1d.data[n] = nextcode[tree->lengths.data[n]]++;
 
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return HuffmanTree_make2DTree(tree);
 }
 
 /*
@@ -765,69 +1049,140 @@ static unsigned HuffmanTree_getLength(const HuffmanTree* tree, unsigned index)
 /*get the literal and length code tree of a deflated block with fixed tree, as specified in the deflate specification*/
 static unsigned generateFixedLitLenTree(HuffmanTree* tree)
 {
-  unsigned i, error = 0;
-  uivector bitlen;
-  uivector_init(&bitlen);
-  if(!uivector_resize(&bitlen, NUM_DEFLATE_CODE_SYMBOLS)) error = 9909;
-
-  if(!error)
-  {
-    /*288 possible codes: 0-255=literals, 256=endcode, 257-285=lengthcodes, 286-287=unused*/
-    for(i =   0; i <= 143; i++) bitlen.data[i] = 8;
-    for(i = 144; i <= 255; i++) bitlen.data[i] = 9;
-    for(i = 256; i <= 279; i++) bitlen.data[i] = 7;
-    for(i = 280; i <= 287; i++) bitlen.data[i] = 8;
+  unsigned i;
+  unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 
-    error = HuffmanTree_makeFromLengths(tree, bitlen.data, NUM_DEFLATE_CODE_SYMBOLS, 15);
-  }
+  /*288 possible codes: 0-255=literals, 256=endcode, 257-285=lengthcodes, 286-287=unused*/
+  for(i =   0; i <= 143; i++) bitlen[i] = 8;
+  for(i = 144; i <= 255; i++) bitlen[i] = 9;
+  for(i = 256; i <= 279; i++) bitlen[i] = 7;
+  for(i = 280; i <= 287; i++) bitlen[i] = 8;
 
-  uivector_cleanup(&bitlen);
-  return error;
+  return HuffmanTree_makeFromLengths(tree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, 15);
 }
 
 /*get the distance code tree of a deflated block with fixed tree, as specified in the deflate specification*/
 static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 {
-  unsigned i, error = 0;
-  uivector bitlen;
-  uivector_init(&bitlen);
-  if(!uivector_resize(&bitlen, NUM_DISTANCE_SYMBOLS)) error = 9910;
+  unsigned i;
+  unsigned bitlen[NUM_DISTANCE_SYMBOLS];
 
   /*there are 32 distance codes, but 30-31 are unused*/
-  if(!error)
+  for(i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlen[i] = 5;
+  return HuffmanTree_makeFromLengths(tree, bitlen, NUM_DISTANCE_SYMBOLS, 15);
+}
+
+#ifdef LODEPNG_COMPILE_DECODER
+
+/*
+The decoder looks symbols up in a table instead of walking tree2d bit by bit. The
+next FIRSTBITS bits of the stream index the primary table. Codes that are longer
+point to a subtable, indexed by the bits after those. Both are filled in by walking
+tree2d for every possible bit pattern, so the lookup gives exactly what walking the
+tree would, including for incomplete or invalid trees.
+*/
+#define FIRSTBITS 9
+
+/*
+walks tree2d from the node treepos with the nbits bits of code (least significant
+bit first, the order they come in the stream) until reaching a symbol or an error.
+Returns the amount of bits used. *ct is set to the symbol, (unsigned)(-1) for an
+error, or when the bits ran out first, the address of the node reached (>= numcodes).
+*/
+static unsigned HuffmanTree_walk(const HuffmanTree* tree, unsigned treepos, unsigned code, unsigned nbits, unsigned* ct)
+{
+  unsigned i;
+  for(i = 0; i < nbits; i++)
   {
-    for(i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlen.data[i] = 5;
-    error = HuffmanTree_makeFromLengths(tree, bitlen.data, NUM_DISTANCE_SYMBOLS, 15);
+    *ct = tree->tree2d.data[(treepos << 1) + ((code >> i) & 1)];
+    if(*ct < tree->numcodes) return i + 1; /*the symbol is decoded*/
+    treepos = *ct - tree->numcodes;
+    if(treepos >= tree->numcodes)
+    {
+      *ct = (unsigned)(-1); /*error: it appeared outside the codetree*/
+      return i + 1;
+    }
   }
-  uivector_cleanup(&bitlen);
-  return error;
+  return nbits;
 }
 
-#ifdef LODEPNG_COMPILE_DECODER
+/*the most bits it takes to get from the node treepos to a symbol (or an error)*/
+static unsigned HuffmanTree_depth(const HuffmanTree* tree, unsigned treepos)
+{
+  unsigned bit, depth = 0;
+  for(bit = 0; bit < 2; bit++)
+  {
+    unsigned ct = tree->tree2d.data[(treepos << 1) + bit];
+    unsigned d = 1;
+    if(ct >= tree->numcodes && ct - tree->numcodes < tree->numcodes) d += HuffmanTree_depth(tree, ct - tree->numcodes);
+    if(d > depth) depth = d;
+  }
+  return depth;
+}
+
+/*builds the lookup table used by huffmanDecodeSymbol from tree2d. return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  unsigned i, j;
+  if(!ucvector_resize(&tree->table_len, 1u << FIRSTBITS)) return 9956;
+  if(!uivector_resize(&tree->table_value, 1u << FIRSTBITS)) return 9956;
+
+  for(i = 0; i < (1u << FIRSTBITS); i++)
+  {
+    unsigned ct;
+    unsigned len = HuffmanTree_walk(tree, 0, i, FIRSTBITS, &ct);
+    if(ct < tree->numcodes || ct == (unsigned)(-1))
+    {
+      tree->table_len.data[i] = (unsigned char)len;
+      tree->table_value.data[i] = ct;
+    }
+    else /*a longer code, give it a subtable for the bits after the first FIRSTBITS*/
+    {
+      unsigned treepos = ct - tree->numcodes;
+      unsigned subbits = HuffmanTree_depth(tree, treepos);
+      size_t start = tree->table_len.size;
+
+      if(!ucvector_resize(&tree->table_len, start + (1u << subbits))) return 9956;
+      if(!uivector_resize(&tree->table_value, start + (1u << subbits))) return 9956;
+      tree->table_len.data[i] = (unsigned char)(FIRSTBITS + subbits);
+      tree->table_value.data[i] = (unsigned)start;
+
+      for(j = 0; j < (1u << subbits); j++)
+      {
+        len = HuffmanTree_walk(tree, treepos, j, subbits, &ct);
+        tree->table_len.data[start + j] = (unsigned char)len;
+        tree->table_value.data[start + j] = ct;
+      }
+    }
+  }
+
+  return 0;
+}
 
 /*
 returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+codes are at most 15 bits, so one BitReader_ensure covers both table lookups
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
-  {
-    if(*bp > inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+  unsigned index, len, value;
 
-    /*
-    decode the symbol from the tree
-    the "readBitFromStream" code is inlined in the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d.data[(treepos << 1) + READBIT(*bp, in)];
-    (*bp)++;
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
+  BitReader_ensure(reader, 15);
+  index = BitReader_peek(reader, FIRSTBITS);
+  len = codetree->table_len.data[index];
+  value = codetree->table_value.data[index];
 
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+  if(len > FIRSTBITS)
+  {
+    BitReader_skip(reader, FIRSTBITS);
+    index = value + BitReader_peek(reader, len - FIRSTBITS);
+    len = codetree->table_len.data[index];
+    value = codetree->table_value.data[index];
   }
+
+  BitReader_skip(reader, len);
+  if(BitReader_position(reader) > reader->size * 8) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+  return value;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -837,70 +1192,91 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* / Inflator                                                               / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+The Huffman trees inflate decodes with. They are kept from one block to the next,
+and a LodePNG_Decoder keeps them from one image to the next, so their buffers are
+only allocated while they grow. The fixed trees are only rebuilt when a dynamic
+block replaced them.
+*/
+typedef struct LodeFlate_Trees
+{
+  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
+  HuffmanTree tree_d; /*the huffman tree for distance codes*/
+  HuffmanTree tree_cl; /*the huffman tree for the code lengths of a dynamic block*/
+  unsigned fixed; /*whether tree_ll and tree_d hold the fixed trees*/
+} LodeFlate_Trees;
+
+static void LodeFlate_Trees_init(LodeFlate_Trees* trees)
+{
+  HuffmanTree_init(&trees->tree_ll);
+  HuffmanTree_init(&trees->tree_d);
+  HuffmanTree_init(&trees->tree_cl);
+  trees->fixed = 0;
+}
+
+static void LodeFlate_Trees_cleanup(LodeFlate_Trees* trees)
+{
+  HuffmanTree_cleanup(&trees->tree_ll);
+  HuffmanTree_cleanup(&trees->tree_d);
+  HuffmanTree_cleanup(&trees->tree_cl);
+  trees->fixed = 0;
+}
+
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*error checking not done, this is fixed stuff, it works, it doesn't depend on the image*/
-  /*TODO: out of memory errors could still happen...*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  unsigned error = generateFixedLitLenTree(tree_ll);
+  if(!error) error = generateFixedDistanceTree(tree_d);
+  if(!error) error = HuffmanTree_makeTable(tree_ll);
+  if(!error) error = HuffmanTree_makeTable(tree_d);
+  return error;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, HuffmanTree* tree_cl, BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
-  uivector bitlen_ll; /*lit,len code lengths*/
-  uivector bitlen_d; /*dist code lengths*/
-  uivector bitlen_cl; /*code length code lengths ("clcl"), the bit lengths of the huffman tree used to compress bitlen_ll and bitlen_d*/
-  HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
-
-  if((*bp) >> 3 >= inlength - 2) return 49; /*the bit pointer is or will go past the memory*/
+  unsigned bitlen_ll[NUM_DEFLATE_CODE_SYMBOLS]; /*lit,len code lengths*/
+  unsigned bitlen_d[NUM_DISTANCE_SYMBOLS]; /*dist code lengths*/
+  unsigned bitlen_cl[NUM_CODE_LENGTH_CODES]; /*code length code lengths ("clcl"), the bit lengths of the huffman tree used to compress bitlen_ll and bitlen_d*/
+  /*tree_cl is the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  HLIT =  readBitsFromStream(bp, in, 5) + 257; /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1; /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4; /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
+  if((BitReader_position(reader) >> 3) + 2 >= reader->size) return 49; /*the bit pointer is or will go past the memory*/
 
-  HuffmanTree_init(&tree_cl);
-  uivector_init(&bitlen_ll);
-  uivector_init(&bitlen_d);
-  uivector_init(&bitlen_cl);
+  HLIT =  BitReader_read(reader, 5) + 257; /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
+  HDIST = BitReader_read(reader, 5) + 1; /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
+  HCLEN = BitReader_read(reader, 4) + 4; /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
 
   while(!error)
   {
     /*read the code length codes out of 3 * (amount of code length codes) bits*/
-    
-    if(!uivector_resize(&bitlen_cl, NUM_CODE_LENGTH_CODES)) ERROR_BREAK(9911);
-
     for(i = 0; i < NUM_CODE_LENGTH_CODES; i++)
     {
-      if(i < HCLEN) bitlen_cl.data[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
-      else bitlen_cl.data[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = BitReader_read(reader, 3);
+      else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
-    error = HuffmanTree_makeFromLengths(&tree_cl, bitlen_cl.data, bitlen_cl.size, 7);
+    error = HuffmanTree_makeFromLengths(tree_cl, bitlen_cl, NUM_CODE_LENGTH_CODES, 7);
+    if(!error) error = HuffmanTree_makeTable(tree_cl);
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
-    uivector_resizev(&bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 0);
-    uivector_resizev(&bitlen_d, NUM_DISTANCE_SYMBOLS, 0);
+    for(i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) bitlen_ll[i] = 0;
+    for(i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlen_d[i] = 0;
     i = 0;
-    if(!bitlen_ll.data || !bitlen_d.data) ERROR_BREAK(9912); /*alloc fail*/
 
     /*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes*/
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code = huffmanDecodeSymbol(reader, tree_cl);
       if(code <= 15) /*a length code*/
       {
-        if(i < HLIT) bitlen_ll.data[i] = code;
-        else bitlen_d.data[i - HLIT] = code;
+        if(i < HLIT) bitlen_ll[i] = code;
+        else bitlen_d[i - HLIT] = code;
         i++;
       }
       else if(code == 16) /*repeat previous*/
@@ -908,52 +1284,52 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         unsigned replength = 3; /*read in the 2 bits that indicate repeat length (3-6)*/
         unsigned value; /*set value to the previous code*/
 
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if((BitReader_position(reader) >> 3) >= reader->size) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 2);
+        replength += BitReader_read(reader, 2);
 
-        if((i - 1) < HLIT) value = bitlen_ll.data[i - 1];
-        else value = bitlen_d.data[i - HLIT - 1];
+        if((i - 1) < HLIT) value = bitlen_ll[i - 1];
+        else value = bitlen_d[i - HLIT - 1];
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
         {
           if(i >= HLIT + HDIST) ERROR_BREAK(13); /*error: i is larger than the amount of codes*/
-          if(i < HLIT) bitlen_ll.data[i] = value;
-          else bitlen_d.data[i - HLIT] = value;
+          if(i < HLIT) bitlen_ll[i] = value;
+          else bitlen_d[i - HLIT] = value;
           i++;
         }
       }
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if((BitReader_position(reader) >> 3) >= reader->size) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 3);
+        replength += BitReader_read(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
         {
           if(i >= HLIT + HDIST) ERROR_BREAK(14); /*error: i is larger than the amount of codes*/
 
-          if(i < HLIT) bitlen_ll.data[i] = 0;
-          else bitlen_d.data[i - HLIT] = 0;
+          if(i < HLIT) bitlen_ll[i] = 0;
+          else bitlen_d[i - HLIT] = 0;
           i++;
         }
       }
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp) >> 3 >= inlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if((BitReader_position(reader) >> 3) >= reader->size) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 7);
+        replength += BitReader_read(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
         {
           if(i >= HLIT + HDIST) ERROR_BREAK(15); /*error: i is larger than the amount of codes*/
 
-          if(i < HLIT) bitlen_ll.data[i] = 0;
-          else bitlen_d.data[i - HLIT] = 0;
+          if(i < HLIT) bitlen_ll[i] = 0;
+          else bitlen_d[i - HLIT] = 0;
           i++;
         }
       }
@@ -961,7 +1337,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       {
         if(code == (unsigned)(-1))
         {
-          error = (*bp) > inlength * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
+          error = BitReader_position(reader) > reader->size * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -969,45 +1345,98 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     }
     if(error) break;
 
-    if(bitlen_ll.data[256] == 0) ERROR_BREAK(64); /*the length of the end code 256 must be larger than 0*/
+    if(bitlen_ll[256] == 0) ERROR_BREAK(64); /*the length of the end code 256 must be larger than 0*/
 
     /*now we've finally got HLIT and HDIST, so generate the code trees, and the function is done*/
-    error = HuffmanTree_makeFromLengths(tree_ll, &bitlen_ll.data[0], bitlen_ll.size, 15);
+    error = HuffmanTree_makeFromLengths(tree_ll, bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 15);
+    if(!error) error = HuffmanTree_makeTable(tree_ll);
     if(error) break;
-    error = HuffmanTree_makeFromLengths(tree_d, &bitlen_d.data[0], bitlen_d.size, 15);
+    error = HuffmanTree_makeFromLengths(tree_d, bitlen_d, NUM_DISTANCE_SYMBOLS, 15);
+    if(!error) error = HuffmanTree_makeTable(tree_d);
 
     break; /*end of error-while*/
   }
 
-  uivector_cleanup(&bitlen_cl);
-  uivector_cleanup(&bitlen_ll);
-  uivector_cleanup(&bitlen_d);
-  HuffmanTree_cleanup(&tree_cl);
-
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength, unsigned btype)
+/*
+copies a match of length bytes from distance bytes back in out to pos. room is how
+many bytes out has from pos on; with enough spare room, whole chunks are copied even
+if that writes a little past the match, the bytes after it get overwritten later.
+*/
+static void copyMatch(unsigned char* out, size_t pos, size_t distance, size_t length, size_t room)
 {
-  unsigned error = 0;
-  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
-  HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  unsigned char* dest = &out[pos];
+  const unsigned char* source = dest - distance;
+  size_t i;
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
+  if(distance >= 16 && length + 16 <= room)
+  {
+    for(i = 0; i < length; i += 16) memcpy(&dest[i], &source[i], 16);
+  }
+  else if(distance >= 8 && length + 8 <= room)
+  {
+    for(i = 0; i < length; i += 8) memcpy(&dest[i], &source[i], 8);
+  }
+  else if(distance >= length)
+  {
+    memcpy(dest, source, length);
+  }
+  else if(distance == 1)
+  {
+    memset(dest, source[0], length);
+  }
+  else
+  {
+    /*
+    an overlapping run: repeat the distance bytes before pos. Each copy doubles the
+    stretch of the repeated pattern available, and never overlaps what it reads
+    */
+    size_t stretch = distance;
+    while(length > stretch)
+    {
+      memcpy(dest, dest - stretch, stretch);
+      dest += stretch;
+      length -= stretch;
+      stretch *= 2;
+    }
+    memcpy(dest, dest - stretch, length);
+  }
+}
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
+/*makes the trees of a block with fixed (btype 1) or dynamic (btype 2) Huffman trees, reading the latter from its header*/
+static unsigned getTreesInflate(LodeFlate_Trees* trees, BitReader* reader, unsigned btype)
+{
+  unsigned error = 0;
+  if(btype == 1)
+  {
+    if(!trees->fixed) error = getTreeInflateFixed(&trees->tree_ll, &trees->tree_d);
+    trees->fixed = !error;
+  }
   else if(btype == 2)
   {
-    error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+    trees->fixed = 0;
+    error = getTreeInflateDynamic(&trees->tree_ll, &trees->tree_d, &trees->tree_cl, reader);
   }
+  return error;
+}
+
+/*
+decodes the symbols of a Huffman block into out from *pos on, until the end code,
+which sets *end. The stream inflater stops it early, between two symbols, once *pos
+reaches outlimit or the reader inlimit bits; inflating all at once they're (size_t)(-1)
+*/
+static unsigned inflateSymbols(ucvector* out, BitReader* reader, size_t* pos, const LodeFlate_Trees* trees, size_t outlimit, size_t inlimit, unsigned* end)
+{
+  unsigned error = 0;
+  const HuffmanTree* tree_ll = &trees->tree_ll;
+  const HuffmanTree* tree_d = &trees->tree_d;
 
-  for(;;) /*decode all symbols until end reached*/
+  while(!error && (*pos) < outlimit && BitReader_position(reader) < inlimit) /*decode all symbols until end reached*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll = huffmanDecodeSymbol(reader, tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
       if((*pos) >= out->size)
@@ -1022,23 +1451,23 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
-      
+      size_t length;
+
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(((*bp) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if((BitReader_position(reader) >> 3) >= reader->size) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      length += BitReader_read(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, tree_d);
       if(code_d > 29)
       {
-        if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+        if(code_d == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
-          error = (*bp) > inlength * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
+          error = BitReader_position(reader) > reader->size * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1047,135 +1476,319 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if(((*bp) >> 3) >= inlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      if((BitReader_position(reader) >> 3) >= reader->size) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
 
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      distance += BitReader_read(reader, numextrabits_d);
+      if(distance > (*pos)) ERROR_BREAK(81); /*error: the match starts before the start of the output*/
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = (*pos);
-      backward = start - distance;
-      if((*pos) + length >= out->size)
+      if((*pos) + length > out->size)
       {
         /*reserve more room at once*/
         if(!ucvector_resize(out, ((*pos) + length) * 2)) ERROR_BREAK(9914 /*alloc fail*/);
       }
 
-      for(forward = 0; forward < length; forward++)
-      {
-        out->data[(*pos)] = out->data[backward];
-        (*pos)++;
-        backward++;
-        if(backward >= start) backward = start - distance;
-      }
+      copyMatch(out->data, (*pos), distance, length, out->size - (*pos));
+      (*pos) += length;
     }
     else if(code_ll == 256)
     {
+      *end = 1;
       break; /*end code, break the loop*/
     }
     else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
     {
-      error = (*bp) > inlength * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
+      error = BitReader_position(reader) > reader->size * 8 ? 10 : 11; /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol (10=no endcode, 11=wrong jump outside of tree)*/
       break;
     }
   }
 
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
+  return error;
+}
 
+/*inflate a block with dynamic of fixed Huffman tree*/
+static unsigned inflateHuffmanBlock(ucvector* out, BitReader* reader, size_t* pos, unsigned btype, LodeFlate_Trees* trees)
+{
+  unsigned end = 0;
+  unsigned error = getTreesInflate(trees, reader, btype);
+  if(!error) error = inflateSymbols(out, reader, pos, trees, (size_t)(-1), (size_t)(-1), &end);
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, BitReader* reader, size_t* pos)
 {
   /*go to first boundary of byte*/
-  size_t p;
-  unsigned LEN, NLEN, n, error = 0;
-  while(((*bp) & 0x7) != 0) (*bp)++;
-  p = (*bp) / 8; /*byte position*/
+  size_t p = BitReader_alignToByte(reader);
+  unsigned LEN, NLEN;
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(p >= inlength - 4) return 52; /*error, bit pointer will jump past memory*/
-  LEN = in[p] + 256 * in[p + 1]; p += 2;
-  NLEN = in[p] + 256 * in[p + 1]; p += 2;
+  if(p + 4 >= reader->size) return 52; /*error, bit pointer will jump past memory*/
+  LEN = reader->data[p] + 256 * reader->data[p + 1]; p += 2;
+  NLEN = reader->data[p] + 256 * reader->data[p + 1]; p += 2;
 
   /*check if 16-bit NLEN is really the one's complement of LEN*/
   if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
 
-  if((*pos) + LEN >= out->size)
+  if((*pos) + LEN > out->size)
   {
     if(!ucvector_resize(out, (*pos) + LEN)) return 9915;
   }
 
   /*read the literal data: LEN bytes are now stored in the out buffer*/
-  if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; n++) out->data[(*pos)++] = in[p++];
+  if(p + LEN > reader->size) return 23; /*error: reading outside of in buffer*/
+  memcpy(&out->data[(*pos)], &reader->data[p], LEN);
+  (*pos) += LEN;
 
-  (*bp) = p * 8;
+  reader->pos = p + LEN;
 
-  return error;
+  return 0;
 }
 
-/*inflate the deflated data (cfr. deflate spec); return value is the error*/
-unsigned LodeFlate_inflate(ucvector* out, const unsigned char* in, size_t insize, size_t inpos)
+/*
+inflate the deflated data (cfr. deflate spec); return value is the error
+out->size is taken as room to decode into, if it's big enough no reallocations happen
+*/
+/*trees may be NULL, then they are made for this call only*/
+unsigned LodeFlate_inflate(ucvector* out, const unsigned char* in, size_t insize, size_t inpos, LodeFlate_Trees* trees)
 {
-  size_t bp = 0; /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
+  BitReader reader;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
+  LodeFlate_Trees local_trees;
 
   unsigned error = 0;
 
-  while(!BFINAL)
+  LodeFlate_Trees_init(&local_trees);
+  if(!trees) trees = &local_trees;
+
+  BitReader_init(&reader, &in[inpos], insize - inpos);
+
+  while(!BFINAL && !error)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, &in[inpos]);
-    BTYPE = 1 * readBitFromStream(&bp, &in[inpos]);
-    BTYPE += 2 * readBitFromStream(&bp, &in[inpos]);
+    if(BitReader_position(&reader) + 2 >= reader.size * 8) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+    BFINAL = BitReader_read(&reader, 1);
+    BTYPE = BitReader_read(&reader, 2);
 
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, &in[inpos], &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, &in[inpos], &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    if(BTYPE == 3) ERROR_BREAK(20); /*error: invalid BTYPE*/
 
-    if(error) return error;
+    if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE, trees); /*compression, BTYPE 01 or 10*/
   }
-  
+
   /*Only now we know the true size of out, resize it to that*/
-  if(!ucvector_resize(out, pos)) error = 9916;
+  if(!error && !ucvector_resize(out, pos)) error = 9916;
 
+  LodeFlate_Trees_cleanup(&local_trees);
   return error;
 }
 
-#endif /*LODEPNG_COMPILE_DECODER*/
-
-#ifdef LODEPNG_COMPILE_ENCODER
+/*
+Inflating data that arrives a piece at a time, for LodePNG_Decoder_streamPush. The input
+waits in a buffer until there's enough of it to decode the next block header, or symbol
+with its extra bits, without running out. Decoding stops there, unless the input is
+complete, and carries on from the same bit when more arrives. The output goes to a
+window that keeps the last 32K bytes for matches once the caller took the rest.
+*/
+#define INFLATE_WINDOW 32768
+#define INFLATE_HEADER_BYTES 600 /*a block header with its dynamic trees takes at most 563 bytes*/
+#define INFLATE_SYMBOL_BYTES 8 /*a length and distance with their extra bits take at most 48 bits*/
 
-/* ////////////////////////////////////////////////////////////////////////// */
-/* / Deflator                                                               / */
-/* ////////////////////////////////////////////////////////////////////////// */
+typedef struct LodeFlate_Stream
+{
+  ucvector in; /*input that isn't used up yet*/
+  size_t bitpos; /*the next bit to read from in*/
+  unsigned complete; /*no more input comes after what's in in*/
+  unsigned block; /*0: block header next, 1: in a stored block, 2: in a Huffman block, 3: past the final block*/
+  unsigned final; /*the current block is the last one*/
+  size_t stored_left; /*bytes of the stored block still to copy*/
+  ucvector out; /*the window: out.size is room, the output ends at outpos*/
+  size_t outpos;
+} LodeFlate_Stream;
 
-static const size_t MAX_SUPPORTED_DEFLATE_LENGTH = 258;
+static void LodeFlate_Stream_init(LodeFlate_Stream* stream)
+{
+  ucvector_init(&stream->in);
+  ucvector_init(&stream->out);
+  stream->bitpos = 0;
+  stream->complete = 0;
+  stream->block = 0;
+  stream->final = 0;
+  stream->stored_left = 0;
+  stream->outpos = 0;
+}
 
-/*bitlen is the size in bits of the code*/
-static void addHuffmanSymbol(size_t* bp, ucvector* compressed, unsigned code, unsigned bitlen)
+static void LodeFlate_Stream_cleanup(LodeFlate_Stream* stream)
 {
-  addBitsToStreamReversed(bp, compressed, code, bitlen);
+  ucvector_cleanup(&stream->in);
+  ucvector_cleanup(&stream->out);
 }
 
-/*search the index in the array, that has the largest value smaller than or equal to the given value, given array must be sorted (if no value is smaller, it returns the size of the given array)*/
-static size_t searchCodeIndex(const unsigned* array, size_t array_size, size_t value)
+/*starts over with a new stream, keeping the buffers*/
+static void LodeFlate_Stream_reset(LodeFlate_Stream* stream)
 {
-  /*linear search implementation*/
-  /*for(size_t i = 1; i < array_size; i++) if(array[i] > value) return i - 1;
-  return array_size - 1;*/
+  stream->in.size = 0;
+  stream->bitpos = 0;
+  stream->complete = 0;
+  stream->block = 0;
+  stream->final = 0;
+  stream->stored_left = 0;
+  stream->outpos = 0;
+}
 
-  /*binary search implementation (not that much faster) (precondition: array_size > 0)*/
-  size_t left  = 1;
-  size_t right = array_size - 1;
-  while(left <= right)
+static unsigned LodeFlate_Stream_append(LodeFlate_Stream* stream, const unsigned char* data, size_t size)
+{
+  size_t used = stream->bitpos / 8;
+  if(used >= INFLATE_WINDOW && used * 2 >= stream->in.size)
   {
-    size_t mid = (left + right) / 2;
-    if(array[mid] <= value) left = mid + 1; /*the value to find is more to the right*/
-    else if(array[mid - 1] > value) right = mid - 1; /*the value to find is more to the left*/
+    /*drop the input that's used up, once that's more than what's left*/
+    memmove(stream->in.data, &stream->in.data[used], stream->in.size - used);
+    stream->in.size -= used;
+    stream->bitpos -= used * 8;
+  }
+  if(!ucvector_resize(&stream->in, stream->in.size + size)) return 9959; /*alloc fail*/
+  if(size) memcpy(&stream->in.data[stream->in.size - size], data, size);
+  return 0;
+}
+
+/*forgets the output before taken, but for the last 32K that matches may still refer to; returns how many bytes went*/
+static size_t LodeFlate_Stream_release(LodeFlate_Stream* stream, size_t taken)
+{
+  size_t drop = taken > INFLATE_WINDOW ? taken - INFLATE_WINDOW : 0;
+  if(drop < INFLATE_WINDOW) return 0; /*not worth moving the window yet*/
+  memmove(stream->out.data, &stream->out.data[drop], stream->outpos - drop);
+  stream->outpos -= drop;
+  return drop;
+}
+
+/*reads from in at bitpos*/
+static void LodeFlate_Stream_reader(LodeFlate_Stream* stream, BitReader* reader)
+{
+  size_t start = stream->bitpos / 8;
+  BitReader_init(reader, &stream->in.data[start], stream->in.size - start);
+  BitReader_read(reader, (unsigned)(stream->bitpos % 8));
+}
+
+/*
+inflates as much as the input allows, or until the output reaches outlimit; *progress
+tells whether anything was read, so that the caller knows when to wait for more input
+*/
+static unsigned LodeFlate_Stream_inflate(LodeFlate_Stream* stream, LodeFlate_Trees* trees, size_t outlimit, unsigned* progress)
+{
+  unsigned error = 0;
+  size_t start = stream->bitpos;
+
+  while(!error && stream->block != 3 && stream->outpos < outlimit)
+  {
+    size_t bits = stream->in.size * 8 - stream->bitpos; /*input available*/
+    BitReader reader;
+
+    if(stream->block == 0)
+    {
+      unsigned BTYPE;
+      if(!stream->complete && bits < INFLATE_HEADER_BYTES * 8) break;
+
+      LodeFlate_Stream_reader(stream, &reader);
+      if(BitReader_position(&reader) + 2 >= reader.size * 8) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+      stream->final = BitReader_read(&reader, 1);
+      BTYPE = BitReader_read(&reader, 2);
+      if(BTYPE == 3) ERROR_BREAK(20); /*error: invalid BTYPE*/
+
+      if(BTYPE == 0)
+      {
+        size_t p = BitReader_alignToByte(&reader);
+        unsigned LEN, NLEN;
+        if(p + 4 >= reader.size) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+        LEN = reader.data[p] + 256 * reader.data[p + 1];
+        NLEN = reader.data[p + 2] + 256 * reader.data[p + 3];
+        if(LEN + NLEN != 65535) ERROR_BREAK(21); /*error: NLEN is not one's complement of LEN*/
+        stream->stored_left = LEN;
+        stream->block = 1;
+        stream->bitpos = (stream->bitpos / 8 + p + 4) * 8;
+      }
+      else
+      {
+        error = getTreesInflate(trees, &reader, BTYPE);
+        if(error) break;
+        if(BitReader_position(&reader) > reader.size * 8) ERROR_BREAK(10); /*the trees went past the end of the data*/
+        stream->block = 2;
+        stream->bitpos = (stream->bitpos / 8) * 8 + BitReader_position(&reader);
+      }
+    }
+    else if(stream->block == 1)
+    {
+      size_t amount = stream->stored_left;
+      if(amount > bits / 8) amount = bits / 8;
+      if(amount > outlimit - stream->outpos) amount = outlimit - stream->outpos;
+      if(amount == 0 && stream->stored_left)
+      {
+        if(stream->complete) ERROR_BREAK(23); /*error: reading outside of in buffer*/
+        break;
+      }
+
+      if(stream->outpos + amount > stream->out.size)
+      {
+        if(!ucvector_resize(&stream->out, (stream->outpos + amount) * 2)) ERROR_BREAK(9960); /*alloc fail*/
+      }
+      if(amount) memcpy(&stream->out.data[stream->outpos], &stream->in.data[stream->bitpos / 8], amount);
+      stream->outpos += amount;
+      stream->bitpos += amount * 8;
+      stream->stored_left -= amount;
+      if(!stream->stored_left) stream->block = stream->final ? 3 : 0;
+    }
+    else
+    {
+      unsigned end = 0;
+      size_t inlimit = (size_t)(-1);
+      if(!stream->complete)
+      {
+        if(bits <= INFLATE_SYMBOL_BYTES * 8) break;
+        inlimit = bits - INFLATE_SYMBOL_BYTES * 8 + stream->bitpos % 8;
+      }
+
+      LodeFlate_Stream_reader(stream, &reader);
+      error = inflateSymbols(&stream->out, &reader, &stream->outpos, trees, outlimit, inlimit, &end);
+      stream->bitpos = (stream->bitpos / 8) * 8 + BitReader_position(&reader);
+      if(!end) break; /*out of input, or of room for output*/
+      stream->block = stream->final ? 3 : 0;
+    }
+  }
+
+  *progress = stream->bitpos != start;
+  return error;
+}
+
+#endif /*LODEPNG_COMPILE_DECODER*/
+
+#ifdef LODEPNG_COMPILE_ENCODER
+
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Deflator                                                               / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+static const size_t MAX_SUPPORTED_DEFLATE_LENGTH = 258;
+
+/*bitlen is the size in bits of the code*/
+static void addHuffmanSymbol(size_t* bp, ucvector* compressed, unsigned code, unsigned bitlen)
+{
+  addBitsToStreamReversed(bp, compressed, code, bitlen);
+}
+
+/*search the index in the array, that has the largest value smaller than or equal to the given value, given array must be sorted (if no value is smaller, it returns the size of the given array)*/
+static size_t searchCodeIndex(const unsigned* array, size_t array_size, size_t value)
+{
+  /*linear search implementation*/
+  /*for(size_t i = 1; i < array_size; i++) if(array[i] > value) return i - 1;
+  return array_size - 1;*/
+
+  /*binary search implementation (not that much faster) (precondition: array_size > 0)*/
+  size_t left  = 1;
+  size_t right = array_size - 1;
+  while(left <= right)
+  {
+    size_t mid = (left + right) / 2;
+    if(array[mid] <= value) left = mid + 1; /*the value to find is more to the right*/
+    else if(array[mid - 1] > value) right = mid - 1; /*the value to find is more to the left*/
     else return mid - 1;
   }
   return array_size - 1;
@@ -1252,164 +1865,411 @@ static void encodeLZ77_brute(uivector* out, const unsigned char* in, size_t insi
 }
 #endif
 
-static const unsigned HASH_NUM_VALUES = 65536;
-static const unsigned HASH_NUM_CHARACTERS = 6;
-static const unsigned HASH_SHIFT = 2;
 /*
-Good and fast values: HASH_NUM_VALUES=65536, HASH_NUM_CHARACTERS=6, HASH_SHIFT=2
-making HASH_NUM_CHARACTERS larger (like 8), makes the file size larger but is a bit faster
-making HASH_NUM_CHARACTERS smaller (like 3), makes the file size smaller but is slower
+LZ77 match finding. The 3 bytes at each position are hashed into "head", which holds the last position (plus one,
+0 is empty) with that hash, and "prev" chains every position to the previous one with the same hash. prev is a ring
+of 65536 entries, twice the largest window, so the chain of a position inside the window is never overwritten.
+How much of the chain is searched depends on the level:
+1: fast, looks only at the last position with the same hash, no chains, and takes the first match it finds
+2: default, searches bounded chains and looks one byte ahead for a longer match before taking one (lazy matching)
+3: max, finds the matches at every position with long chains and picks the cheapest path through them (optimal
+   parsing), costing the symbols first with the fixed Huffman code lengths and then with the ones its own first
+   parse would give
 */
+static const unsigned HASH_BITS = 15;
+static const unsigned HASH_NUM_VALUES = 32768; /*1 << HASH_BITS*/
+static const unsigned PREV_NUM_VALUES = 65536;
+
+/*search parameters of a level, as in zlib: chain positions to look at, a match length that's good enough to look
+at only a quarter of the chain for a longer one, one that's long enough to stop looking, and the longest previous
+match that's still worth a lazy look for a longer one. Matches under min_length are left as literals, in filtered
+scanlines those mostly cost more bits than the bytes they replace (zlib's Z_FILTERED does the same). The optimal
+parsing of the max level weighs that up itself.*/
+typedef struct LZ77Level
+{
+  unsigned max_chain;
+  unsigned good_length;
+  unsigned nice_length;
+  unsigned max_lazy;
+  unsigned min_length;
+} LZ77Level;
+
+static const LZ77Level LZ77_LEVELS[4] =
+{
+  {1, 258, 258, 0, 5}, /*fast*/
+  {1, 258, 258, 0, 5}, /*fast*/
+  {128, 8, 128, 16, 5}, /*default*/
+  {1024, 258, 258, 258, 3} /*max*/
+};
+
+/*the optimal parsing of the max level finds the matches of this many bytes at a time, so they fit in memory and
+don't reach past them, and parses the input this many times*/
+static const size_t OPTIMAL_SEGMENT = 65536;
+static const unsigned OPTIMAL_ITERATIONS = 2;
+
+typedef struct LZ77Finder
+{
+  const unsigned char* in;
+  size_t insize;
+  unsigned windowSize;
+  unsigned* head; /*HASH_NUM_VALUES entries*/
+  unsigned* prev; /*PREV_NUM_VALUES entries, NULL for the fast level which has no chains*/
+  unsigned error; /*set if a match couldn't be added to the list of matches*/
+} LZ77Finder;
+
+static unsigned LZ77Finder_init(LZ77Finder* finder, const unsigned char* in, size_t insize, unsigned windowSize, unsigned chains)
+{
+  finder->in = in;
+  finder->insize = insize;
+  finder->windowSize = windowSize;
+  finder->error = 0;
+  finder->head = (unsigned*)malloc(HASH_NUM_VALUES * sizeof(unsigned));
+  finder->prev = chains ? (unsigned*)malloc(PREV_NUM_VALUES * sizeof(unsigned)) : NULL;
+  if(!finder->head || (chains && !finder->prev)) return 9917; /*alloc fail*/
+  return 0;
+}
 
-static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
+static unsigned getHash(const unsigned char* data, size_t pos)
 {
-  unsigned result = 0;
-  size_t amount, i;
-  if(pos >= size) return 0;
-  amount = HASH_NUM_CHARACTERS;
-  if(pos + amount >= size) amount = size - pos;
-  for(i = 0; i < amount; i++) result ^= (data[pos + i] << (i * HASH_SHIFT));
-  return result % HASH_NUM_VALUES;
+  unsigned value = (unsigned)data[pos] | ((unsigned)data[pos + 1] << 8) | ((unsigned)data[pos + 2] << 16);
+  return ((value * 2654435761u) & 0xffffffffu) >> (32 - HASH_BITS);
+}
+
+/*add a position to the hash table, the last 2 bytes have nothing to hash*/
+static void LZ77Finder_insert(LZ77Finder* finder, size_t pos)
+{
+  unsigned hash;
+  if(pos + 3 > finder->insize) return;
+  hash = getHash(finder->in, pos);
+  if(finder->prev) finder->prev[pos & (PREV_NUM_VALUES - 1)] = finder->head[hash];
+  finder->head[hash] = (unsigned)pos + 1;
 }
 
-static unsigned countInitialZeros(const unsigned char* data, size_t size, size_t pos)
+/*empty the hash table, then fill it with the window before inpos*/
+static void LZ77Finder_reset(LZ77Finder* finder, size_t inpos)
 {
-  size_t max_count = MAX_SUPPORTED_DEFLATE_LENGTH;
   size_t i;
-  if(max_count > size - pos) max_count = size - pos;
-  for(i = 0; i < max_count; i++)
-  {
-    if(data[pos + i] != 0)
-      return i;
-  }
-  return max_count;
+  for(i = 0; i < HASH_NUM_VALUES; i++) finder->head[i] = 0;
+  for(i = inpos > finder->windowSize ? inpos - finder->windowSize : 0; i < inpos; i++) LZ77Finder_insert(finder, i);
 }
 
-/*LZ77-encode the data using a hash table technique to let it encode faster. Return value is error code*/
-static unsigned encodeLZ77(uivector* out, const unsigned char* in, size_t insize, unsigned windowSize)
+static void LZ77Finder_cleanup(LZ77Finder* finder)
 {
-  /**generate hash table**/
-  vector table; /*HASH_NUM_VALUES uivectors; this represents what would be an std::vector<std::vector<unsigned> > in C++*/
-  uivector tablepos1, tablepos2;
-  uivector initialZerosTable; /*hash == 0 indicates a possible common case of a long sequence of zeros, store and use the amount here for a speedup*/
-  unsigned pos, i, error = 0;
+  free(finder->head);
+  free(finder->prev);
+}
 
-  vector_init(&table, sizeof(uivector));
-  if(!vector_resize(&table, HASH_NUM_VALUES)) return 9917;
-  for(i = 0; i < HASH_NUM_VALUES; i++)
-  {
-    uivector* v = (uivector*)vector_get(&table, i);
-    uivector_init(v);
-  }
+/*
+Search the earlier positions with the same hash as pos, at most max_chain of them, for the longest match. Returns
+its length, or 0 if there's none of at least 3 bytes. With matches given, every match longer than the ones found
+before it is added to it as length and distance, so it ends with the longest one and each length up to it can use
+the distance of the first match reaching it, the nearest one. Doesn't add pos to the table.
+*/
+static unsigned LZ77Finder_find(LZ77Finder* finder, size_t pos, unsigned max_chain, unsigned nice_length,
+                                unsigned* distance, uivector* matches)
+{
+  const unsigned char* in = finder->in;
+  const unsigned char* scan = &in[pos];
+  size_t max_length = finder->insize - pos;
+  unsigned length = 2, candidate;
+  if(max_length < 3) return 0;
+  if(max_length > MAX_SUPPORTED_DEFLATE_LENGTH) max_length = MAX_SUPPORTED_DEFLATE_LENGTH;
+  if(nice_length > max_length) nice_length = (unsigned)max_length;
+
+  candidate = finder->head[getHash(in, pos)];
+  while(candidate != 0 && max_chain > 0)
+  {
+    size_t back = candidate - 1, current_length;
+    const unsigned char* match = &in[back];
+    if(pos - back > finder->windowSize) break;
+
+    /*a longer match has to differ from the best so far at its last byte, so check that one first*/
+    if(match[length] == scan[length] && match[0] == scan[0] && match[1] == scan[1])
+    {
+      current_length = 2;
+      while(current_length < max_length && match[current_length] == scan[current_length]) current_length++;
+      if(current_length > length)
+      {
+        length = (unsigned)current_length;
+        *distance = (unsigned)(pos - back);
+        if(matches)
+        {
+          if(!uivector_push_back(matches, length) || !uivector_push_back(matches, *distance))
+          {
+            finder->error = 9919; /*alloc fail*/
+            return 0;
+          }
+        }
+        if(length >= nice_length) break;
+      }
+    }
 
-  /*remember start and end positions in the tables to search in*/
-  uivector_init(&tablepos1);
-  uivector_init(&tablepos2);
-  uivector_init(&initialZerosTable);
+    if(!finder->prev) break;
+    candidate = finder->prev[back & (PREV_NUM_VALUES - 1)];
+    max_chain--;
+  }
+  return length >= 3 ? length : 0;
+}
 
-  if(!uivector_resizev(&tablepos1, HASH_NUM_VALUES, 0)) error = 9918;
-  if(!uivector_resizev(&tablepos2, HASH_NUM_VALUES, 0)) error = 9919;
+/*the fast and default levels: greedy matching, and lazy matching with level->max_lazy above 0*/
+static unsigned encodeLZ77Lazy(uivector* out, LZ77Finder* finder, size_t inpos, const LZ77Level* level)
+{
+  const unsigned char* in = finder->in;
+  size_t insize = finder->insize, pos, i;
+  unsigned prev_length = 0, prev_distance = 0; /*the match at pos - 1 waiting for the lazy look at pos*/
+  unsigned pending = 0; /*whether pos - 1 still needs to be output, as a literal or with the waiting match*/
 
-  if(!error)
+  for(pos = inpos; pos < insize; pos++)
   {
-    unsigned length, offset, tablepos, max_offset;
-    unsigned hash, initialZeros;
-    unsigned backpos, current_offset, t1, t2, skip, current_length;
-    const unsigned char *lastptr, *foreptr, *backptr;
-
-    for(pos = 0; pos < insize; pos++)
+    unsigned length = 0, distance = 0;
+    if(!pending || prev_length < level->max_lazy)
     {
-      length = 0, offset = 0; /*the length and offset found for the current position*/
-      max_offset = pos < windowSize ? pos : windowSize; /*how far back to test*/
-
-      /*/search for the longest string*/
-      /*first find out where in the table to start (the first value that is in the range from "pos - max_offset" to "pos")*/
-      hash = getHash(in, insize, pos);
-      initialZeros = countInitialZeros(in, insize, pos);
-      if(!uivector_push_back((uivector*)vector_get(&table, hash), pos)) ERROR_BREAK(9920 /*alloc fail*/);
-      if(hash == 0)
-      {
-        if(!uivector_push_back(&initialZerosTable, initialZeros)) ERROR_BREAK(9920 /*alloc fail*/);
-      }
+      unsigned chain = prev_length >= level->good_length ? level->max_chain / 4 : level->max_chain;
+      length = LZ77Finder_find(finder, pos, chain ? chain : 1, level->nice_length, &distance, 0);
+      if(length < level->min_length) length = 0;
+    }
+    LZ77Finder_insert(finder, pos);
 
-      while(((uivector*)vector_get(&table, hash))->data[tablepos1.data[hash]] < pos - max_offset)
+    if(level->max_lazy == 0)
+    {
+      /*greedy: take the match right away, only adding its start to the table if it's long*/
+      if(length < 3)
       {
-        tablepos1.data[hash]++; /*it now points to the first value in the table for which the index is larger than or equal to pos - max_offset*/
+        if(!uivector_push_back(out, in[pos])) return 9921; /*alloc fail*/
+        continue;
       }
-      while(((uivector*)vector_get(&table, hash))->data[tablepos2.data[hash]] < pos)
+      addLengthDistance(out, length, distance);
+      if(length <= 4)
       {
-        tablepos2.data[hash]++; /*it now points to the first value in the table for which the index is larger than or equal to pos*/
+        for(i = 1; i < length; i++) LZ77Finder_insert(finder, pos + i);
       }
+      pos += length - 1;
+    }
+    else if(pending && prev_length >= 3 && length <= prev_length)
+    {
+      /*the match at pos - 1 is no worse than this one, take it*/
+      addLengthDistance(out, prev_length, prev_distance);
+      for(i = pos + 1; i < pos - 1 + prev_length; i++) LZ77Finder_insert(finder, i);
+      pos += prev_length - 2;
+      pending = 0;
+      prev_length = 0;
+    }
+    else
+    {
+      if(pending && !uivector_push_back(out, in[pos - 1])) return 9921; /*alloc fail*/
+      pending = 1;
+      prev_length = length;
+      prev_distance = distance;
+    }
+  }
+  if(pending && !uivector_push_back(out, in[insize - 1])) return 9921; /*alloc fail*/
+  return 0;
+}
 
-      t1 = tablepos1.data[hash];
-      t2 = tablepos2.data[hash];
+/*count the lit/len and dist symbols of LZ77-encoded data, and the end code*/
+static void countSymbols(const uivector* lz77_encoded, unsigned* frequencies_ll, unsigned* frequencies_d)
+{
+  size_t i;
+  for(i = 0; i < 286; i++) frequencies_ll[i] = 0;
+  for(i = 0; i < 30; i++) frequencies_d[i] = 0;
+  for(i = 0; i < lz77_encoded->size; i++)
+  {
+    unsigned symbol = lz77_encoded->data[i];
+    frequencies_ll[symbol]++;
+    if(symbol > 256)
+    {
+      frequencies_d[lz77_encoded->data[i + 2]]++;
+      i += 3;
+    }
+  }
+  frequencies_ll[256] = 1; /*there will be exactly 1 end code, at the end of the block*/
+}
 
-      lastptr = &in[insize < pos + MAX_SUPPORTED_DEFLATE_LENGTH ? insize : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
+/*bits of each lit/len and dist symbol, including the extra bits, from the frequencies (or the fixed tree if NULL)*/
+static void getSymbolCosts(float* lit_costs, float* length_costs, float* distance_costs,
+                           const unsigned* frequencies_ll, const unsigned* frequencies_d)
+{
+  size_t total_ll = 0, total_d = 0;
+  float costs_ll[286], costs_d[30];
+  unsigned i;
+  if(frequencies_ll)
+  {
+    for(i = 0; i < 286; i++) total_ll += frequencies_ll[i];
+    for(i = 0; i < 30; i++) total_d += frequencies_d[i];
+  }
+  for(i = 0; i < 286; i++)
+  {
+    /*symbols that weren't used get the cost of a very rare one*/
+    if(!frequencies_ll) costs_ll[i] = (float)(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    else costs_ll[i] = (float)(log((double)total_ll / (frequencies_ll[i] ? frequencies_ll[i] : 0.5)) / log(2.0));
+  }
+  for(i = 0; i < 30; i++)
+  {
+    if(!frequencies_d || !total_d) costs_d[i] = 5.0f;
+    else costs_d[i] = (float)(log((double)total_d / (frequencies_d[i] ? frequencies_d[i] : 0.5)) / log(2.0));
+  }
 
-      for(tablepos = tablepos2.data[hash] - 1; tablepos >= t1 && tablepos < t2; tablepos--)
-      {
-        backpos = ((uivector*)vector_get(&table, hash))->data[tablepos];
-        current_offset = pos - backpos;
+  for(i = 0; i < 256; i++) lit_costs[i] = costs_ll[i];
+  for(i = 3; i <= MAX_SUPPORTED_DEFLATE_LENGTH; i++)
+  {
+    size_t code = searchCodeIndex(LENGTHBASE, 29, i);
+    length_costs[i] = costs_ll[code + FIRST_LENGTH_CODE_INDEX] + LENGTHEXTRA[code];
+  }
+  for(i = 0; i < 30; i++) distance_costs[i] = costs_d[i] + DISTANCEEXTRA[i];
+}
 
-        /*test the next characters*/
-        foreptr = &in[pos];
-        backptr = &in[backpos];
+/*
+Find the cheapest way to encode in[start] up to in[end] with the matches found at each position: matches has the
+length/distance pairs of position i from matchpos[i - start] to matchpos[i - start + 1]. Fills choice[i - start]
+with the length/distance (length 1 for a literal) that reaches end the cheapest way, for the positions on that path.
+*/
+static void findCheapestPath(const unsigned char* in, size_t start, size_t end, const uivector* matches,
+                             const uivector* matchpos, float* costs, unsigned* choice,
+                             const float* lit_costs, const float* length_costs, const float* distance_costs)
+{
+  size_t count = end - start, i, j;
+  unsigned next;
+  for(i = 1; i <= count; i++) costs[i] = 1e30f;
+  costs[0] = 0.0f;
 
-        if(hash == 0)
-        {
-          skip = initialZerosTable.data[tablepos];
-          if(skip > initialZeros) skip = initialZeros;
-          if(skip > insize - pos) skip = insize - pos;
-          backptr += skip;
-          foreptr += skip;
-        }
-        while(foreptr != lastptr && *backptr == *foreptr) /*maximum supported length by deflate is max length*/
-        {
-          ++backptr;
-          ++foreptr;
-        }
-        current_length = (unsigned)(foreptr - &in[pos]);
-        if(current_length > length)
+  for(i = 0; i < count; i++)
+  {
+    float cost = costs[i] + lit_costs[in[start + i]];
+    unsigned length = 3;
+    size_t first = matchpos->data[i], last = matchpos->data[i + 1];
+    if(cost < costs[i + 1])
+    {
+      costs[i + 1] = cost;
+      choice[i + 1] = 1;
+    }
+    /*in a long run, only the longest match is worth trying*/
+    if(last > first && matches->data[last - 2] == MAX_SUPPORTED_DEFLATE_LENGTH) first = last - 2;
+    for(j = first; j < last; j += 2)
+    {
+      unsigned match_length = matches->data[j], distance = matches->data[j + 1];
+      float distance_cost = costs[i] + distance_costs[searchCodeIndex(DISTANCEBASE, 30, distance)];
+      if(j == first) length = match_length == MAX_SUPPORTED_DEFLATE_LENGTH ? match_length : 3;
+      for(; length <= match_length; length++)
+      {
+        cost = distance_cost + length_costs[length];
+        if(cost < costs[i + length])
         {
-          length = current_length; /*the longest length*/
-          offset = current_offset; /*the offset that is related to this longest length*/
-          if(current_length == MAX_SUPPORTED_DEFLATE_LENGTH) break; /*you can jump out of this for loop once a length of max length is found (gives significant speed gain)*/
+          costs[i + length] = cost;
+          choice[i + length] = length | (distance << 16);
         }
       }
+    }
+  }
+
+  /*the choices are stored at the end of each step, walk back and move them to its start*/
+  i = count;
+  next = choice[count];
+  while(i > 0)
+  {
+    unsigned current = next, step = current & 65535;
+    next = choice[i - step];
+    choice[i - step] = current;
+    i -= step;
+  }
+}
+
+/*the max level: optimal parsing, OPTIMAL_SEGMENT bytes at a time, OPTIMAL_ITERATIONS times over the whole input*/
+static unsigned encodeLZ77Optimal(uivector* out, LZ77Finder* finder, size_t inpos, const LZ77Level* level)
+{
+  const unsigned char* in = finder->in;
+  size_t insize = finder->insize, start, i;
+  unsigned error = 0, iteration;
+  uivector parse; /*the symbols of the latest parse, their frequencies give the costs for the next one*/
+  uivector matches, matchpos, choice;
+  float* costs = (float*)malloc((OPTIMAL_SEGMENT + 1) * sizeof(float));
+  float lit_costs[256], length_costs[259], distance_costs[30];
+  unsigned frequencies_ll[286], frequencies_d[30];
+
+  uivector_init(&parse);
+  uivector_init(&matches);
+  uivector_init(&matchpos);
+  uivector_init(&choice);
+  if(!costs || !uivector_resize(&matchpos, OPTIMAL_SEGMENT + 1) || !uivector_resize(&choice, OPTIMAL_SEGMENT + 1))
+  {
+    error = 9918; /*alloc fail*/
+  }
 
-      /**encode it as length/distance pair or literal value**/
-      if(length < 3) /*only lengths of 3 or higher are supported as length/distance pair*/
+  /*the first costs come from a parse at the default level*/
+  if(!error) error = encodeLZ77Lazy(&parse, finder, inpos, &LZ77_LEVELS[2]);
+
+  for(iteration = 0; !error && iteration < OPTIMAL_ITERATIONS; iteration++)
+  {
+    countSymbols(&parse, frequencies_ll, frequencies_d);
+    getSymbolCosts(lit_costs, length_costs, distance_costs, frequencies_ll, frequencies_d);
+    LZ77Finder_reset(finder, inpos);
+    parse.size = 0;
+
+    for(start = inpos; !error && start < insize; start += OPTIMAL_SEGMENT)
+    {
+      size_t end = insize - start > OPTIMAL_SEGMENT ? start + OPTIMAL_SEGMENT : insize;
+      finder->insize = end; /*matches stay inside the segment*/
+      matches.size = 0;
+      for(i = start; i < end; i++)
       {
-        if(!uivector_push_back(out, in[pos])) ERROR_BREAK(9921 /*alloc fail*/);
+        unsigned distance;
+        matchpos.data[i - start] = (unsigned)matches.size;
+        LZ77Finder_find(finder, i, level->max_chain, level->nice_length, &distance, &matches);
+        if(finder->error) ERROR_BREAK(finder->error);
+        LZ77Finder_insert(finder, i);
       }
-      else
+      matchpos.data[end - start] = (unsigned)matches.size;
+      finder->insize = insize;
+      /*the last 2 positions of the segment couldn't be hashed before, now they can*/
+      for(i = end > start + 2 ? end - 2 : start; i < end; i++) LZ77Finder_insert(finder, i);
+      if(error) break;
+
+      findCheapestPath(in, start, end, &matches, &matchpos, costs, choice.data, lit_costs, length_costs, distance_costs);
+      for(i = start; i < end; i += choice.data[i - start] & 65535)
       {
-        unsigned j, local_hash;
-        addLengthDistance(out, length, offset);
-        for(j = 0; j < length - 1; j++)
+        unsigned length = choice.data[i - start] & 65535;
+        if(length == 1)
         {
-          pos++;
-          local_hash = getHash(in, insize, pos);
-          if(!uivector_push_back((uivector*)vector_get(&table, local_hash), pos)) ERROR_BREAK(9922 /*alloc fail*/);
-          if(local_hash == 0)
-          {
-            if(!uivector_push_back(&initialZerosTable, countInitialZeros(in, insize, pos))) ERROR_BREAK(9922 /*alloc fail*/);
-          }
+          if(!uivector_push_back(&parse, in[i])) ERROR_BREAK(9921 /*alloc fail*/);
         }
+        else addLengthDistance(&parse, length, choice.data[i - start] >> 16);
       }
-    } /*end of the loop through each character of input*/
-  } /*end of "if(!error)"*/
+    }
+  }
 
-  /*cleanup*/
-  for(i = 0; i < table.size; i++)
+  if(!error)
+  {
+    for(i = 0; i < parse.size; i++)
+    {
+      if(!uivector_push_back(out, parse.data[i])) ERROR_BREAK(9921 /*alloc fail*/);
+    }
+  }
+
+  free(costs);
+  uivector_cleanup(&parse);
+  uivector_cleanup(&matches);
+  uivector_cleanup(&matchpos);
+  uivector_cleanup(&choice);
+  return error;
+}
+
+/*
+LZ77-encode in[inpos] up to in[insize] at the level of the settings. The bytes before inpos are a dictionary: the
+window before inpos goes into the hash table first, so matches can refer back into it. Return value is error code
+*/
+static unsigned encodeLZ77(uivector* out, const unsigned char* in, size_t inpos, size_t insize, const LodeZlib_CompressSettings* settings)
+{
+  const LZ77Level* level = &LZ77_LEVELS[settings->level > 3 ? 3 : settings->level];
+  LZ77Finder finder;
+  unsigned error = LZ77Finder_init(&finder, in, insize, settings->windowSize, level->max_chain > 1);
+
+  if(!error)
   {
-    uivector* v = (uivector*)vector_get(&table, i);
-    uivector_cleanup(v);
+    LZ77Finder_reset(&finder, inpos);
+    if(settings->level >= 3) error = encodeLZ77Optimal(out, &finder, inpos, level);
+    else error = encodeLZ77Lazy(out, &finder, inpos, level);
   }
-  vector_cleanup(&table);
-  uivector_cleanup(&tablepos1);
-  uivector_cleanup(&tablepos2);
-  uivector_cleanup(&initialZerosTable);
+
+  LZ77Finder_cleanup(&finder);
   return error;
 }
 
@@ -1482,8 +2342,22 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
   }
 }
 
-/*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
-static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t datasize, const LodeZlib_CompressSettings* settings)
+/*an empty stored block, which ends a chunk of deflate data on a byte boundary so that the next chunk can simply be appended after it*/
+static void addEmptyStoredBlock(size_t* bp, ucvector* out)
+{
+  addBitsToStream(bp, out, 0, 3); /*BFINAL 0 and BTYPE 00, then the rest of the byte is skipped*/
+  ucvector_push_back(out, 0); /*LEN 0*/
+  ucvector_push_back(out, 0);
+  ucvector_push_back(out, 255); /*NLEN*/
+  ucvector_push_back(out, 255);
+}
+
+/*
+Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees.
+Compresses data[datapos] up to data[dataend], the bytes before datapos are the dictionary. Unless
+final is set the block isn't the last one, and is followed by an empty stored block.
+*/
+static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t datapos, size_t dataend, unsigned final, const LodeZlib_CompressSettings* settings)
 {
   unsigned error = 0;
 
@@ -1515,7 +2389,7 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   bitlen_cl is to bitlen_lld_e what bitlen_lld is to lz77_encoded.
   */
 
-  unsigned BFINAL = 1; /*make only one block... the first and final one*/
+  unsigned BFINAL = final; /*make only one block... the first and, unless more chunks follow, final one*/
   size_t numcodes_ll, numcodes_d, i;
   size_t bp = 0; /*the bit pointer*/
   unsigned HLIT, HDIST, HCLEN;
@@ -1536,31 +2410,20 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   {
     if(settings->useLZ77)
     {
-      error = encodeLZ77(&lz77_encoded, data, datasize, settings->windowSize); /*LZ77 encoded*/
+      error = encodeLZ77(&lz77_encoded, data, datapos, dataend, settings); /*LZ77 encoded*/
       if(error) break;
     }
     else
     {
-      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(9923 /*alloc fail*/);
-      for(i = 0; i < datasize; i++) lz77_encoded.data[i] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      if(!uivector_resize(&lz77_encoded, dataend - datapos)) ERROR_BREAK(9923 /*alloc fail*/);
+      for(i = 0; i < dataend - datapos; i++) lz77_encoded.data[i] = data[datapos + i]; /*no LZ77, but still will be Huffman compressed*/
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(9924 /*alloc fail*/);
     if(!uivector_resizev(&frequencies_d, 30, 0)) ERROR_BREAK(9925 /*alloc fail*/);
 
     /*Count the frequencies of lit, len and dist codes*/
-    for(i = 0; i < lz77_encoded.size; i++)
-    {
-      unsigned symbol = lz77_encoded.data[i];
-      frequencies_ll.data[symbol]++;
-      if(symbol > 256)
-      {
-        unsigned dist = lz77_encoded.data[i + 2];
-        frequencies_d.data[dist]++;
-        i += 3;
-      }
-    }
-    frequencies_ll.data[256] = 1; /*there will be exactly 1 end code, at the end of the block*/
+    countSymbols(&lz77_encoded, frequencies_ll.data, frequencies_d.data);
 
     /*Make both huffman trees, one for the lit and len codes, one for the dist codes*/
     error = HuffmanTree_makeFromFrequencies(&tree_ll, frequencies_ll.data, frequencies_ll.size, 15);
@@ -1686,6 +2549,7 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
 
     /*write the end code*/
     addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+    if(!final) addEmptyStoredBlock(&bp, out);
 
     break; /*end of error-while*/
   }
@@ -1705,12 +2569,13 @@ static unsigned deflateDynamic(ucvector* out, const unsigned char* data, size_t
   return error;
 }
 
-static unsigned deflateFixed(ucvector* out, const unsigned char* data, size_t datasize, const LodeZlib_CompressSettings* settings)
+/*deflate with the fixed Huffman trees, data[datapos] up to data[dataend] like deflateDynamic*/
+static unsigned deflateFixed(ucvector* out, const unsigned char* data, size_t datapos, size_t dataend, unsigned final, const LodeZlib_CompressSettings* settings)
 {
   HuffmanTree tree_ll; /*tree for literal values and length codes*/
   HuffmanTree tree_d; /*tree for distance codes*/
 
-  unsigned BFINAL = 1; /*make only one block... the first and final one*/
+  unsigned BFINAL = final; /*make only one block... the first and, unless more chunks follow, final one*/
   unsigned error = 0;
   size_t i, bp = 0; /*the bit pointer*/
 
@@ -1728,18 +2593,19 @@ static unsigned deflateFixed(ucvector* out, const unsigned char* data, size_t da
   {
     uivector lz77_encoded;
     uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, data, datasize, settings->windowSize);
+    error = encodeLZ77(&lz77_encoded, data, datapos, dataend, settings);
     if(!error) writeLZ77data(&bp, out, &lz77_encoded, &tree_ll, &tree_d);
     uivector_cleanup(&lz77_encoded);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
-    for(i = 0; i < datasize; i++)
+    for(i = datapos; i < dataend; i++)
     {
       addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, data[i]), HuffmanTree_getLength(&tree_ll, data[i]));
     }
   }
   if(!error) addHuffmanSymbol(&bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256)); /*"end" code*/
+  if(!error && !final) addEmptyStoredBlock(&bp, out);
 
   /*cleanup*/
   HuffmanTree_cleanup(&tree_ll);
@@ -1752,8 +2618,8 @@ unsigned LodeFlate_deflate(ucvector* out, const unsigned char* data, size_t data
 {
   unsigned error = 0;
   if(settings->btype == 0) error = deflateNoCompression(out, data, datasize);
-  else if(settings->btype == 1) error = deflateFixed(out, data, datasize, settings);
-  else if(settings->btype == 2) error = deflateDynamic(out, data, datasize, settings);
+  else if(settings->btype == 1) error = deflateFixed(out, data, 0, datasize, 1, settings);
+  else if(settings->btype == 2) error = deflateDynamic(out, data, 0, datasize, 1, settings);
   else error = 61;
   return error;
 }
@@ -1764,11 +2630,122 @@ unsigned LodeFlate_deflate(ucvector* out, const unsigned char* data, size_t data
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_X86_RUNTIME
+/*
+Adler32 of 32 byte blocks with SSSE3 or AVX2. Per block, s1 grows by the sum of the
+bytes and s2 by 32 * s1 plus the bytes weighted 32, 31, ... 1. The weighted sums are
+done with maddubs, and 32 * s1 is summed up in ps and added once at the end of each
+run of blocks. 5552 bytes (173 blocks) can be summed before s2 may overflow 32 bits,
+as in zlib. len must be a multiple of 32.
+*/
+#define ADLER32_BLOCK 32
+#define ADLER32_NMAX_BLOCKS (5552 / ADLER32_BLOCK)
+
+LODEPNG_TARGET_SSSE3
+static unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / ADLER32_BLOCK;
+  const __m128i taps1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i taps2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > ADLER32_NMAX_BLOCKS ? ADLER32_NMAX_BLOCKS : blocks;
+    __m128i ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v1 = zero;
+    __m128i v2 = _mm_cvtsi32_si128((int)s2);
+    blocks -= n;
+    while(n > 0)
+    {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      ps = _mm_add_epi32(ps, v1);
+      v1 = _mm_add_epi32(v1, _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+      v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, taps1), ones));
+      v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, taps2), ones));
+      data += ADLER32_BLOCK;
+      n--;
+    }
+    v2 = _mm_add_epi32(v2, _mm_slli_epi32(ps, 5));
+
+    /*horizontal sums; sad_epu8 only leaves sums in lanes 0 and 2*/
+    v1 = _mm_add_epi32(v1, _mm_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(v2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+LODEPNG_TARGET_AVX2
+static unsigned update_adler32_avx2(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / ADLER32_BLOCK;
+  const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > ADLER32_NMAX_BLOCKS ? ADLER32_NMAX_BLOCKS : blocks;
+    __m256i ps = _mm256_setzero_si256();
+    __m256i v1 = zero;
+    __m256i v2 = zero;
+    __m128i h1, h2;
+    blocks -= n;
+    ps = _mm256_insert_epi32(ps, (int)(s1 * n), 0);
+    v2 = _mm256_insert_epi32(v2, (int)s2, 0);
+    while(n > 0)
+    {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      ps = _mm256_add_epi32(ps, v1);
+      v1 = _mm256_add_epi32(v1, _mm256_sad_epu8(bytes, zero));
+      v2 = _mm256_add_epi32(v2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, taps), ones));
+      data += ADLER32_BLOCK;
+      n--;
+    }
+    v2 = _mm256_add_epi32(v2, _mm256_slli_epi32(ps, 5));
+
+    h1 = _mm_add_epi32(_mm256_castsi256_si128(v1), _mm256_extracti128_si256(v1, 1));
+    h2 = _mm_add_epi32(_mm256_castsi256_si128(v2), _mm256_extracti128_si256(v2, 1));
+    h1 = _mm_add_epi32(h1, _mm_shuffle_epi32(h1, _MM_SHUFFLE(1, 0, 3, 2)));
+    h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(2, 3, 0, 1)));
+    h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(h1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(h2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_X86_RUNTIME*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned s1, s2;
+
+#ifdef LODEPNG_X86_RUNTIME
+  unsigned features = cpuFeatures();
+  if(len >= 2 * ADLER32_BLOCK && (features & (LODEPNG_CPU_SSSE3 | LODEPNG_CPU_AVX2)))
+  {
+    unsigned amount = len - len % ADLER32_BLOCK;
+    if(features & LODEPNG_CPU_AVX2) adler = update_adler32_avx2(adler, data, amount);
+    else adler = update_adler32_ssse3(adler, data, amount);
+    data += amount;
+    len -= amount;
+  }
+#endif /*LODEPNG_X86_RUNTIME*/
 
+  s1 = adler & 0xffff;
+  s2 = (adler >> 16) & 0xffff;
   while(len > 0)
   {
     /*at least 5550 sums can be done before the sums overflow, saving us from a lot of module divisions*/
@@ -1818,13 +2795,11 @@ unsigned LodeZlib_read32bitInt(const unsigned char* buffer)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned LodeZlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_DecompressSettings* settings)
+/*checks the 2 byte zlib header at in, returns the error if it's not one PNG allows*/
+static unsigned checkZlibHeader(const unsigned char* in)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
-  ucvector outv;
 
-  if(insize < 2) return 53; /*error, size of zlib data too small*/
   /*read information from zlib header*/
   if((in[0] * 256 + in[1]) % 31 != 0) return 24; /*error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way*/
 
@@ -1836,9 +2811,21 @@ unsigned LodeZlib_decompress(unsigned char** out, size_t* outsize, const unsigne
 
   if(CM != 8 || CINFO > 7) return 25; /*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec*/
   if(FDICT != 0) return 26; /*error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."*/
+  return 0;
+}
+
+/*LodeZlib_decompress with the Huffman trees to inflate with, or NULL*/
+static unsigned zlibDecompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_DecompressSettings* settings, LodeFlate_Trees* trees)
+{
+  unsigned error = 0;
+  ucvector outv;
+
+  if(insize < 2) return 53; /*error, size of zlib data too small*/
+  error = checkZlibHeader(in);
+  if(error) return error;
 
   ucvector_init_buffer(&outv, *out, *outsize); /*ucvector-controlled version of the output buffer, for dynamic array*/
-  error = LodeFlate_inflate(&outv, in, insize, 2);
+  error = LodeFlate_inflate(&outv, in, insize, 2, trees);
   *out = outv.data;
   *outsize = outv.size;
   if(error) return error;
@@ -1853,40 +2840,192 @@ unsigned LodeZlib_decompress(unsigned char** out, size_t* outsize, const unsigne
   return 0; /*no error*/
 }
 
+unsigned LodeZlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_DecompressSettings* settings)
+{
+  return zlibDecompress(out, outsize, in, insize, settings, 0);
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
-unsigned LodeZlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_CompressSettings* settings)
+/*
+Deflating on several threads, as pigz does: the data is cut into chunks that are each
+deflated on their own, with the window before them as dictionary so matches can still
+reach back across the cut. Every chunk but the last ends with an empty stored block,
+so they end on whole bytes and are simply joined. Each thread does every numthreads'th
+chunk, the calling thread the first, and the Adler-32s of the chunks are combined.
+*/
+#define DEFLATE_CHUNK 131072 /*bytes of data per chunk*/
+
+typedef struct DeflateChunks
 {
-  /*initially, *out must be NULL and outsize 0, if you just give some random *out that's pointing to a non allocated buffer, this'll crash*/
-  ucvector deflatedata, outv;
-  size_t i;
-  unsigned error;
+  const unsigned char* in;
+  size_t insize;
+  const LodeZlib_CompressSettings* settings;
+  size_t numchunks;
+  ucvector* out; /*the deflate data of each chunk*/
+  unsigned* adler; /*the Adler-32 of each chunk*/
+  unsigned* error;
+} DeflateChunks;
 
-  unsigned ADLER32;
-  /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
-  unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
-  unsigned FLEVEL = 0;
-  unsigned FDICT = 0;
-  unsigned CMFFLG = 256 * CMF + FDICT * 32 + FLEVEL * 64;
-  unsigned FCHECK = 31 - CMFFLG % 31;
-  CMFFLG += FCHECK;
+typedef struct DeflateWorker
+{
+  DeflateChunks* chunks;
+  size_t first, step; /*does chunks first, first + step, ...*/
+  unsigned threaded; /*has a thread of its own*/
+#ifdef LODEPNG_THREADS
+  LodeThread thread;
+#endif /*LODEPNG_THREADS*/
+} DeflateWorker;
+
+static void deflateChunks(void* data)
+{
+  DeflateWorker* worker = (DeflateWorker*)data;
+  DeflateChunks* chunks = worker->chunks;
+  size_t i;
+  for(i = worker->first; i < chunks->numchunks; i += worker->step)
+  {
+    size_t start = i * DEFLATE_CHUNK;
+    size_t end = chunks->insize - start > DEFLATE_CHUNK ? start + DEFLATE_CHUNK : chunks->insize;
+    unsigned final = i + 1 == chunks->numchunks;
+
+    if(chunks->settings->btype == 1) chunks->error[i] = deflateFixed(&chunks->out[i], chunks->in, start, end, final, chunks->settings);
+    else chunks->error[i] = deflateDynamic(&chunks->out[i], chunks->in, start, end, final, chunks->settings);
+    chunks->adler[i] = adler32(&chunks->in[start], (unsigned)(end - start));
+  }
+}
+
+/*the Adler-32 of two pieces of data one after the other, from that of each and the size of the second (as zlib's adler32_combine)*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned base = 65521;
+  unsigned rem = (unsigned)(len2 % base);
+  unsigned sum1 = adler1 & 0xffff;
+  unsigned sum2 = (rem * sum1) % base;
+  sum1 += (adler2 & 0xffff) + base - 1;
+  sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+  if(sum1 >= base) sum1 -= base;
+  if(sum1 >= base) sum1 -= base;
+  if(sum2 >= (base << 1)) sum2 -= (base << 1);
+  if(sum2 >= base) sum2 -= base;
+  return sum1 | (sum2 << 16);
+}
+
+/*deflates in to the end of out in DEFLATE_CHUNK chunks on settings->threads threads, and gives the Adler-32 of in*/
+static unsigned deflateParallel(ucvector* out, const unsigned char* in, size_t insize, const LodeZlib_CompressSettings* settings, unsigned* adler)
+{
+  DeflateChunks chunks;
+  DeflateWorker* workers;
+  size_t numthreads = settings->threads, i, size = out->size;
+  unsigned error = 0;
+
+  chunks.in = in;
+  chunks.insize = insize;
+  chunks.settings = settings;
+  chunks.numchunks = (insize + DEFLATE_CHUNK - 1) / DEFLATE_CHUNK;
+  if(numthreads > chunks.numchunks) numthreads = chunks.numchunks;
+
+  chunks.out = (ucvector*)malloc(chunks.numchunks * sizeof(ucvector));
+  chunks.adler = (unsigned*)malloc(chunks.numchunks * sizeof(unsigned));
+  chunks.error = (unsigned*)malloc(chunks.numchunks * sizeof(unsigned));
+  workers = (DeflateWorker*)malloc(numthreads * sizeof(DeflateWorker));
+  if(!chunks.out || !chunks.adler || !chunks.error || !workers)
+  {
+    free(chunks.out);
+    free(chunks.adler);
+    free(chunks.error);
+    free(workers);
+    return 9967; /*alloc fail*/
+  }
+  for(i = 0; i < chunks.numchunks; i++) ucvector_init(&chunks.out[i]);
+
+  for(i = 0; i < numthreads; i++)
+  {
+    workers[i].chunks = &chunks;
+    workers[i].first = i;
+    workers[i].step = numthreads;
+    workers[i].threaded = 0;
+#ifdef LODEPNG_THREADS
+    if(i > 0) workers[i].threaded = startThread(&workers[i].thread, deflateChunks, &workers[i]);
+#endif /*LODEPNG_THREADS*/
+  }
+  for(i = 0; i < numthreads; i++)
+  {
+#ifdef LODEPNG_THREADS
+    if(workers[i].threaded)
+    {
+      joinThread(&workers[i].thread);
+      continue;
+    }
+#endif /*LODEPNG_THREADS*/
+    deflateChunks(&workers[i]); /*the calling thread's own chunks, or those of a thread that couldn't start*/
+  }
+
+  /*join the chunks*/
+  for(i = 0; i < chunks.numchunks && !error; i++)
+  {
+    error = chunks.error[i];
+    size += chunks.out[i].size;
+  }
+  if(!error)
+  {
+    size_t pos = out->size;
+    if(!ucvector_resize(out, size)) error = 9967; /*alloc fail*/
+    for(i = 0; i < chunks.numchunks && !error; i++)
+    {
+      size_t chunksize = insize - i * DEFLATE_CHUNK > DEFLATE_CHUNK ? DEFLATE_CHUNK : insize - i * DEFLATE_CHUNK;
+      memcpy(&out->data[pos], chunks.out[i].data, chunks.out[i].size);
+      pos += chunks.out[i].size;
+      *adler = i ? adler32_combine(*adler, chunks.adler[i], chunksize) : chunks.adler[0];
+    }
+  }
+  for(i = 0; i < chunks.numchunks; i++) ucvector_cleanup(&chunks.out[i]);
+  free(chunks.out);
+  free(chunks.adler);
+  free(chunks.error);
+  free(workers);
+  return error;
+}
+
+unsigned LodeZlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_CompressSettings* settings)
+{
+  /*initially, *out must be NULL and outsize 0, if you just give some random *out that's pointing to a non allocated buffer, this'll crash*/
+  ucvector deflatedata, outv;
+  size_t i;
+  unsigned error;
+
+  unsigned ADLER32;
+  /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
+  unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
+  unsigned FLEVEL = 0;
+  unsigned FDICT = 0;
+  unsigned CMFFLG = 256 * CMF + FDICT * 32 + FLEVEL * 64;
+  unsigned FCHECK = 31 - CMFFLG % 31;
+  CMFFLG += FCHECK;
 
   ucvector_init_buffer(&outv, *out, *outsize); /*ucvector-controlled version of the output buffer, for dynamic array*/
 
   ucvector_push_back(&outv, (unsigned char)(CMFFLG / 256));
   ucvector_push_back(&outv, (unsigned char)(CMFFLG % 256));
 
-  ucvector_init(&deflatedata);
-  error = LodeFlate_deflate(&deflatedata, in, insize, settings);
-
-  if(!error)
+  if(settings->threads > 1 && settings->btype != 0 && insize > DEFLATE_CHUNK)
   {
-    ADLER32 = adler32(in, (unsigned)insize);
-    for(i = 0; i < deflatedata.size; i++) ucvector_push_back(&outv, deflatedata.data[i]);
+    error = deflateParallel(&outv, in, insize, settings, &ADLER32);
+    if(!error) LodeZlib_add32bitInt(&outv, ADLER32);
+  }
+  else
+  {
+    ucvector_init(&deflatedata);
+    error = LodeFlate_deflate(&deflatedata, in, insize, settings);
+
+    if(!error)
+    {
+      ADLER32 = adler32(in, (unsigned)insize);
+      for(i = 0; i < deflatedata.size; i++) ucvector_push_back(&outv, deflatedata.data[i]);
+      LodeZlib_add32bitInt(&outv, ADLER32);
+    }
     ucvector_cleanup(&deflatedata);
-    LodeZlib_add32bitInt(&outv, ADLER32);
   }
 
   *out = outv.data;
@@ -1908,9 +3047,11 @@ void LodeZlib_CompressSettings_init(LodeZlib_CompressSettings* settings)
   settings->btype = 2; /*compress with dynamic huffman tree (not in the mathematical sense, just not the predefined one)*/
   settings->useLZ77 = 1;
   settings->windowSize = 2048; /*this is a good tradeoff between speed and compression ratio*/
+  settings->level = 2;
+  settings->threads = 1;
 }
 
-const LodeZlib_CompressSettings LodeZlib_defaultCompressSettings = {2, 1, 2048};
+const LodeZlib_CompressSettings LodeZlib_defaultCompressSettings = {2, 1, 2048, 2, 1};
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
@@ -1946,16 +3087,19 @@ below, is to provide the ability to let LodePNG use a different Zlib encoder by
 changing the two functions below, instead of changing it inside the vareous places
 in the other LodePNG functions.
 
-*out must be NULL and *outsize must be 0 initially, and after the function is done,
-*out must point to the decompressed data, *outsize must be the size of it, and must
-be the size of the useful data in bytes, not the alloc size.
+*out must be NULL and *outsize must be 0 initially, or *out a malloc'ed buffer of
+*outsize bytes to decompress into, which gets reallocated if it's too small. After
+the function is done, *out must point to the decompressed data, *outsize must be
+the size of it, and must be the size of the useful data in bytes, not the alloc size.
+trees are the Huffman trees the decoder keeps for LodeFlate_inflate to reuse, a
+different Zlib decoder can ignore them.
 */
 
 #ifdef LODEPNG_COMPILE_DECODER
-static unsigned LodePNG_decompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_DecompressSettings* settings)
+static unsigned LodePNG_decompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodeZlib_DecompressSettings* settings, LodeFlate_Trees* trees)
 {
   /*replace this by custom function call to use an alterntive zlib codec*/
-  return LodeZlib_decompress(out, outsize, in, insize, settings);
+  return zlibDecompress(out, outsize, in, insize, settings, trees);
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -1970,10 +3114,15 @@ static unsigned LodePNG_compress(unsigned char** out, size_t* outsize, const uns
 /* / CRC32                                                                  / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned Crc32_crc_table_computed = 0;
-static unsigned Crc32_crc_table[256];
+/*
+Crc32_crc_table[0] is the usual byte at a time table. Table k gives the CRC of a byte
+followed by k zero bytes, which lets the portable code below do 8 bytes per step
+("slicing-by-8") with 8 independent lookups instead of 8 dependent ones.
+*/
+static LodeOnce Crc32_crc_table_computed = LODEPNG_ONCE_INIT;
+static unsigned Crc32_crc_table[8][256];
 
-/*Make the table for a fast CRC.*/
+/*Make the tables for a fast CRC.*/
 static void Crc32_make_crc_table(void)
 {
   unsigned c, k, n;
@@ -1985,25 +3134,149 @@ static void Crc32_make_crc_table(void)
       if(c & 1) c = 0xedb88320L ^ (c >> 1);
       else c = c >> 1;
     }
-    Crc32_crc_table[n] = c;
+    Crc32_crc_table[0][n] = c;
+  }
+  for(n = 0; n < 256; n++)
+  {
+    c = Crc32_crc_table[0][n];
+    for(k = 1; k < 8; k++)
+    {
+      c = Crc32_crc_table[0][c & 0xff] ^ (c >> 8);
+      Crc32_crc_table[k][n] = c;
+    }
   }
-  Crc32_crc_table_computed = 1;
 }
 
+#ifdef LODEPNG_X86_RUNTIME
+/*
+CRC by folding 64 bytes at a time with carry-less multiplication, then a Barrett
+reduction to 32 bits ("Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+Instruction", Gopal et al.). len must be a multiple of 16 and at least 64. Like
+Crc32_update_crc this takes and returns the running CRC.
+*/
+LODEPNG_TARGET_PCLMUL
+static unsigned Crc32_update_crc_pclmul(const unsigned char* buf, unsigned crc, size_t len)
+{
+  /*bit reflected folding constants x^(k) mod P(x) and the CRC32 and Barrett polynomials*/
+  const __m128i k1k2 = _mm_set_epi32(1, (int)0xc6e41596, 1, 0x54442bd4);
+  const __m128i k3k4 = _mm_set_epi32(0, (int)0xccaa009e, 1, 0x751997d0);
+  const __m128i k5 = _mm_set_epi32(0, 0, 1, 0x63cd6124);
+  const __m128i poly = _mm_set_epi32(1, (int)0xf7011641, 1, (int)0xdb710641);
+  const __m128i mask = _mm_set_epi32(0, -1, 0, -1);
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 0)), _mm_cvtsi32_si128((int)crc));
+  x2 = _mm_loadu_si128((const __m128i*)(buf + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(buf + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(buf + 48));
+  buf += 64;
+  len -= 64;
+
+  /*fold four 128-bit lanes in parallel*/
+  while(len >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 48)));
+    buf += 64;
+    len -= 64;
+  }
+
+  /*fold the four lanes into one, then any remaining 16 byte blocks into that*/
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+  while(len >= 16)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)buf));
+    buf += 16;
+    len -= 16;
+  }
+
+  /*fold 128 bits to 64*/
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /*Barrett reduction to 32 bits*/
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_X86_RUNTIME*/
+
 /*Update a running CRC with the bytes buf[0..len-1]--the CRC should be
 initialized to all 1's, and the transmitted value is the 1's complement of the
 final running CRC (see the crc() routine below).*/
 static unsigned Crc32_update_crc(const unsigned char* buf, unsigned crc, size_t len)
 {
   unsigned c = crc;
-  size_t n;
 
-  if(!Crc32_crc_table_computed) Crc32_make_crc_table();
-  for(n = 0; n < len; n++)
+#if defined(LODEPNG_ARM_CRC32)
+  /*the ARMv8 CRC32 instructions use this same (reflected) polynomial*/
+  while(len >= 8)
+  {
+    uint64_t word;
+    memcpy(&word, buf, 8);
+    c = __crc32d(c, word);
+    buf += 8;
+    len -= 8;
+  }
+  while(len > 0)
+  {
+    c = __crc32b(c, *buf++);
+    len--;
+  }
+  return c;
+#else /*LODEPNG_ARM_CRC32*/
+
+#ifdef LODEPNG_X86_RUNTIME
+  if(len >= 64 && (cpuFeatures() & LODEPNG_CPU_PCLMUL))
+  {
+    size_t amount = len & ~(size_t)15;
+    c = Crc32_update_crc_pclmul(buf, c, amount);
+    buf += amount;
+    len -= amount;
+  }
+#endif /*LODEPNG_X86_RUNTIME*/
+
+  runOnce(&Crc32_crc_table_computed, Crc32_make_crc_table);
+  while(len >= 8)
   {
-    c = Crc32_crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+    unsigned lo = c ^ (buf[0] | ((unsigned)buf[1] << 8) | ((unsigned)buf[2] << 16) | ((unsigned)buf[3] << 24));
+    unsigned hi = buf[4] | ((unsigned)buf[5] << 8) | ((unsigned)buf[6] << 16) | ((unsigned)buf[7] << 24);
+    c = Crc32_crc_table[7][lo & 0xff] ^ Crc32_crc_table[6][(lo >> 8) & 0xff]
+      ^ Crc32_crc_table[5][(lo >> 16) & 0xff] ^ Crc32_crc_table[4][(lo >> 24) & 0xff]
+      ^ Crc32_crc_table[3][hi & 0xff] ^ Crc32_crc_table[2][(hi >> 8) & 0xff]
+      ^ Crc32_crc_table[1][(hi >> 16) & 0xff] ^ Crc32_crc_table[0][(hi >> 24) & 0xff];
+    buf += 8;
+    len -= 8;
+  }
+  while(len > 0)
+  {
+    c = Crc32_crc_table[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
+    len--;
   }
   return c;
+#endif /*LODEPNG_ARM_CRC32*/
 }
 
 /*Return the CRC of the bytes buf[0..len-1].*/
@@ -2600,6 +3873,293 @@ unsigned LodePNG_InfoRaw_copy(LodePNG_InfoRaw* dest, const LodePNG_InfoRaw* sour
 
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+Conversion to RGBA with 8 bits per sample, the format textures get uploaded in, from
+8- and 16-bit images without a color key. convertToRGBA8 picks the loop once for the
+whole image and the SIMD kernels do as many whole vectors as fit, each returning how
+many pixels (or samples) it did. Everything else goes pixel by pixel in
+LodePNG_convert_rgb_a_8.
+*/
+
+/*max amount of pixels of a 16-bit image narrowed to 8 bits at a time on the stack*/
+#define NARROW_CHUNK 256
+
+#ifdef LODEPNG_SSE2
+
+static size_t greyToRGBA8SSE2(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  const __m128i opaque = _mm_set1_epi8((char)255);
+  size_t i;
+  for(i = 0; i + 16 <= numpixels; i += 16)
+  {
+    __m128i grey = _mm_loadu_si128((const __m128i*)&in[i]);
+    __m128i gg_lo = _mm_unpacklo_epi8(grey, grey), gg_hi = _mm_unpackhi_epi8(grey, grey);
+    __m128i ga_lo = _mm_unpacklo_epi8(grey, opaque), ga_hi = _mm_unpackhi_epi8(grey, opaque);
+    _mm_storeu_si128((__m128i*)&out[4 * i + 0], _mm_unpacklo_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 16], _mm_unpackhi_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 32], _mm_unpacklo_epi16(gg_hi, ga_hi));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 48], _mm_unpackhi_epi16(gg_hi, ga_hi));
+  }
+  return i;
+}
+
+static size_t greyAlphaToRGBA8SSE2(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  size_t i;
+  for(i = 0; i + 8 <= numpixels; i += 8)
+  {
+    __m128i ga = _mm_loadu_si128((const __m128i*)&in[2 * i]);
+    __m128i grey = _mm_and_si128(ga, low);
+    __m128i gg = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 0], _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 16], _mm_unpackhi_epi16(gg, ga));
+  }
+  return i;
+}
+
+/*16-bit samples are big endian, so the high byte comes first and ends up in the low half of each lane*/
+static size_t narrow16To8SSE2(unsigned char* out, const unsigned char* in, size_t numsamples)
+{
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  size_t i;
+  for(i = 0; i + 16 <= numsamples; i += 16)
+  {
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[2 * i + 0]), low);
+    __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[2 * i + 16]), low);
+    _mm_storeu_si128((__m128i*)&out[i], _mm_packus_epi16(a, b));
+  }
+  return i;
+}
+
+static int maxIndexSSE2(const unsigned char* in, size_t numpixels)
+{
+  __m128i highest = _mm_setzero_si128();
+  unsigned char lanes[16];
+  int result = 0;
+  size_t i;
+  for(i = 0; i + 16 <= numpixels; i += 16) highest = _mm_max_epu8(highest, _mm_loadu_si128((const __m128i*)&in[i]));
+  _mm_storeu_si128((__m128i*)lanes, highest);
+  for(i = 0; i < 16; i++) if(lanes[i] > result) result = lanes[i];
+  for(i = numpixels & ~(size_t)15; i < numpixels; i++) if(in[i] > result) result = in[i];
+  return result;
+}
+
+#ifdef LODEPNG_X86_RUNTIME
+
+/*every 16 pixels are three vectors of RGB, spread out to four with pshufb*/
+LODEPNG_TARGET_SSSE3
+static size_t rgbToRGBA8SSSE3(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i opaque = _mm_set1_epi32((int)0xff000000u);
+  size_t i;
+  for(i = 0; i + 16 <= numpixels; i += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i*)&in[3 * i + 0]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&in[3 * i + 16]);
+    __m128i c = _mm_loadu_si128((const __m128i*)&in[3 * i + 32]);
+    _mm_storeu_si128((__m128i*)&out[4 * i + 0], _mm_or_si128(_mm_shuffle_epi8(a, spread), opaque));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 16], _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread), opaque));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 32], _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), spread), opaque));
+    _mm_storeu_si128((__m128i*)&out[4 * i + 48], _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), spread), opaque));
+  }
+  return i;
+}
+
+/*looks up 8 palette entries at once with vpgatherdd*/
+LODEPNG_TARGET_AVX2
+static size_t paletteToRGBA8AVX2(unsigned char* out, const unsigned char* in, size_t numpixels, const unsigned* table)
+{
+  size_t i;
+  for(i = 0; i + 8 <= numpixels; i += 8)
+  {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&in[i]));
+    _mm256_storeu_si256((__m256i*)&out[4 * i], _mm256_i32gather_epi32((const int*)table, index, 4));
+  }
+  return i;
+}
+
+#endif /*LODEPNG_X86_RUNTIME*/
+
+#endif /*LODEPNG_SSE2*/
+
+#ifdef LODEPNG_NEON
+
+static size_t greyToRGBA8NEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  uint8x16x4_t rgba;
+  size_t i;
+  rgba.val[3] = vdupq_n_u8(255);
+  for(i = 0; i + 16 <= numpixels; i += 16)
+  {
+    rgba.val[0] = rgba.val[1] = rgba.val[2] = vld1q_u8(&in[i]);
+    vst4q_u8(&out[4 * i], rgba);
+  }
+  return i;
+}
+
+static size_t greyAlphaToRGBA8NEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  uint8x16x4_t rgba;
+  size_t i;
+  for(i = 0; i + 16 <= numpixels; i += 16)
+  {
+    uint8x16x2_t ga = vld2q_u8(&in[2 * i]);
+    rgba.val[0] = rgba.val[1] = rgba.val[2] = ga.val[0];
+    rgba.val[3] = ga.val[1];
+    vst4q_u8(&out[4 * i], rgba);
+  }
+  return i;
+}
+
+static size_t rgbToRGBA8NEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  uint8x16x4_t rgba;
+  size_t i;
+  rgba.val[3] = vdupq_n_u8(255);
+  for(i = 0; i + 16 <= numpixels; i += 16)
+  {
+    uint8x16x3_t rgb = vld3q_u8(&in[3 * i]);
+    rgba.val[0] = rgb.val[0];
+    rgba.val[1] = rgb.val[1];
+    rgba.val[2] = rgb.val[2];
+    vst4q_u8(&out[4 * i], rgba);
+  }
+  return i;
+}
+
+static size_t narrow16To8NEON(unsigned char* out, const unsigned char* in, size_t numsamples)
+{
+  size_t i;
+  for(i = 0; i + 16 <= numsamples; i += 16) vst1q_u8(&out[i], vld2q_u8(&in[2 * i]).val[0]);
+  return i;
+}
+
+#endif /*LODEPNG_NEON*/
+
+/*expand 8-bit grey, grey+alpha, RGB or RGBA (colorType 0, 4, 2 or 6) to RGBA*/
+static void expandToRGBA8(unsigned char* out, const unsigned char* in, unsigned colorType, size_t numpixels, unsigned features)
+{
+  size_t i = 0;
+  (void)features;
+  switch(colorType)
+  {
+    case 0:
+#if defined(LODEPNG_SSE2)
+      i = greyToRGBA8SSE2(out, in, numpixels);
+#elif defined(LODEPNG_NEON)
+      i = greyToRGBA8NEON(out, in, numpixels);
+#endif
+      for(; i < numpixels; i++)
+      {
+        out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = in[i];
+        out[4 * i + 3] = 255;
+      }
+      break;
+    case 2:
+#if defined(LODEPNG_X86_RUNTIME)
+      if(features & LODEPNG_CPU_SSSE3) i = rgbToRGBA8SSSE3(out, in, numpixels);
+#elif defined(LODEPNG_NEON)
+      i = rgbToRGBA8NEON(out, in, numpixels);
+#endif
+      for(; i < numpixels; i++)
+      {
+        out[4 * i + 0] = in[3 * i + 0];
+        out[4 * i + 1] = in[3 * i + 1];
+        out[4 * i + 2] = in[3 * i + 2];
+        out[4 * i + 3] = 255;
+      }
+      break;
+    case 4:
+#if defined(LODEPNG_SSE2)
+      i = greyAlphaToRGBA8SSE2(out, in, numpixels);
+#elif defined(LODEPNG_NEON)
+      i = greyAlphaToRGBA8NEON(out, in, numpixels);
+#endif
+      for(; i < numpixels; i++)
+      {
+        out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = in[2 * i + 0];
+        out[4 * i + 3] = in[2 * i + 1];
+      }
+      break;
+    case 6:
+      memcpy(out, in, numpixels * 4);
+      break;
+  }
+}
+
+/*keep the high byte of each 16-bit sample*/
+static void narrow16To8(unsigned char* out, const unsigned char* in, size_t numsamples, unsigned features)
+{
+  size_t i = 0;
+  (void)features;
+#if defined(LODEPNG_SSE2)
+  i = narrow16To8SSE2(out, in, numsamples);
+#elif defined(LODEPNG_NEON)
+  i = narrow16To8NEON(out, in, numsamples);
+#endif
+  for(; i < numsamples; i++) out[i] = in[2 * i];
+}
+
+/*
+Converts a whole image to RGBA with 8 bits per sample if it is one of the common cases.
+Returns 1 if it did, 0 to leave it to the pixel by pixel conversion, which also reports
+invalid palette indices.
+*/
+static unsigned convertToRGBA8(unsigned char* out, const unsigned char* in, const LodePNG_InfoColor* infoIn, size_t numpixels)
+{
+  unsigned features = cpuFeatures();
+
+  if(infoIn->key_defined && (infoIn->colorType == 0 || infoIn->colorType == 2)) return 0;
+
+  if(infoIn->bitDepth == 8 && infoIn->colorType == 3)
+  {
+    unsigned table[256];
+    size_t i = 0;
+    int highest;
+#ifdef LODEPNG_SSE2
+    highest = maxIndexSSE2(in, numpixels);
+#else
+    highest = 0;
+    for(i = 0; i < numpixels; i++) if(in[i] > highest) highest = in[i];
+    i = 0;
+#endif
+    if(highest >= (int)infoIn->palettesize) return 0;
+
+    memcpy(table, infoIn->palette, infoIn->palettesize * 4);
+#ifdef LODEPNG_X86_RUNTIME
+    if(features & LODEPNG_CPU_AVX2) i = paletteToRGBA8AVX2(out, in, numpixels, table);
+#endif
+    for(; i < numpixels; i++) memcpy(&out[4 * i], &table[in[i]], 4);
+    return 1;
+  }
+  else if(infoIn->bitDepth == 8 && infoIn->colorType != 3)
+  {
+    expandToRGBA8(out, in, infoIn->colorType, numpixels, features);
+    return 1;
+  }
+  else if(infoIn->bitDepth == 16)
+  {
+    unsigned char narrowed[NARROW_CHUNK * 4];
+    size_t channels = LodePNG_InfoColor_getChannels(infoIn), i;
+
+    if(infoIn->colorType == 6)
+    {
+      narrow16To8(out, in, numpixels * 4, features);
+      return 1;
+    }
+    for(i = 0; i < numpixels; i += NARROW_CHUNK)
+    {
+      size_t amount = numpixels - i < NARROW_CHUNK ? numpixels - i : NARROW_CHUNK;
+      narrow16To8(narrowed, &in[2 * channels * i], channels * amount, features);
+      expandToRGBA8(&out[4 * i], narrowed, infoIn->colorType, amount, features);
+    }
+    return 1;
+  }
+  return 0;
+}
+
 /*convert from any color type to RGB or RGBA with 8 bits per sample*/
 static unsigned LodePNG_convert_rgb_a_8(unsigned char* out, const unsigned char* in, LodePNG_InfoColor* infoIn, size_t numpixels, unsigned bytes, unsigned alpha)
 {
@@ -2659,7 +4219,7 @@ static unsigned LodePNG_convert_rgb_a_8(unsigned char* out, const unsigned char*
         for(i = 0; i < numpixels; i++)
         {
           out[bytes * i + 0] = out[bytes * i + 1] = out[bytes * i + 2] = in[2 * i];
-          if(alpha) out[bytes * i + 3] = infoIn->key_defined && 256U * in[i] + in[i + 1] == infoIn->key_r ? 0 : 255;
+          if(alpha) out[bytes * i + 3] = infoIn->key_defined && 256U * in[2 * i] + in[2 * i + 1] == infoIn->key_r ? 0 : 255;
         }
         break;
       case 2: /*RGB color*/
@@ -2754,7 +4314,7 @@ static unsigned LodePNG_convert_grey_8(unsigned char* out, const unsigned char*
         {
           if(alpha) out[bytes * i + 1] = 255;
           out[bytes * i] = in[2 * i];
-          if(alpha && infoIn->key_defined && 256U * in[i] + in[i + 1] == infoIn->key_r)
+          if(alpha && infoIn->key_defined && 256U * in[2 * i] + in[2 * i + 1] == infoIn->key_r)
           {
             out[bytes * i + 1] = 0;
           }
@@ -2828,7 +4388,7 @@ static unsigned LodePNG_convert_rgb_a_16(unsigned char* out, const unsigned char
         for(i = 0; i < numpixels; i++)
         {
           if(in[i] >= infoIn->palettesize) return 46; /*invalid palette index*/
-          for(c = 0; c < bytes; c++)
+          for(c = 0; c < bytes / 2; c++)
           {
             out[bytes * i + 2 * c] = out[bytes * i + 2 * c + 1] = infoIn->palette[4 * in[i] + c];
           }
@@ -2837,8 +4397,8 @@ static unsigned LodePNG_convert_rgb_a_16(unsigned char* out, const unsigned char
       case 4: /*greyscale with alpha*/
         for(i = 0; i < numpixels; i++)
         {
-          out[bytes * i + 0] = out[bytes * i + 2] = out[bytes * i + 4] = in[i];
-          out[bytes * i + 1] = out[bytes * i + 3] = out[bytes * i + 5] = in[i];
+          out[bytes * i + 0] = out[bytes * i + 2] = out[bytes * i + 4] = in[2 * i];
+          out[bytes * i + 1] = out[bytes * i + 3] = out[bytes * i + 5] = in[2 * i];
           if(alpha)
           {
             out[bytes * i + 6] = out[bytes * i + 7] = in[2 * i + 1];
@@ -2872,7 +4432,7 @@ static unsigned LodePNG_convert_rgb_a_16(unsigned char* out, const unsigned char
           out[bytes * i + 1] = out[bytes * i + 3] = out[bytes * i + 5] = in[2 * i + 1];
           if(alpha)
           {
-            if(infoIn->key_defined && 256U * in[i] + in[i + 1] == infoIn->key_r)
+            if(infoIn->key_defined && 256U * in[2 * i] + in[2 * i + 1] == infoIn->key_r)
               out[bytes * i + 6] = out[bytes * i + 7] = 0;
             else out[bytes * i + 6] = out[bytes * i + 7] = 255;
           }
@@ -2906,7 +4466,7 @@ static unsigned LodePNG_convert_rgb_a_16(unsigned char* out, const unsigned char
       case 6: /*RGB with alpha*/
         for(i = 0; i < numpixels; i++)
         {
-          for(c = 0; c < bytes; c++) out[bytes * i + c] = in[8 * i + 2 * c];
+          for(c = 0; c < bytes; c++) out[bytes * i + c] = in[8 * i + c];
         }
         break;
       default: break;
@@ -2988,7 +4548,7 @@ static unsigned LodePNG_convert_grey_16(unsigned char* out, const unsigned char*
           out[bytes * i + 1] = in[2 * i + 1];
           if(alpha)
           {
-            if(infoIn->key_defined && 256U * in[i] + in[i + 1] == infoIn->key_r)
+            if(infoIn->key_defined && 256U * in[2 * i] + in[2 * i + 1] == infoIn->key_r)
               out[bytes * i + 2] = out[bytes * i + 3] = 0;
             else out[bytes * i + 2] = out[bytes * i + 3] = 255;
           }
@@ -3025,23 +4585,24 @@ static unsigned LodePNG_convert_grey_16(unsigned char* out, const unsigned char*
 converts from any color type to 24-bit or 32-bit (later maybe more supported). return value = LodePNG error code
 the out buffer must have (w * h * bpp + 7) / 8 bytes, where bpp is the bits per pixel of the output color type (LodePNG_InfoColor_getBpp)
 for < 8 bpp images, there may _not_ be padding bits at the end of scanlines.
+if simd is set, conversions to RGBA use the SIMD kernels where there are any (see convertToRGBA8)
 */
-unsigned LodePNG_convert(unsigned char* out, const unsigned char* in, LodePNG_InfoColor* infoOut, LodePNG_InfoColor* infoIn, unsigned w, unsigned h)
+static unsigned convertColors(unsigned char* out, const unsigned char* in, LodePNG_InfoColor* infoOut, LodePNG_InfoColor* infoIn, unsigned w, unsigned h, unsigned simd)
 {
-  size_t numpixels = w * h; /*amount of pixels*/
+  size_t numpixels = (size_t)w * h; /*amount of pixels*/
   unsigned bytes = LodePNG_InfoColor_getBpp(infoOut) / 8; /*bytes per pixel in the output image*/
   unsigned alpha = LodePNG_InfoColor_isAlphaType(infoOut); /*use 8-bit alpha channel*/
   
   /*cases where in and out already have the same format*/
   if(LodePNG_InfoColor_equal(infoIn, infoOut))
   {
-    size_t i;
     size_t size = (numpixels * LodePNG_InfoColor_getBpp(infoIn) + 7) / 8;
-    for(i = 0; i < size; i++) out[i] = in[i];
+    memcpy(out, in, size);
     return 0;
   }
   else if((infoOut->colorType == 2 || infoOut->colorType == 6) && infoOut->bitDepth == 8)
   {
+    if(simd && infoOut->colorType == 6 && convertToRGBA8(out, in, infoIn, numpixels)) return 0;
     LodePNG_convert_rgb_a_8(out, in, infoIn, numpixels, bytes, alpha);
   }
   else if(LodePNG_InfoColor_isGreyscaleType(infoOut) && infoOut->bitDepth == 8) /*conversion from greyscale to greyscale*/
@@ -3062,6 +4623,11 @@ unsigned LodePNG_convert(unsigned char* out, const unsigned char* in, LodePNG_In
   return 0;
 }
 
+unsigned LodePNG_convert(unsigned char* out, const unsigned char* in, LodePNG_InfoColor* infoOut, LodePNG_InfoColor* infoIn, unsigned w, unsigned h)
+{
+  return convertColors(out, in, infoOut, infoIn, w, h, 1);
+}
+
 /*
 Paeth predicter, used by PNG filter type 4
 The parameters are of type short, but should come from unsigned chars, the shorts
@@ -3083,6 +4649,32 @@ static unsigned char paethPredictor(short a, short b, short c)
   else return (unsigned char)c;
 }
 
+#ifdef LODEPNG_SSE2
+static __m128i absSSE2(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/*mask ? x : y*/
+static __m128i selectSSE2(__m128i mask, __m128i x, __m128i y)
+{
+  return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+/*paethPredictor on 8 lanes of 16 bits: a is left, b is above, c is above left*/
+static __m128i paethSSE2(__m128i a, __m128i b, __m128i c)
+{
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = absSSE2(_mm_add_epi16(pa, pb));
+  __m128i smallest;
+  pa = absSSE2(pa);
+  pb = absSSE2(pb);
+  smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  return selectSSE2(_mm_cmpeq_epi16(smallest, pa), a, selectSSE2(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+#endif /*LODEPNG_SSE2*/
+
 /*shared values used by multiple Adam7 related functions*/
 
 static const unsigned ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 }; /*x start values*/
@@ -3176,25 +4768,257 @@ void LodePNG_Decoder_inspect(LodePNG_Decoder* decoder, const unsigned char* in,
   decoder->error = checkColorValidity(decoder->infoPng.color.colorType, decoder->infoPng.color.bitDepth);
 }
 
-static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned char filterType, size_t length)
+/*
+SIMD unfiltering. For 3 and 4 byte pixels the Sub, Average and Paeth filters depend
+on the pixel to the left, so those kernels work one whole pixel at a time in a
+vector register instead of byte by byte. Up has no such dependency and is done 16
+(or with AVX2 32) bytes at a time for any pixel size. The results are identical to
+the scalar code in unfilterScanline, which handles everything else.
+*/
+
+#ifdef LODEPNG_SSE2
+
+/*
+load or store one pixel of bytewidth 3 or 4 in the low bytes of a register. 3 byte
+pixels go byte by byte, a variable sized memcpy is much slower.
+*/
+static __m128i loadPixelSSE2(const unsigned char* p, size_t bytewidth)
+{
+  int value;
+  if(bytewidth == 4) memcpy(&value, p, 4);
+  else value = p[0] | (p[1] << 8) | (p[2] << 16);
+  return _mm_cvtsi32_si128(value);
+}
+
+static void storePixelSSE2(unsigned char* p, __m128i pixel, size_t bytewidth)
 {
-  /*
-  For PNG filter method 0
-  unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte, the filter works byte per byte (bytewidth = 1)
-  precon is the previous unfiltered scanline, recon the result, scanline the current one
-  the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
-  recon and scanline MAY be the same memory address! precon must be disjoint.
-  */
+  int value = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else
+  {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+  }
+}
+
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+  }
+  for(; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
 
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  __m128i a = _mm_setzero_si128();
   size_t i;
-  switch(filterType)
+  for(i = 0; i < length; i += bytewidth)
   {
-    case 0:
-      for(i = 0; i < length; i++) recon[i] = scanline[i];
-      break;
-    case 1:
-      for(i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-      for(i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+    a = _mm_add_epi8(a, loadPixelSSE2(&scanline[i], bytewidth));
+    storePixelSSE2(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+{
+  /*_mm_avg_epu8 rounds up, so take the carried low bit off again to get (a + b) / 2*/
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = loadPixelSSE2(&precon[i], bytewidth);
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixelSSE2(&scanline[i], bytewidth), average);
+    storePixelSSE2(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+{
+  /*a is left, b is above, c is above left, on 16-bit lanes*/
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], bytewidth), zero);
+    __m128i predictor = paethSSE2(a, b, c);
+    __m128i x = _mm_add_epi8(loadPixelSSE2(&scanline[i], bytewidth), _mm_packus_epi16(predictor, predictor));
+    storePixelSSE2(&recon[i], x, bytewidth);
+
+    a = _mm_unpacklo_epi8(x, zero);
+    c = b;
+  }
+}
+
+#endif /*LODEPNG_SSE2*/
+
+#ifdef LODEPNG_X86_RUNTIME
+
+LODEPNG_TARGET_AVX2
+static void unfilterUpAVX2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length)
+{
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)&precon[i]);
+    _mm256_storeu_si256((__m256i*)&recon[i], _mm256_add_epi8(x, b));
+  }
+  for(; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+#endif /*LODEPNG_X86_RUNTIME*/
+
+#ifdef LODEPNG_NEON
+
+/*like loadPixelSSE2 and storePixelSSE2*/
+static uint8x8_t loadPixelNEON(const unsigned char* p, size_t bytewidth)
+{
+  unsigned value;
+  if(bytewidth == 4) memcpy(&value, p, 4);
+  else value = p[0] | (p[1] << 8) | (p[2] << 16);
+  return vreinterpret_u8_u32(vdup_n_u32(value));
+}
+
+static void storePixelNEON(unsigned char* p, uint8x8_t pixel, size_t bytewidth)
+{
+  unsigned value = vget_lane_u32(vreinterpret_u32_u8(pixel), 0);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else
+  {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+  }
+}
+
+static void unfilterUpNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    vst1q_u8(&recon[i], vaddq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&precon[i])));
+  }
+  for(; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterSubNEON(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  uint8x8_t a = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    a = vadd_u8(a, loadPixelNEON(&scanline[i], bytewidth));
+    storePixelNEON(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterAverageNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+{
+  uint8x8_t a = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    a = vadd_u8(loadPixelNEON(&scanline[i], bytewidth), vhadd_u8(a, loadPixelNEON(&precon[i], bytewidth)));
+    storePixelNEON(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterPaethNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+{
+  uint8x8_t a = vdup_n_u8(0), c = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    uint8x8_t b = loadPixelNEON(&precon[i], bytewidth);
+    uint16x8_t pa = vabdl_u8(b, c);
+    uint16x8_t pb = vabdl_u8(a, c);
+    uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+    uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+    uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+    uint8x8_t predictor = vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+
+    a = vadd_u8(loadPixelNEON(&scanline[i], bytewidth), predictor);
+    storePixelNEON(&recon[i], a, bytewidth);
+    c = b;
+  }
+}
+
+#endif /*LODEPNG_NEON*/
+
+/*
+Unfilters the scanline with SIMD instructions if there is a kernel for this filter
+type and pixel size on this CPU. Returns 1 if it did, 0 to leave it to the scalar code.
+*/
+static unsigned unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned char filterType, size_t length)
+{
+  unsigned features = cpuFeatures();
+  if(!(features & (LODEPNG_CPU_SSE2 | LODEPNG_CPU_NEON)) || filterType == 0) return 0;
+  if(filterType != 2 && bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType != 1 && !precon) return 0; /*the first scanline is cheap anyway*/
+
+#ifdef LODEPNG_SSE2
+  switch(filterType)
+  {
+    case 1: unfilterSubSSE2(recon, scanline, bytewidth, length); return 1;
+    case 2:
+#ifdef LODEPNG_X86_RUNTIME
+      if(features & LODEPNG_CPU_AVX2)
+      {
+        unfilterUpAVX2(recon, scanline, precon, length);
+        return 1;
+      }
+#endif /*LODEPNG_X86_RUNTIME*/
+      unfilterUpSSE2(recon, scanline, precon, length);
+      return 1;
+    case 3: unfilterAverageSSE2(recon, scanline, precon, bytewidth, length); return 1;
+    case 4: unfilterPaethSSE2(recon, scanline, precon, bytewidth, length); return 1;
+  }
+#endif /*LODEPNG_SSE2*/
+
+#ifdef LODEPNG_NEON
+  switch(filterType)
+  {
+    case 1: unfilterSubNEON(recon, scanline, bytewidth, length); return 1;
+    case 2: unfilterUpNEON(recon, scanline, precon, length); return 1;
+    case 3: unfilterAverageNEON(recon, scanline, precon, bytewidth, length); return 1;
+    case 4: unfilterPaethNEON(recon, scanline, precon, bytewidth, length); return 1;
+  }
+#endif /*LODEPNG_NEON*/
+
+  (void)recon; (void)scanline; (void)length;
+  return 0;
+}
+
+static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned char filterType, size_t length, unsigned simd)
+{
+  /*
+  For PNG filter method 0
+  unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte, the filter works byte per byte (bytewidth = 1)
+  precon is the previous unfiltered scanline, recon the result, scanline the current one
+  the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
+  recon and scanline MAY be the same memory address! precon must be disjoint.
+  if simd is set, SIMD kernels are used where the CPU has them (see unfilterScanlineSIMD)
+  */
+
+  size_t i;
+  if(simd && filterType <= 4 && unfilterScanlineSIMD(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+  switch(filterType)
+  {
+    case 0:
+      for(i = 0; i < length; i++) recon[i] = scanline[i];
+      break;
+    case 1:
+      for(i =         0; i < bytewidth; i++) recon[i] = scanline[i];
+      for(i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
       break;
     case 2:
       if(precon)
@@ -3247,13 +5071,13 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp, unsigned simd)
 {
   /*
   For PNG filter method 0
   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
-  w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
+  w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel, simd enables the SIMD kernels
   in and out are allowed to be the same memory address (but are not the same size because in has the extra filter bytes)
   */
 
@@ -3269,7 +5093,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
-    unsigned error = unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
+    unsigned error = unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes, simd);
     if(error) return error;
 
     prevline = &out[outindex];
@@ -3278,19 +5102,23 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   return 0;
 }
 
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp, unsigned level)
 {
   /*Note: this function works on image buffers WITHOUT padding bits at end of scanlines with non-multiple-of-8 bit amounts, only between reduced images is padding
-  out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation (because that's likely a little bit faster)*/
+  out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation (because that's likely a little bit faster)
+  level 0 gives the whole image from the 7 passes; level 1, 2 or 3 gives the image at 1/2^level of the size (rounded up) from the first 5, 3 or 1 passes,
+  whose pixels all lie on multiples of 2^level*/
   unsigned passw[7], passh[7];
   size_t filter_passstart[8], padded_passstart[8], passstart[8];
   unsigned i;
+  unsigned passes = 7 - 2 * level;
+  unsigned ow = (w + (1U << level) - 1) >> level; /*width of out*/
 
   Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
   if(bpp >= 8)
   {
-    for(i = 0; i < 7; i++)
+    for(i = 0; i < passes; i++)
     {
       unsigned x, y, b;
       size_t bytewidth = bpp / 8;
@@ -3298,7 +5126,7 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
       for(x = 0; x < passw[i]; x++)
       {
         size_t pixelinstart = passstart[i] + (y * passw[i] + x) * bytewidth;
-        size_t pixeloutstart = ((ADAM7_IY[i] + y * ADAM7_DY[i]) * w + ADAM7_IX[i] + x * ADAM7_DX[i]) * bytewidth;
+        size_t pixeloutstart = ((size_t)((ADAM7_IY[i] + y * ADAM7_DY[i]) >> level) * ow + ((ADAM7_IX[i] + x * ADAM7_DX[i]) >> level)) * bytewidth;
         for(b = 0; b < bytewidth; b++)
         {
           out[pixeloutstart + b] = in[pixelinstart + b];
@@ -3308,17 +5136,17 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
   }
   else /*bpp < 8: Adam7 with pixels < 8 bit is a bit trickier: with bit pointers*/
   {
-    for(i = 0; i < 7; i++)
+    for(i = 0; i < passes; i++)
     {
       unsigned x, y, b;
       unsigned ilinebits = bpp * passw[i];
-      unsigned olinebits = bpp * w;
+      unsigned olinebits = bpp * ow;
       size_t obp, ibp; /*bit pointers (for out and in buffer)*/
       for(y = 0; y < passh[i]; y++)
       for(x = 0; x < passw[i]; x++)
       {
         ibp = (8 * passstart[i]) + (y * ilinebits + x * bpp);
-        obp = (ADAM7_IY[i] + y * ADAM7_DY[i]) * olinebits + (ADAM7_IX[i] + x * ADAM7_DX[i]) * bpp;
+        obp = (size_t)((ADAM7_IY[i] + y * ADAM7_DY[i]) >> level) * olinebits + ((ADAM7_IX[i] + x * ADAM7_DX[i]) >> level) * bpp;
         for(b = 0; b < bpp; b++)
         {
           unsigned char bit = readBitFromReversedStream(&ibp, in);
@@ -3352,8 +5180,26 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in, size_
   }
 }
 
+/*unfilters Adam7 pass i of the scanlines in in, in place, and removes its padding bits, leaving the reduced image at passstart[i]. The passes before it must have been done already.*/
+static unsigned Adam7_unfilterPass(unsigned char* in, unsigned i, unsigned w, unsigned h, unsigned bpp, unsigned simd)
+{
+  unsigned passw[7], passh[7]; size_t filter_passstart[8], padded_passstart[8], passstart[8];
+  unsigned error;
+
+  Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+
+  error = unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp, simd);
+  if(error) return error;
+  if(bpp < 8) /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline, move bytes instead of bits or move not at all*/
+  {
+    /*remove padding bits in scanlines; after this there still may be padding bits between the different reduced images: each reduced image still starts nicely at a byte*/
+    removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], passw[i] * bpp, ((passw[i] * bpp + 7) / 8) * 8, passh[i]);
+  }
+  return 0;
+}
+
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks (with filter index bytes and possible padding bits)*/
-static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, const LodePNG_InfoPng* infoPng) /*return value is error*/
+static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, const LodePNG_InfoPng* infoPng, unsigned simd) /*return value is error*/
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype. Steps:
@@ -3371,88 +5217,90 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in, cons
   {
     if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-      error = unfilter(in, in, w, h, bpp);
+      error = unfilter(in, in, w, h, bpp, simd);
       if(error) return error;
       removePaddingBits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
     }
-    else error = unfilter(out, in, w, h, bpp); /*we can immediatly filter into the out buffer, no other steps needed*/
+    else error = unfilter(out, in, w, h, bpp, simd); /*we can immediatly filter into the out buffer, no other steps needed*/
   }
   else /*interlaceMethod is 1 (Adam7)*/
   {
-    unsigned passw[7], passh[7]; size_t filter_passstart[8], padded_passstart[8], passstart[8];
     unsigned i;
 
-    Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
-
     for(i = 0; i < 7; i++)
     {
-      error = unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp);
+      error = Adam7_unfilterPass(in, i, w, h, bpp, simd);
       if(error) return error;
-      if(bpp < 8) /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline, move bytes instead of bits or move not at all*/
-      {
-        /*remove padding bits in scanlines; after this there still may be padding bits between the different reduced images: each reduced image still starts nicely at a byte*/
-        removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], passw[i] * bpp, ((passw[i] * bpp + 7) / 8) * 8, passh[i]);
-      }
     }
 
-    Adam7_deinterlace(out, in, w, h, bpp);
+    if(bpp < 8) memset(out, 0, ((size_t)w * h * bpp + 7) / 8); /*Adam7_deinterlace only sets bits, and out may be a reused or the caller's buffer*/
+    Adam7_deinterlace(out, in, w, h, bpp, 0);
   }
 
   return error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize)
+/*the size of the decompressed IDAT data: the scanlines of the image, or of its 7 Adam7 passes, with their filter type bytes*/
+static size_t getScanlinesSize(const LodePNG_InfoPng* infoPng)
 {
-  unsigned char IEND = 0;
-  const unsigned char* chunk;
-  size_t i;
-  ucvector idat; /*the data from idat chunks*/
-
-  /*for unknown chunk order*/
-  unsigned unknown = 0;
-  unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
-
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-  *outsize = 0;
-
-  LodePNG_Decoder_inspect(decoder, in, insize); /*reads header and resets other parameters in decoder->infoPng*/
-  if(decoder->error) return;
-
-  ucvector_init(&idat);
-
-  chunk = &in[33]; /*first byte of the first chunk after the header*/
-
-  while(!IEND) /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer*/
+  unsigned bpp = LodePNG_InfoColor_getBpp(&infoPng->color);
+  if(infoPng->interlaceMethod == 0)
   {
-    unsigned chunkLength;
-    const unsigned char* data; /*the data in the chunk*/
-
-    if((size_t)((chunk - in) + 12) > insize || chunk < in) CERROR_BREAK(decoder->error, 30); /*error: size of the in buffer too small to contain next chunk*/
+    return (size_t)infoPng->height * (1 + ((size_t)infoPng->width * bpp + 7) / 8);
+  }
+  else
+  {
+    unsigned passw[7], passh[7];
+    size_t filter_passstart[8], padded_passstart[8], passstart[8];
+    Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, infoPng->width, infoPng->height, bpp);
+    return filter_passstart[7];
+  }
+}
 
-    chunkLength = LodePNG_chunk_length(chunk); /*length of the data of the chunk, excluding the length bytes, chunk type and CRC bytes*/
-    if(chunkLength > 2147483647) CERROR_BREAK(decoder->error, 63); /*chunk length larger than the max PNG chunk size*/
+/*
+make a scratch buffer hold at least size bytes, keeping its contents. With grow, for
+buffers that get appended to, it makes room for twice that when it reallocates.
+Returns 0 if out of memory.
+*/
+static unsigned reserveScratch(unsigned char** buffer, size_t* allocsize, size_t size, unsigned grow)
+{
+  if(size > *allocsize)
+  {
+    size_t newsize = grow ? size * 2 : size;
+    unsigned char* data = (unsigned char*)realloc(*buffer, newsize);
+    if(!data) return 0;
+    *buffer = data;
+    *allocsize = newsize;
+  }
+  return 1;
+}
 
-    if((size_t)((chunk - in) + chunkLength + 12) > insize || (chunk + chunkLength + 12) < in) CERROR_BREAK(decoder->error, 64); /*error: size of the in buffer too small to contain next chunk*/
+/*the decoder's inflate trees, made the first time. NULL if out of memory, then inflate makes its own*/
+static LodeFlate_Trees* inflateTrees(LodePNG_Decoder* decoder)
+{
+  if(!decoder->scratch.trees)
+  {
+    decoder->scratch.trees = (LodeFlate_Trees*)malloc(sizeof(LodeFlate_Trees));
+    if(decoder->scratch.trees) LodeFlate_Trees_init(decoder->scratch.trees);
+  }
+  return decoder->scratch.trees;
+}
 
-    data = LodePNG_chunk_data_const(chunk);
+/*
+reads a chunk other than IDAT and IEND into decoder->infoPng. critical_pos tells where
+unknown chunks go (1 = after IHDR, 2 = after PLTE, 3 = after IDAT), unknown is set when
+the chunk is of an unknown type. The caller checks the CRC.
+*/
+static void readChunk(LodePNG_Decoder* decoder, const unsigned char* chunk, unsigned* critical_pos, unsigned* unknown)
+{
+  unsigned chunkLength = LodePNG_chunk_length(chunk);
+  const unsigned char* data = LodePNG_chunk_data_const(chunk);
+  size_t i;
 
-    /*IDAT chunk, containing compressed image data*/
-    if(LodePNG_chunk_type_equals(chunk, "IDAT"))
-    {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(decoder->error, 9936 /*alloc fail*/);
-      for(i = 0; i < chunkLength; i++) idat.data[oldsize + i] = data[i];
-      critical_pos = 3;
-    }
-    /*IEND chunk*/
-    else if(LodePNG_chunk_type_equals(chunk, "IEND"))
-    {
-      IEND = 1;
-    }
+  while(!decoder->error) /*not really a while loop, only used to break on error*/
+  {
     /*palette chunk (PLTE)*/
-    else if(LodePNG_chunk_type_equals(chunk, "PLTE"))
+    if(LodePNG_chunk_type_equals(chunk, "PLTE"))
     {
       unsigned pos = 0;
       if(decoder->infoPng.color.palette) free(decoder->infoPng.color.palette);
@@ -3472,7 +5320,7 @@ static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t*
         decoder->infoPng.color.palette[4 * i + 2] = data[pos++]; /*B*/
         decoder->infoPng.color.palette[4 * i + 3] = 255; /*alpha*/
       }
-      critical_pos = 2;
+      *critical_pos = 2;
     }
     /*palette transparency chunk (tRNS)*/
     else if(LodePNG_chunk_type_equals(chunk, "tRNS"))
@@ -3597,7 +5445,7 @@ static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t*
           if(string2_begin > chunkLength) CERROR_BREAK(decoder->error, 75); /*no null termination, corrupt?*/
 
           length = chunkLength - string2_begin;
-          decoder->error = LodePNG_decompress(&decoded.data, &decoded.size, (unsigned char*)(&data[string2_begin]), length, &decoder->settings.zlibsettings);
+          decoder->error = LodePNG_decompress(&decoded.data, &decoded.size, (unsigned char*)(&data[string2_begin]), length, &decoder->settings.zlibsettings, inflateTrees(decoder));
           if(decoder->error) break;
           ucvector_push_back(&decoded, 0);
 
@@ -3672,7 +5520,7 @@ static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t*
 
           if(compressed)
           {
-            decoder->error = LodePNG_decompress(&decoded.data, &decoded.size, (unsigned char*)(&data[begin]), length, &decoder->settings.zlibsettings);
+            decoder->error = LodePNG_decompress(&decoded.data, &decoded.size, (unsigned char*)(&data[begin]), length, &decoder->settings.zlibsettings, inflateTrees(decoder));
             if(decoder->error) break;
             ucvector_push_back(&decoded, 0);
           }
@@ -3722,94 +5570,669 @@ static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t*
     {
       if(LodePNG_chunk_critical(chunk)) CERROR_BREAK(decoder->error, 69); /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
 
-      unknown = 1;
+      *unknown = 1;
 #ifdef LODEPNG_COMPILE_UNKNOWN_CHUNKS
       if(decoder->settings.rememberUnknownChunks)
       {
         LodePNG_UnknownChunks* unknown = &decoder->infoPng.unknown_chunks;
-        decoder->error = LodePNG_append_chunk(&unknown->data[critical_pos - 1], &unknown->datasize[critical_pos - 1], chunk);
+        decoder->error = LodePNG_append_chunk(&unknown->data[*critical_pos - 1], &unknown->datasize[*critical_pos - 1], chunk);
         if(decoder->error) break;
       }
 #endif /*LODEPNG_COMPILE_UNKNOWN_CHUNKS*/
     }
+    break;
+  }
+}
+
+/*
+read the chunks of a PNG and inflate its image data into decoder->scratch.scanlines:
+the filtered, possibly interlaced rows with their filter type bytes.
+*/
+static void decodeScanlines(LodePNG_Decoder* decoder, const unsigned char* in, size_t insize)
+{
+  unsigned char IEND = 0;
+  const unsigned char* chunk;
+  LodePNG_DecodeScratch* scratch = &decoder->scratch;
+  const unsigned char* idat_data = 0; /*the compressed image data, in scratch->idat or still in the input*/
+  size_t idat_size = 0;
+  unsigned idat_joined = 0; /*whether there was more than one IDAT chunk, so they are in scratch->idat*/
+
+  /*for unknown chunk order*/
+  unsigned unknown = 0;
+  unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
+
+  LodePNG_Decoder_inspect(decoder, in, insize); /*reads header and resets other parameters in decoder->infoPng*/
+  if(decoder->error) return;
+
+  chunk = &in[33]; /*first byte of the first chunk after the header*/
+
+  while(!IEND) /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer*/
+  {
+    unsigned chunkLength;
+    const unsigned char* data; /*the data in the chunk*/
+
+    if((size_t)((chunk - in) + 12) > insize || chunk < in) CERROR_BREAK(decoder->error, 30); /*error: size of the in buffer too small to contain next chunk*/
+
+    chunkLength = LodePNG_chunk_length(chunk); /*length of the data of the chunk, excluding the length bytes, chunk type and CRC bytes*/
+    if(chunkLength > 2147483647) CERROR_BREAK(decoder->error, 63); /*chunk length larger than the max PNG chunk size*/
+
+    if((size_t)((chunk - in) + chunkLength + 12) > insize || (chunk + chunkLength + 12) < in) CERROR_BREAK(decoder->error, 64); /*error: size of the in buffer too small to contain next chunk*/
+
+    data = LodePNG_chunk_data_const(chunk);
+
+    /*IDAT chunk, containing compressed image data*/
+    if(LodePNG_chunk_type_equals(chunk, "IDAT"))
+    {
+      if(!idat_data)
+      {
+        /*a lone IDAT chunk is inflated where it is, they only get joined up if there are more*/
+        idat_data = data;
+        idat_size = chunkLength;
+      }
+      else
+      {
+        if(!reserveScratch(&scratch->idat, &scratch->idat_allocsize, idat_size + chunkLength, 1)) CERROR_BREAK(decoder->error, 9936 /*alloc fail*/);
+        if(!idat_joined && idat_size) memcpy(scratch->idat, idat_data, idat_size);
+        if(chunkLength) memcpy(&scratch->idat[idat_size], data, chunkLength);
+        idat_joined = 1;
+        idat_data = scratch->idat;
+        idat_size += chunkLength;
+      }
+      critical_pos = 3;
+    }
+    /*IEND chunk*/
+    else if(LodePNG_chunk_type_equals(chunk, "IEND"))
+    {
+      IEND = 1;
+    }
+    else
+    {
+      readChunk(decoder, chunk, &critical_pos, &unknown);
+      if(decoder->error) break;
+    }
+
+    if(!decoder->settings.ignoreCrc && !unknown) /*check CRC if wanted, only on known chunk types*/
+    {
+      if(LodePNG_chunk_check_crc(chunk)) CERROR_BREAK(decoder->error, 57); /*invalid CRC*/
+    }
+
+    if(!IEND) chunk = LodePNG_chunk_next_const(chunk);
+  }
+
+  if(!decoder->error)
+  {
+    size_t scanlinessize = getScanlinesSize(&decoder->infoPng);
+
+    /*make room for exactly what the image decompresses to, so that inflate never has to reallocate*/
+    if(!reserveScratch(&scratch->scanlines, &scratch->scanlines_allocsize, scanlinessize, 0)) decoder->error = 9945;
+    if(!decoder->error)
+    {
+      size_t size = scratch->scanlines_allocsize;
+      decoder->error = LodePNG_decompress(&scratch->scanlines, &size, idat_data, idat_size, &decoder->settings.zlibsettings, inflateTrees(decoder)); /*decompress with the Zlib decompressor*/
+      /*inflate reallocates it if the data is bigger than the header says, that is at least size bytes*/
+      if(size > scratch->scanlines_allocsize) scratch->scanlines_allocsize = size;
+    }
+  }
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+static void decodeGeneric(LodePNG_Decoder* decoder, unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize)
+{
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+  *outsize = 0;
+
+  decodeScanlines(decoder, in, insize);
+  if(!decoder->error)
+  {
+    ucvector outv;
+    ucvector_init(&outv);
+    if(!ucvector_resizev(&outv, (decoder->infoPng.height * decoder->infoPng.width * LodePNG_InfoColor_getBpp(&decoder->infoPng.color) + 7) / 8, 0)) decoder->error = 9946;
+    if(!decoder->error) decoder->error = postProcessScanlines(outv.data, decoder->scratch.scanlines, &decoder->infoPng, decoder->settings.simd);
+    *out = outv.data;
+    *outsize = outv.size;
+  }
+}
+
+void LodePNG_Decoder_decode(LodePNG_Decoder* decoder, unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize)
+{
+  *out = 0;
+  *outsize = 0;
+  decodeGeneric(decoder, out, outsize, in, insize);
+  if(decoder->error) return;
+  if(!decoder->settings.color_convert || LodePNG_InfoColor_equal(&decoder->infoRaw.color, &decoder->infoPng.color))
+  {
+    /*same color type, no copying or converting of data needed*/
+    /*store the infoPng color settings on the infoRaw so that the infoRaw still reflects what colorType
+    the raw image has to the end user*/
+    if(!decoder->settings.color_convert)
+    {
+      decoder->error = LodePNG_InfoColor_copy(&decoder->infoRaw.color, &decoder->infoPng.color);
+      if(decoder->error) return;
+    }
+  }
+  else
+  {
+    /*color conversion needed; sort of copy of the data*/
+    unsigned char* data = *out;
+
+    /*TODO: check if this works according to the statement in the documentation: "The converter can convert from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
+    if(!(decoder->infoRaw.color.colorType == 2 || decoder->infoRaw.color.colorType == 6) && !(decoder->infoRaw.color.bitDepth == 8))
+    {
+      decoder->error = 56; /*unsupported color mode conversion*/
+      return;
+    }
+
+    *outsize = (decoder->infoPng.width * decoder->infoPng.height * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color) + 7) / 8;
+    *out = (unsigned char*)malloc(*outsize);
+    if(!(*out))
+    {
+      decoder->error = 9947; /*alloc fail*/
+      *outsize = 0;
+    }
+    else decoder->error = convertColors(*out, data, &decoder->infoRaw.color, &decoder->infoPng.color, decoder->infoPng.width, decoder->infoPng.height, decoder->settings.simd);
+    free(data);
+  }
+}
+
+/*copy the rows of a packed image of linebits bits per row to rows that each start stride bytes apart*/
+static void copyRows(unsigned char* out, size_t stride, const unsigned char* in, size_t linebits, unsigned h)
+{
+  unsigned y;
+  if(linebits % 8 == 0)
+  {
+    for(y = 0; y < h; y++) memcpy(&out[y * stride], &in[y * (linebits / 8)], linebits / 8);
+  }
+  else
+  {
+    for(y = 0; y < h; y++)
+    {
+      size_t ibp = y * linebits, obp = y * stride * 8, x;
+      for(x = 0; x < linebits; x++) setBitOfReversedStream(&obp, out, readBitFromReversedStream(&ibp, in));
+    }
+  }
+}
+
+void LodePNG_Decoder_decodeInto(LodePNG_Decoder* decoder, unsigned char* out, size_t stride, size_t outsize, const unsigned char* in, size_t insize)
+{
+  LodePNG_DecodeScratch* scratch = &decoder->scratch;
+
+  decodeScanlines(decoder, in, insize);
+  while(!decoder->error) /*not really a while loop, only used to break on error*/
+  {
+    unsigned w = decoder->infoPng.width, h = decoder->infoPng.height;
+    unsigned convert = decoder->settings.color_convert && !LodePNG_InfoColor_equal(&decoder->infoRaw.color, &decoder->infoPng.color);
+    size_t pngbits, rawbits, rawrow;
+    unsigned char* image;
+
+    if(!decoder->settings.color_convert)
+    {
+      decoder->error = LodePNG_InfoColor_copy(&decoder->infoRaw.color, &decoder->infoPng.color);
+      if(decoder->error) break;
+    }
+    if(convert && !(decoder->infoRaw.color.colorType == 2 || decoder->infoRaw.color.colorType == 6) && !(decoder->infoRaw.color.bitDepth == 8))
+    {
+      CERROR_BREAK(decoder->error, 56); /*unsupported color mode conversion*/
+    }
+
+    pngbits = (size_t)w * LodePNG_InfoColor_getBpp(&decoder->infoPng.color);
+    rawbits = (size_t)w * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color);
+    rawrow = (rawbits + 7) / 8;
+    if(stride < rawrow || (h > 0 && outsize < stride * (h - 1) + rawrow)) CERROR_BREAK(decoder->error, 82);
+
+    if(!convert && stride * 8 == pngbits)
+    {
+      /*the common case: unfilter straight into out*/
+      decoder->error = postProcessScanlines(out, scratch->scanlines, &decoder->infoPng, decoder->settings.simd);
+      break;
+    }
+
+    /*else unfilter into the scratch image, in the PNG's color type*/
+    if(!reserveScratch(&scratch->image, &scratch->image_allocsize, (pngbits * h + 7) / 8, 0)) CERROR_BREAK(decoder->error, 9957); /*alloc fail*/
+    image = scratch->image;
+    decoder->error = postProcessScanlines(image, scratch->scanlines, &decoder->infoPng, decoder->settings.simd);
+    if(decoder->error) break;
+
+    if(!convert) copyRows(out, stride, image, pngbits, h);
+    else if(stride == rawrow)
+    {
+      decoder->error = convertColors(out, image, &decoder->infoRaw.color, &decoder->infoPng.color, w, h, decoder->settings.simd);
+    }
+    else if(pngbits % 8 == 0)
+    {
+      /*rows of the PNG's color type start at whole bytes, so they can be converted one at a time*/
+      unsigned y;
+      for(y = 0; y < h && !decoder->error; y++)
+      {
+        decoder->error = convertColors(&out[y * stride], &image[y * (pngbits / 8)], &decoder->infoRaw.color, &decoder->infoPng.color, w, 1, decoder->settings.simd);
+      }
+    }
+    else
+    {
+      unsigned char* converted = (unsigned char*)malloc(rawrow * h);
+      if(!converted && rawrow * h != 0) CERROR_BREAK(decoder->error, 9958); /*alloc fail*/
+      decoder->error = convertColors(converted, image, &decoder->infoRaw.color, &decoder->infoPng.color, w, h, decoder->settings.simd);
+      if(!decoder->error) copyRows(out, stride, converted, rawbits, h);
+      free(converted);
+    }
+    break;
+  }
+}
+
+/*
+The state of LodePNG_Decoder_streamPush between two pieces of input. The chunks around
+the image data are collected whole in pending and read like decodeScanlines does, the
+IDAT data goes to the inflater as it comes. Rows are unfiltered as soon as the
+inflater has them, so without interlacing only two rows and the 32K window are kept.
+Interlaced scanlines are kept whole, but each Adam7 pass is unfiltered once it is
+complete, so the previews can be made from the passes so far.
+*/
+#define STREAM_STEP 65536 /*the most output to inflate before taking rows out of the window*/
+
+typedef struct LodePNG_StreamState
+{
+  LodePNG_StreamCallbacks callbacks;
+  unsigned stage; /*what comes next: 0 signature and IHDR, 1 chunk header, 2 rest of a chunk, 3 IDAT data, 4 IDAT CRC, 5 nothing (after IEND)*/
+  ucvector pending; /*the bytes of the current stage read so far, up to need*/
+  size_t need;
+  size_t left; /*IDAT data still to come in the current chunk*/
+  unsigned crc; /*running CRC of the current IDAT chunk*/
+  unsigned critical_pos, unknown; /*as in decodeScanlines*/
+  unsigned started; /*an IDAT chunk came, so the header callback was called and the rows are set up*/
+
+  size_t zlibsize; /*zlib data seen so far*/
+  unsigned char zlibheader[2];
+  unsigned char tail[4]; /*the last 4 bytes of zlib data seen, in the end the Adler-32*/
+  LodeFlate_Stream inflater;
+  LodeFlate_Trees trees; /*own trees, zTXt chunks between the IDATs must not change them*/
+  unsigned adler;
+  size_t checked; /*the output in the window up to here went into adler*/
+  size_t taken; /*the output in the window up to here is used*/
+
+  unsigned convert;
+  size_t linebytes, rawrow, bytewidth;
+  unsigned rows, y; /*rows to emit, rows emitted*/
+  ucvector rowbuffer; /*without interlacing the previous and current row, then a converted row*/
+  unsigned current; /*which of the two rows is the current one*/
+  size_t scanlinessize, copied; /*with interlacing the scanlines are kept in scratch.scanlines until IEND*/
+  size_t filter_passstart[8]; /*where each Adam7 pass starts in the scanlines*/
+  unsigned pass; /*Adam7 passes unfiltered so far*/
+  ucvector preview; /*a preview image, and the same converted to infoRaw*/
+} LodePNG_StreamState;
+
+static void LodePNG_StreamState_cleanup(LodePNG_StreamState* state)
+{
+  ucvector_cleanup(&state->pending);
+  LodeFlate_Stream_cleanup(&state->inflater);
+  LodeFlate_Trees_cleanup(&state->trees);
+  ucvector_cleanup(&state->rowbuffer);
+  ucvector_cleanup(&state->preview);
+}
+
+/*converts row y of the PNG's color type if needed and passes it on*/
+static void streamRow(LodePNG_Decoder* decoder, LodePNG_StreamState* state, const unsigned char* line)
+{
+  if(state->convert)
+  {
+    unsigned char* converted = &state->rowbuffer.data[2 * state->linebytes];
+    decoder->error = convertColors(converted, line, &decoder->infoRaw.color, &decoder->infoPng.color, decoder->infoPng.width, 1, decoder->settings.simd);
+    if(!decoder->error) state->callbacks.row(state->callbacks.user, state->y, converted, state->rawrow);
+  }
+  else state->callbacks.row(state->callbacks.user, state->y, line, state->rawrow);
+  state->y++;
+}
+
+/*at the first IDAT: the header callback may pick infoRaw now that PLTE and tRNS are known*/
+static void streamStart(LodePNG_Decoder* decoder, LodePNG_StreamState* state)
+{
+  unsigned w = decoder->infoPng.width, h = decoder->infoPng.height;
+  size_t pngbits, rowsize;
+
+  state->started = 1;
+  if(state->callbacks.header) state->callbacks.header(state->callbacks.user, decoder);
+  if(decoder->error) return;
+
+  state->convert = decoder->settings.color_convert && !LodePNG_InfoColor_equal(&decoder->infoRaw.color, &decoder->infoPng.color);
+  if(!decoder->settings.color_convert)
+  {
+    decoder->error = LodePNG_InfoColor_copy(&decoder->infoRaw.color, &decoder->infoPng.color);
+    if(decoder->error) return;
+  }
+  if(state->convert && !(decoder->infoRaw.color.colorType == 2 || decoder->infoRaw.color.colorType == 6) && !(decoder->infoRaw.color.bitDepth == 8))
+  {
+    decoder->error = 56; /*unsupported color mode conversion*/
+    return;
+  }
+
+  pngbits = (size_t)w * LodePNG_InfoColor_getBpp(&decoder->infoPng.color);
+  state->linebytes = (pngbits + 7) / 8;
+  state->rawrow = ((size_t)w * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color) + 7) / 8;
+  state->bytewidth = (LodePNG_InfoColor_getBpp(&decoder->infoPng.color) + 7) / 8;
+  state->rows = w ? h : 0;
+
+  rowsize = 2 * state->linebytes + (state->convert ? state->rawrow : 0);
+  if(!ucvector_resize(&state->rowbuffer, rowsize)) { decoder->error = 9961; return; } /*alloc fail*/
+
+  if(decoder->infoPng.interlaceMethod == 1)
+  {
+    unsigned passw[7], passh[7];
+    size_t padded_passstart[8], passstart[8];
+    Adam7_getpassvalues(passw, passh, state->filter_passstart, padded_passstart, passstart, w, h, LodePNG_InfoColor_getBpp(&decoder->infoPng.color));
+    state->scanlinessize = state->filter_passstart[7];
+    if(!reserveScratch(&decoder->scratch.scanlines, &decoder->scratch.scanlines_allocsize, state->scanlinessize, 0)) decoder->error = 9962; /*alloc fail*/
+  }
+}
+
+/*with interlacing, gives the preview callback the image at 1/2^level of its size, from the Adam7 passes unfiltered so far*/
+static void streamPreview(LodePNG_Decoder* decoder, LodePNG_StreamState* state, unsigned level)
+{
+  unsigned w = (decoder->infoPng.width + (1U << level) - 1) >> level;
+  unsigned h = (decoder->infoPng.height + (1U << level) - 1) >> level;
+  unsigned bpp = LodePNG_InfoColor_getBpp(&decoder->infoPng.color);
+  size_t pngsize = ((size_t)w * h * bpp + 7) / 8;
+  size_t rawsize = state->convert ? ((size_t)w * h * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color) + 7) / 8 : 0;
+  unsigned char* image;
+
+  if(!ucvector_resize(&state->preview, pngsize + rawsize)) { decoder->error = 9966; return; } /*alloc fail*/
+  image = state->preview.data;
+  if(bpp < 8) memset(image, 0, pngsize); /*Adam7_deinterlace only sets bits*/
+  Adam7_deinterlace(image, decoder->scratch.scanlines, decoder->infoPng.width, decoder->infoPng.height, bpp, level);
+
+  if(state->convert)
+  {
+    decoder->error = convertColors(&image[pngsize], image, &decoder->infoRaw.color, &decoder->infoPng.color, w, h, decoder->settings.simd);
+    if(decoder->error) return;
+    image = &image[pngsize];
+  }
+  state->callbacks.preview(state->callbacks.user, level, image, w, h);
+}
+
+/*takes the rows the inflater has so far out of its window*/
+static void streamRows(LodePNG_Decoder* decoder, LodePNG_StreamState* state)
+{
+  LodeFlate_Stream* inflater = &state->inflater;
+  size_t drop;
+
+  if(decoder->infoPng.interlaceMethod == 1)
+  {
+    size_t amount = inflater->outpos - state->taken;
+    if(amount > state->scanlinessize - state->copied) amount = state->scanlinessize - state->copied;
+    if(amount) memcpy(&decoder->scratch.scanlines[state->copied], &inflater->out.data[state->taken], amount);
+    state->copied += amount;
+    state->taken += amount;
+    if(state->copied == state->scanlinessize) state->taken = inflater->outpos; /*anything after the scanlines is only inflated for the Adler-32*/
+
+    while(!decoder->error && state->rows && state->pass < 7 && state->copied >= state->filter_passstart[state->pass + 1])
+    {
+      decoder->error = Adam7_unfilterPass(decoder->scratch.scanlines, state->pass, decoder->infoPng.width, decoder->infoPng.height,
+                                          LodePNG_InfoColor_getBpp(&decoder->infoPng.color), decoder->settings.simd);
+      state->pass++;
+      /*passes 1, 3 and 5 complete the image at 1/8, 1/4 and 1/2 of its size*/
+      if(!decoder->error && state->callbacks.preview && state->pass % 2 == 1 && state->pass < 7) streamPreview(decoder, state, (7 - state->pass) / 2);
+    }
+  }
+  else
+  {
+    while(!decoder->error && state->y < state->rows && inflater->outpos - state->taken >= 1 + state->linebytes)
+    {
+      unsigned char* recon = &state->rowbuffer.data[state->current * state->linebytes];
+      unsigned char* precon = state->y ? &state->rowbuffer.data[(1 - state->current) * state->linebytes] : 0;
+      const unsigned char* scanline = &inflater->out.data[state->taken];
+
+      decoder->error = unfilterScanline(recon, &scanline[1], precon, state->bytewidth, scanline[0], state->linebytes, decoder->settings.simd);
+      if(decoder->error) break;
+      streamRow(decoder, state, recon);
+      state->current = 1 - state->current;
+      state->taken += 1 + state->linebytes;
+    }
+    if(state->y >= state->rows) state->taken = inflater->outpos;
+  }
+
+  drop = LodeFlate_Stream_release(inflater, state->taken);
+  state->taken -= drop;
+  state->checked -= drop;
+}
+
+/*inflates the IDAT data given so far and emits the rows that completes*/
+static void streamInflate(LodePNG_Decoder* decoder, LodePNG_StreamState* state)
+{
+  LodeFlate_Stream* inflater = &state->inflater;
+  unsigned progress = 1;
+
+  while(!decoder->error && progress)
+  {
+    decoder->error = LodeFlate_Stream_inflate(inflater, &state->trees, inflater->outpos + STREAM_STEP, &progress);
+    if(decoder->error) break;
+    if(!decoder->settings.zlibsettings.ignoreAdler32)
+    {
+      state->adler = update_adler32(state->adler, &inflater->out.data[state->checked], (unsigned)(inflater->outpos - state->checked));
+    }
+    state->checked = inflater->outpos;
+    streamRows(decoder, state);
+  }
+}
+
+/*the zlib data in one IDAT chunk: the header goes aside, the rest to the inflater*/
+static void streamIDAT(LodePNG_Decoder* decoder, LodePNG_StreamState* state, const unsigned char* data, size_t size)
+{
+  size_t i;
+
+  /*keep the last 4 bytes*/
+  for(i = size > 4 ? size - 4 : 0; i < size; i++)
+  {
+    state->tail[0] = state->tail[1];
+    state->tail[1] = state->tail[2];
+    state->tail[2] = state->tail[3];
+    state->tail[3] = data[i];
+  }
+
+  while(state->zlibsize < 2 && size > 0)
+  {
+    state->zlibheader[state->zlibsize++] = *data;
+    data++;
+    size--;
+    if(state->zlibsize == 2)
+    {
+      decoder->error = checkZlibHeader(state->zlibheader);
+      if(decoder->error) return;
+    }
+  }
+  state->zlibsize += size;
+
+  decoder->error = LodeFlate_Stream_append(&state->inflater, data, size);
+}
+
+/*at IEND: inflates the rest of the data, checks it and with interlacing emits all rows*/
+static void streamFinish(LodePNG_Decoder* decoder, LodePNG_StreamState* state)
+{
+  if(state->zlibsize < 2) { decoder->error = 53; return; } /*error, size of zlib data too small*/
 
-    if(!decoder->settings.ignoreCrc && !unknown) /*check CRC if wanted, only on known chunk types*/
-    {
-      if(LodePNG_chunk_check_crc(chunk)) CERROR_BREAK(decoder->error, 57); /*invalid CRC*/
-    }
+  state->inflater.complete = 1;
+  streamInflate(decoder, state);
+  if(decoder->error) return;
 
-    if(!IEND) chunk = LodePNG_chunk_next_const(chunk);
+  if(!decoder->settings.zlibsettings.ignoreAdler32)
+  {
+    if(state->adler != LodeZlib_read32bitInt(state->tail)) { decoder->error = 58; return; } /*error, adler checksum not correct, data must be corrupted*/
   }
 
-  if(!decoder->error)
+  if(decoder->infoPng.interlaceMethod == 1)
   {
-    ucvector scanlines;
-    ucvector_init(&scanlines);
+    size_t pngbits = (size_t)decoder->infoPng.width * LodePNG_InfoColor_getBpp(&decoder->infoPng.color);
+    LodePNG_DecodeScratch* scratch = &decoder->scratch;
+    size_t imagesize = (pngbits * decoder->infoPng.height + 7) / 8;
+    unsigned bpp = LodePNG_InfoColor_getBpp(&decoder->infoPng.color);
+    unsigned y;
 
-    /*maximum final image length is already reserved in the vector's length - this is not really necessary*/
-    if(!ucvector_resize(&scanlines, ((decoder->infoPng.width * (decoder->infoPng.height * LodePNG_InfoColor_getBpp(&decoder->infoPng.color) + 7)) / 8) + decoder->infoPng.height))
-    {
-      decoder->error = 9945;
-    }
-    if(!decoder->error)
-    {
-      decoder->error = LodePNG_decompress(&scanlines.data, &scanlines.size, idat.data, idat.size, &decoder->settings.zlibsettings); /*decompress with the Zlib decompressor*/
-    }
+    if(state->copied < state->scanlinessize) { decoder->error = 83; return; } /*the image data ended before the last row*/
+    if(!reserveScratch(&scratch->image, &scratch->image_allocsize, imagesize, 0)) { decoder->error = 9963; return; } /*alloc fail*/
+    /*streamRows has unfiltered all passes by now*/
+    if(bpp < 8) memset(scratch->image, 0, imagesize); /*Adam7_deinterlace only sets bits*/
+    Adam7_deinterlace(scratch->image, scratch->scanlines, decoder->infoPng.width, decoder->infoPng.height, bpp, 0);
 
-    if(!decoder->error)
+    for(y = 0; y < state->rows && !decoder->error; y++)
     {
-      ucvector outv;
-      ucvector_init(&outv);
-      if(!ucvector_resizev(&outv, (decoder->infoPng.height * decoder->infoPng.width * LodePNG_InfoColor_getBpp(&decoder->infoPng.color) + 7) / 8, 0)) decoder->error = 9946;
-      if(!decoder->error) decoder->error = postProcessScanlines(outv.data, scanlines.data, &decoder->infoPng);
-      *out = outv.data;
-      *outsize = outv.size;
+      if(pngbits % 8 == 0) streamRow(decoder, state, &scratch->image[y * (pngbits / 8)]);
+      else
+      {
+        /*the rows of the deinterlaced image aren't padded to whole bytes*/
+        unsigned char* line = state->rowbuffer.data;
+        size_t ibp = y * pngbits, obp = 0, x;
+        for(x = 0; x < pngbits; x++) setBitOfReversedStream(&obp, line, readBitFromReversedStream(&ibp, scratch->image));
+        streamRow(decoder, state, line);
+      }
     }
-    ucvector_cleanup(&scanlines);
   }
-
-  ucvector_cleanup(&idat);
+  else if(state->y < state->rows) decoder->error = 83; /*the image data ended before the last row*/
+}
+
+void LodePNG_Decoder_streamBegin(LodePNG_Decoder* decoder, const LodePNG_StreamCallbacks* callbacks)
+{
+  LodePNG_StreamState* state = decoder->scratch.stream;
+  if(!state)
+  {
+    state = (LodePNG_StreamState*)malloc(sizeof(LodePNG_StreamState));
+    if(!state) { decoder->error = 9964; return; } /*alloc fail*/
+    ucvector_init(&state->pending);
+    LodeFlate_Stream_init(&state->inflater);
+    LodeFlate_Trees_init(&state->trees);
+    ucvector_init(&state->rowbuffer);
+    ucvector_init(&state->preview);
+    decoder->scratch.stream = state;
+  }
+
+  state->callbacks = *callbacks;
+  state->stage = 0;
+  state->pending.size = 0;
+  state->need = 33; /*signature and IHDR chunk*/
+  state->left = 0;
+  state->crc = 0;
+  state->critical_pos = 1;
+  state->unknown = 0;
+  state->started = 0;
+  state->zlibsize = 0;
+  memset(state->tail, 0, sizeof(state->tail));
+  LodeFlate_Stream_reset(&state->inflater);
+  state->adler = 1;
+  state->checked = 0;
+  state->taken = 0;
+  state->y = 0;
+  state->rows = 0;
+  state->current = 0;
+  state->copied = 0;
+  state->pass = 0;
+  decoder->error = 0;
 }
 
-void LodePNG_Decoder_decode(LodePNG_Decoder* decoder, unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize)
+void LodePNG_Decoder_streamPush(LodePNG_Decoder* decoder, const unsigned char* in, size_t insize)
 {
-  *out = 0;
-  *outsize = 0;
-  decodeGeneric(decoder, out, outsize, in, insize);
-  if(decoder->error) return;
-  if(!decoder->settings.color_convert || LodePNG_InfoColor_equal(&decoder->infoRaw.color, &decoder->infoPng.color))
+  LodePNG_StreamState* state = decoder->scratch.stream;
+  unsigned inflate = 0; /*IDAT data came*/
+
+  if(!state) { decoder->error = 84; return; } /*no stream was begun, so it can't have reached IEND either*/
+
+  while(!decoder->error && insize > 0 && state->stage != 5)
   {
-    /*same color type, no copying or converting of data needed*/
-    /*store the infoPng color settings on the infoRaw so that the infoRaw still reflects what colorType
-    the raw image has to the end user*/
-    if(!decoder->settings.color_convert)
+    size_t amount;
+
+    if(state->stage == 3)
     {
-      decoder->error = LodePNG_InfoColor_copy(&decoder->infoRaw.color, &decoder->infoPng.color);
-      if(decoder->error) return;
+      amount = insize < state->left ? insize : state->left;
+      if(!decoder->settings.ignoreCrc) state->crc = Crc32_update_crc(in, state->crc, amount);
+      streamIDAT(decoder, state, in, amount);
+      in += amount;
+      insize -= amount;
+      state->left -= amount;
+      inflate = 1;
+      if(!state->left)
+      {
+        state->stage = 4;
+        state->need = 4;
+      }
+      continue;
     }
-  }
-  else
-  {
-    /*color conversion needed; sort of copy of the data*/
-    unsigned char* data = *out;
 
-    /*TODO: check if this works according to the statement in the documentation: "The converter can convert from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
-    if(!(decoder->infoRaw.color.colorType == 2 || decoder->infoRaw.color.colorType == 6) && !(decoder->infoRaw.color.bitDepth == 8))
+    /*collect the bytes this stage needs*/
+    amount = state->need - state->pending.size;
+    if(amount > insize) amount = insize;
+    if(!ucvector_resize(&state->pending, state->pending.size + amount)) CERROR_BREAK(decoder->error, 9965); /*alloc fail*/
+    memcpy(&state->pending.data[state->pending.size - amount], in, amount);
+    in += amount;
+    insize -= amount;
+    if(state->pending.size < state->need) break;
+
+    if(state->stage == 0)
     {
-      decoder->error = 56; /*unsupported color mode conversion*/
-      return;
+      LodePNG_Decoder_inspect(decoder, state->pending.data, state->pending.size);
+      state->stage = 1;
+      state->need = 8;
+      state->pending.size = 0;
     }
+    else if(state->stage == 1)
+    {
+      unsigned chunkLength = LodePNG_chunk_length(state->pending.data);
+      if(chunkLength > 2147483647) CERROR_BREAK(decoder->error, 63); /*chunk length larger than the max PNG chunk size*/
 
-    *outsize = (decoder->infoPng.width * decoder->infoPng.height * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color) + 7) / 8;
-    *out = (unsigned char*)malloc(*outsize);
-    if(!(*out))
+      if(LodePNG_chunk_type_equals(state->pending.data, "IDAT"))
+      {
+        if(!state->started) streamStart(decoder, state);
+        state->crc = Crc32_update_crc(&state->pending.data[4], 0xffffffffL, 4);
+        state->left = chunkLength;
+        state->critical_pos = 3;
+        state->stage = chunkLength ? 3 : 4;
+        state->need = 4;
+        state->pending.size = 0;
+      }
+      else
+      {
+        /*the whole chunk with its header and CRC*/
+        state->stage = 2;
+        state->need = (size_t)chunkLength + 12;
+      }
+    }
+    else if(state->stage == 2)
     {
-      decoder->error = 9947; /*alloc fail*/
-      *outsize = 0;
+      const unsigned char* chunk = state->pending.data;
+      unsigned IEND = LodePNG_chunk_type_equals(chunk, "IEND");
+
+      if(!IEND)
+      {
+        readChunk(decoder, chunk, &state->critical_pos, &state->unknown);
+        if(decoder->error) break;
+      }
+      if(!decoder->settings.ignoreCrc && !state->unknown) /*check CRC if wanted, only on known chunk types*/
+      {
+        if(LodePNG_chunk_check_crc(chunk)) CERROR_BREAK(decoder->error, 57); /*invalid CRC*/
+      }
+      state->pending.size = 0;
+      state->stage = 1;
+      state->need = 8;
+
+      if(IEND)
+      {
+        state->stage = 5;
+        if(!state->started) streamStart(decoder, state);
+        if(!decoder->error) streamFinish(decoder, state);
+        inflate = 0;
+      }
+    }
+    else /*stage 4*/
+    {
+      if(!decoder->settings.ignoreCrc && LodePNG_read32bitInt(state->pending.data) != (state->crc ^ 0xffffffffL)) CERROR_BREAK(decoder->error, 57); /*invalid CRC*/
+      state->stage = 1;
+      state->need = 8;
+      state->pending.size = 0;
     }
-    else decoder->error = LodePNG_convert(*out, data, &decoder->infoRaw.color, &decoder->infoPng.color, decoder->infoPng.width, decoder->infoPng.height);
-    free(data);
   }
+
+  if(!decoder->error && inflate) streamInflate(decoder, state);
+}
+
+void LodePNG_Decoder_streamEnd(LodePNG_Decoder* decoder)
+{
+  LodePNG_StreamState* state = decoder->scratch.stream;
+  if(decoder->error) return;
+  if(!state || state->stage != 5) decoder->error = 84; /*the PNG stream ended before IEND*/
 }
 
 unsigned LodePNG_decode(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize, unsigned colorType, unsigned bitDepth)
@@ -3868,24 +6291,57 @@ void LodePNG_DecodeSettings_init(LodePNG_DecodeSettings* settings)
   settings->readTextChunks = 1;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
   settings->ignoreCrc = 0;
+  settings->simd = 1;
 #ifdef LODEPNG_COMPILE_UNKNOWN_CHUNKS
   settings->rememberUnknownChunks = 0;
 #endif /*LODEPNG_COMPILE_UNKNOWN_CHUNKS*/
   LodeZlib_DecompressSettings_init(&settings->zlibsettings);
 }
 
+static void LodePNG_DecodeScratch_init(LodePNG_DecodeScratch* scratch)
+{
+  scratch->scanlines = 0;
+  scratch->scanlines_allocsize = 0;
+  scratch->idat = 0;
+  scratch->idat_allocsize = 0;
+  scratch->image = 0;
+  scratch->image_allocsize = 0;
+  scratch->trees = 0;
+  scratch->stream = 0;
+}
+
+static void LodePNG_DecodeScratch_cleanup(LodePNG_DecodeScratch* scratch)
+{
+  free(scratch->scanlines);
+  free(scratch->idat);
+  free(scratch->image);
+  if(scratch->trees)
+  {
+    LodeFlate_Trees_cleanup(scratch->trees);
+    free(scratch->trees);
+  }
+  if(scratch->stream)
+  {
+    LodePNG_StreamState_cleanup(scratch->stream);
+    free(scratch->stream);
+  }
+  LodePNG_DecodeScratch_init(scratch);
+}
+
 void LodePNG_Decoder_init(LodePNG_Decoder* decoder)
 {
   LodePNG_DecodeSettings_init(&decoder->settings);
   LodePNG_InfoRaw_init(&decoder->infoRaw);
   LodePNG_InfoPng_init(&decoder->infoPng);
   decoder->error = 1;
+  LodePNG_DecodeScratch_init(&decoder->scratch);
 }
 
 void LodePNG_Decoder_cleanup(LodePNG_Decoder* decoder)
 {
   LodePNG_InfoRaw_cleanup(&decoder->infoRaw);
   LodePNG_InfoPng_cleanup(&decoder->infoPng);
+  LodePNG_DecodeScratch_cleanup(&decoder->scratch);
 }
 
 void LodePNG_Decoder_copy(LodePNG_Decoder* dest, const LodePNG_Decoder* source)
@@ -3894,6 +6350,7 @@ void LodePNG_Decoder_copy(LodePNG_Decoder* dest, const LodePNG_Decoder* source)
   *dest = *source;
   LodePNG_InfoRaw_init(&dest->infoRaw);
   LodePNG_InfoPng_init(&dest->infoPng);
+  LodePNG_DecodeScratch_init(&dest->scratch);
   dest->error = LodePNG_InfoRaw_copy(&dest->infoRaw, &source->infoRaw); if(dest->error) return;
   dest->error = LodePNG_InfoPng_copy(&dest->infoPng, &source->infoPng); if(dest->error) return;
 }
@@ -4165,65 +6622,326 @@ static unsigned addChunk_pHYs(ucvector* out, const LodePNG_InfoPng* info)
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline, size_t length, size_t bytewidth, unsigned char filterType)
+/*
+SIMD filtering for the encoder. Unlike unfiltering, every filter type only looks at the
+raw scanline and the raw one above, so all of them work 16 (or with AVX2 32) bytes at a
+time for any pixel size, from the second pixel on. The kernels return how far they got
+and the scalar code does the rest, with identical results.
+*/
+
+#ifdef LODEPNG_SSE2
+
+/*(a + b) / 2 per byte; _mm_avg_epu8 rounds up, so take the carried low bit off again*/
+static __m128i averageSSE2(__m128i a, __m128i b)
+{
+  return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static __m128i paethBytesSSE2(__m128i a, __m128i b, __m128i c)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = paethSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+  __m128i high = paethSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+  return _mm_packus_epi16(low, high);
+}
+
+/*the absolute values of the bytes of x as signed numbers, added up in the two 64-bit halves*/
+static __m128i sumAbsSSE2(__m128i x)
+{
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_sad_epu8(_mm_min_epu8(x, _mm_sub_epi8(zero, x)), zero);
+}
+
+static size_t sumHalvesSSE2(__m128i sum)
+{
+  return (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+static size_t filterScanlineSSE2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline, size_t start, size_t length, size_t bytewidth, unsigned filterType)
+{
+  size_t i;
+  for(i = start; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+    __m128i predictor;
+    if(filterType == 1) predictor = a;
+    else if(filterType == 2) predictor = b;
+    else if(filterType == 3) predictor = averageSSE2(a, b);
+    else predictor = paethBytesSSE2(a, b, _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]));
+    _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, predictor));
+  }
+  return i;
+}
+
+static size_t scoreFiltersSSE2(size_t sums[5], const unsigned char* scanline, const unsigned char* prevline, size_t start, size_t length, size_t bytewidth)
+{
+  size_t i = start;
+  while(i + 16 <= length)
+  {
+    /*flush the sums to sums[] now and then, before the 32-bit halves could overflow*/
+    size_t end = length - i > 65536 ? i + 65536 : length - 15;
+    __m128i sum0 = _mm_setzero_si128(), sum1 = sum0, sum2 = sum0, sum3 = sum0, sum4 = sum0;
+    for(; i < end; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+      __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+      __m128i c = _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]);
+      sum0 = _mm_add_epi64(sum0, sumAbsSSE2(x));
+      sum1 = _mm_add_epi64(sum1, sumAbsSSE2(_mm_sub_epi8(x, a)));
+      sum2 = _mm_add_epi64(sum2, sumAbsSSE2(_mm_sub_epi8(x, b)));
+      sum3 = _mm_add_epi64(sum3, sumAbsSSE2(_mm_sub_epi8(x, averageSSE2(a, b))));
+      sum4 = _mm_add_epi64(sum4, sumAbsSSE2(_mm_sub_epi8(x, paethBytesSSE2(a, b, c))));
+    }
+    sums[0] += sumHalvesSSE2(sum0);
+    sums[1] += sumHalvesSSE2(sum1);
+    sums[2] += sumHalvesSSE2(sum2);
+    sums[3] += sumHalvesSSE2(sum3);
+    sums[4] += sumHalvesSSE2(sum4);
+  }
+  return i;
+}
+
+#endif /*LODEPNG_SSE2*/
+
+#ifdef LODEPNG_X86_RUNTIME
+
+LODEPNG_TARGET_AVX2
+static __m256i averageAVX2(__m256i a, __m256i b)
+{
+  return _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+}
+
+/*paethSSE2 on 16 lanes*/
+LODEPNG_TARGET_AVX2
+static __m256i paethAVX2(__m256i a, __m256i b, __m256i c)
+{
+  __m256i pa = _mm256_sub_epi16(b, c);
+  __m256i pb = _mm256_sub_epi16(a, c);
+  __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+  __m256i smallest;
+  pa = _mm256_abs_epi16(pa);
+  pb = _mm256_abs_epi16(pb);
+  smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+  return _mm256_blendv_epi8(_mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(smallest, pb)), a, _mm256_cmpeq_epi16(smallest, pa));
+}
+
+/*the unpacks and the pack both work within each 128-bit lane, so the bytes come back in order*/
+LODEPNG_TARGET_AVX2
+static __m256i paethBytesAVX2(__m256i a, __m256i b, __m256i c)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i low = paethAVX2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(c, zero));
+  __m256i high = paethAVX2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(c, zero));
+  return _mm256_packus_epi16(low, high);
+}
+
+LODEPNG_TARGET_AVX2
+static __m256i sumAbsAVX2(__m256i x)
+{
+  return _mm256_sad_epu8(_mm256_abs_epi8(x), _mm256_setzero_si256());
+}
+
+LODEPNG_TARGET_AVX2
+static size_t sumQuartersAVX2(__m256i sum)
+{
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  return (size_t)_mm_cvtsi128_si32(half) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+}
+
+LODEPNG_TARGET_AVX2
+static size_t filterScanlineAVX2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline, size_t start, size_t length, size_t bytewidth, unsigned filterType)
 {
   size_t i;
+  for(i = start; i + 32 <= length; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+    __m256i a = _mm256_loadu_si256((const __m256i*)&scanline[i - bytewidth]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)&prevline[i]);
+    __m256i predictor;
+    if(filterType == 1) predictor = a;
+    else if(filterType == 2) predictor = b;
+    else if(filterType == 3) predictor = averageAVX2(a, b);
+    else predictor = paethBytesAVX2(a, b, _mm256_loadu_si256((const __m256i*)&prevline[i - bytewidth]));
+    _mm256_storeu_si256((__m256i*)&out[i], _mm256_sub_epi8(x, predictor));
+  }
+  return i;
+}
+
+LODEPNG_TARGET_AVX2
+static size_t scoreFiltersAVX2(size_t sums[5], const unsigned char* scanline, const unsigned char* prevline, size_t start, size_t length, size_t bytewidth)
+{
+  size_t i = start;
+  while(i + 32 <= length)
+  {
+    size_t end = length - i > 131072 ? i + 131072 : length - 31;
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = sum0, sum2 = sum0, sum3 = sum0, sum4 = sum0;
+    for(; i < end; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+      __m256i a = _mm256_loadu_si256((const __m256i*)&scanline[i - bytewidth]);
+      __m256i b = _mm256_loadu_si256((const __m256i*)&prevline[i]);
+      __m256i c = _mm256_loadu_si256((const __m256i*)&prevline[i - bytewidth]);
+      sum0 = _mm256_add_epi64(sum0, sumAbsAVX2(x));
+      sum1 = _mm256_add_epi64(sum1, sumAbsAVX2(_mm256_sub_epi8(x, a)));
+      sum2 = _mm256_add_epi64(sum2, sumAbsAVX2(_mm256_sub_epi8(x, b)));
+      sum3 = _mm256_add_epi64(sum3, sumAbsAVX2(_mm256_sub_epi8(x, averageAVX2(a, b))));
+      sum4 = _mm256_add_epi64(sum4, sumAbsAVX2(_mm256_sub_epi8(x, paethBytesAVX2(a, b, c))));
+    }
+    sums[0] += sumQuartersAVX2(sum0);
+    sums[1] += sumQuartersAVX2(sum1);
+    sums[2] += sumQuartersAVX2(sum2);
+    sums[3] += sumQuartersAVX2(sum3);
+    sums[4] += sumQuartersAVX2(sum4);
+  }
+  return i;
+}
+
+#endif /*LODEPNG_X86_RUNTIME*/
+
+/*
+Filter a scanline with the given type. prevline is the raw scanline above it, a line of
+zeros for the first one. With simd set, the SIMD kernels do what they can.
+*/
+static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline, size_t length, size_t bytewidth, unsigned char filterType, unsigned simd)
+{
+  size_t i, first = bytewidth < length ? bytewidth : length;
+  size_t start = first; /*where the scalar code takes over from the first pixel on*/
+  if(filterType == 0)
+  {
+    for(i = 0; i < length; i++) out[i] = scanline[i];
+    return;
+  }
+  if(filterType > 4) return; /*unexisting filter type given*/
+
+  if(simd && length > bytewidth)
+  {
+    unsigned features = cpuFeatures();
+#ifdef LODEPNG_X86_RUNTIME
+    if(features & LODEPNG_CPU_AVX2) start = filterScanlineAVX2(out, scanline, prevline, start, length, bytewidth, filterType);
+#endif /*LODEPNG_X86_RUNTIME*/
+#ifdef LODEPNG_SSE2
+    if(features & LODEPNG_CPU_SSE2) start = filterScanlineSSE2(out, scanline, prevline, start, length, bytewidth, filterType);
+#endif /*LODEPNG_SSE2*/
+    (void)features;
+  }
+
   switch(filterType)
   {
-    case 0:
-      for(i = 0; i < length; i++) out[i] = scanline[i];
-      break;
     case 1:
-      if(prevline)
-      {
-        for(i =         0; i < bytewidth; i++) out[i] = scanline[i];
-        for(i = bytewidth; i < length   ; i++) out[i] = scanline[i] - scanline[i - bytewidth];
-      }
-      else
-      {
-        for(i =         0; i < bytewidth; i++) out[i] = scanline[i];
-        for(i = bytewidth; i <    length; i++) out[i] = scanline[i] - scanline[i - bytewidth];
-      }
+      for(i =     0; i <     first; i++) out[i] = scanline[i];
+      for(i = start; i <    length; i++) out[i] = scanline[i] - scanline[i - bytewidth];
       break;
     case 2:
-      if(prevline)
-      {
-        for(i = 0; i < length; i++) out[i] = scanline[i] - prevline[i];
-      }
-      else
-      {
-        for(i = 0; i < length; i++) out[i] = scanline[i];
-      }
+      for(i =     0; i <     first; i++) out[i] = scanline[i] - prevline[i];
+      for(i = start; i <    length; i++) out[i] = scanline[i] - prevline[i];
       break;
     case 3:
-      if(prevline)
-      {
-        for(i =         0; i < bytewidth; i++) out[i] = scanline[i] - prevline[i] / 2;
-        for(i = bytewidth; i <    length; i++) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) / 2);
-      }
-      else
-      {
-        for(i =         0; i < bytewidth; i++) out[i] = scanline[i];
-        for(i = bytewidth; i <    length; i++) out[i] = scanline[i] - scanline[i - bytewidth] / 2;
-      }
+      for(i =     0; i <     first; i++) out[i] = scanline[i] - prevline[i] / 2;
+      for(i = start; i <    length; i++) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) / 2);
       break;
     case 4:
-      if(prevline)
-      {
-        for(i =         0; i < bytewidth; i++) out[i] = (scanline[i] - prevline[i]); /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
-        for(i = bytewidth; i <    length; i++) out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
-      }
-      else
+      for(i =     0; i <     first; i++) out[i] = (scanline[i] - prevline[i]); /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
+      for(i = start; i <    length; i++) out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
+      break;
+  }
+}
+
+/*the absolute value of a filtered byte taken as a signed number*/
+#define ABS_FILTERED(value) ((unsigned char)(value) < 128 ? (unsigned char)(value) : 256 - (unsigned char)(value))
+
+/*
+For each filter type, the sum of the absolute values of the scanline filtered with it,
+taking the filtered bytes as signed numbers. prevline as for filterScanline.
+*/
+static void scoreFilters(size_t sums[5], const unsigned char* scanline, const unsigned char* prevline, size_t length, size_t bytewidth, unsigned simd)
+{
+  size_t i, start = bytewidth;
+  for(i = 0; i < 5; i++) sums[i] = 0;
+
+  if(simd && length > bytewidth)
+  {
+    unsigned features = cpuFeatures();
+#ifdef LODEPNG_X86_RUNTIME
+    if(features & LODEPNG_CPU_AVX2) start = scoreFiltersAVX2(sums, scanline, prevline, start, length, bytewidth);
+#endif /*LODEPNG_X86_RUNTIME*/
+#ifdef LODEPNG_SSE2
+    if(features & LODEPNG_CPU_SSE2) start = scoreFiltersSSE2(sums, scanline, prevline, start, length, bytewidth);
+#endif /*LODEPNG_SSE2*/
+    (void)features;
+  }
+
+  for(i = 0; i < length && i < bytewidth; i++)
+  {
+    unsigned char x = scanline[i], b = prevline[i];
+    sums[0] += ABS_FILTERED(x);
+    sums[1] += ABS_FILTERED(x);
+    sums[2] += ABS_FILTERED(x - b);
+    sums[3] += ABS_FILTERED(x - b / 2);
+    sums[4] += ABS_FILTERED(x - b);
+  }
+  for(i = start; i < length; i++)
+  {
+    unsigned char x = scanline[i], a = scanline[i - bytewidth], b = prevline[i], c = prevline[i - bytewidth];
+    sums[0] += ABS_FILTERED(x);
+    sums[1] += ABS_FILTERED(x - a);
+    sums[2] += ABS_FILTERED(x - b);
+    sums[3] += ABS_FILTERED(x - (a + b) / 2);
+    sums[4] += ABS_FILTERED(x - paethPredictor(a, b, c));
+  }
+}
+
+#undef ABS_FILTERED
+
+/*the rows of an image for filterRows to do*/
+typedef struct FilterRows
+{
+  unsigned char* out;
+  const unsigned char* in;
+  const unsigned char* zeros; /*the line above the first*/
+  size_t linebytes, bytewidth;
+  unsigned first, end; /*rows first up to end*/
+  unsigned adaptive, simd;
+#ifdef LODEPNG_THREADS
+  LodeThread thread;
+  unsigned threaded;
+#endif /*LODEPNG_THREADS*/
+} FilterRows;
+
+static void filterRows(void* data)
+{
+  const FilterRows* rows = (const FilterRows*)data;
+  size_t linebytes = rows->linebytes;
+  unsigned y;
+  for(y = rows->first; y < rows->end; y++)
+  {
+    const unsigned char* scanline = &rows->in[y * linebytes];
+    const unsigned char* prevline = y ? &rows->in[(y - 1) * linebytes] : rows->zeros;
+    unsigned char* out = &rows->out[y * (linebytes + 1)]; /*the extra filterbyte added to each row*/
+    unsigned char type = 0, i;
+
+    if(rows->adaptive)
+    {
+      /*the filter type with the smallest sum*/
+      size_t sums[5];
+      scoreFilters(sums, scanline, prevline, linebytes, rows->bytewidth, rows->simd);
+      for(i = 1; i < 5; i++)
       {
-        for(i =         0; i < bytewidth; i++) out[i] = scanline[i];
-        for(i = bytewidth; i <    length; i++) out[i] = (scanline[i] - scanline[i - bytewidth]); /*paethPredictor(scanline[i - bytewidth], 0, 0) is always scanline[i - bytewidth]*/
+        if(sums[i] < sums[type]) type = i;
       }
-      break;
-    default: return; /*unexisting filter type given*/
+    }
+
+    out[0] = type; /*the first byte of a scanline will be the filter type*/
+    filterScanline(&out[1], scanline, prevline, linebytes, rows->bytewidth, type, rows->simd);
   }
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, const LodePNG_InfoColor* info)
+/*images smaller than this many bytes are filtered on the calling thread only*/
+#define FILTER_THREAD_BYTES 262144
+
+static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, const LodePNG_InfoColor* info, const LodePNG_EncodeSettings* settings)
 {
   /*
   For PNG filter method 0
@@ -4233,119 +6951,64 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
    *  If the image type is Palette, or the bit depth is smaller than 8, then do not filter the image (i.e. use fixed filtering, with the filter None).
    * (The other case) If the image type is Grayscale or RGB (with or without Alpha), and the bit depth is not smaller than 8, then use adaptive filtering heuristic as follows: independently for each row, apply all five filters and select the filter that produces the smallest sum of absolute values per row.
 
-  Here the above method is used mostly. Note though that it appears to be better to use the adaptive filtering on the plasma 8-bit palette example, but that image isn't the best reference for palette images in general.
+  Here the above method is used. Note though that it appears to be better to use the adaptive filtering on the plasma 8-bit palette example, but that image isn't the best reference for palette images in general.
+
+  Every row only needs the raw row above it, so with zlibsettings.threads above 1 big
+  images are cut into bands of rows that are filtered on threads of their own.
   */
 
   unsigned bpp = LodePNG_InfoColor_getBpp(info);
   size_t linebytes = (w * bpp + 7) / 8; /*the width of a scanline in bytes, not including the filter type*/
-  size_t bytewidth = (bpp + 7) / 8; /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
-  const unsigned char* prevline = 0;
-  unsigned x, y;
-  unsigned heuristic;
-  unsigned error = 0;
+  size_t numthreads = settings->zlibsettings.threads, i;
+  unsigned char* zeros;
+  FilterRows* bands;
 
   if(bpp == 0) return 31; /*error: invalid color type*/
+  if(h == 0) return 0;
 
-  /*choose heuristic as described above*/
-  if(info->colorType == 3 || info->bitDepth < 8) heuristic = 0;
-  else heuristic = 1;
+  if(numthreads < 1) numthreads = 1;
+  if(numthreads > h) numthreads = h;
+  if(linebytes * h < FILTER_THREAD_BYTES) numthreads = 1;
 
-  if(heuristic == 0) /*None filtertype for everything*/
+  zeros = (unsigned char*)calloc(linebytes ? linebytes : 1, 1);
+  bands = (FilterRows*)malloc(numthreads * sizeof(FilterRows));
+  if(!zeros || !bands)
   {
-    for(y = 0; y < h; y++)
-    {
-      size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
-      size_t inindex = linebytes * y;
-      const unsigned TYPE = 0;
-      out[outindex] = TYPE; /*filter type byte*/
-      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, TYPE);
-      prevline = &in[inindex];
-    }
+    free(zeros);
+    free(bands);
+    return 9949; /*alloc fail*/
   }
-  else if(heuristic == 1) /*adaptive filtering*/
-  {
-    size_t sum[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
-    unsigned type, bestType = 0;
-
-    for(type = 0; type < 5; type++) ucvector_init(&attempt[type]);
-    for(type = 0; type < 5; type++)
-    {
-      if(!ucvector_resize(&attempt[type], linebytes)) ERROR_BREAK(9949 /*alloc fail*/);
-    }
-
-    if(!error)
-    {
-      for(y = 0; y < h; y++)
-      {
-        /*try the 5 filter types*/
-        for(type = 0; type < 5; type++)
-        {
-          filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          for(x = 0; x < attempt[type].size; x+=3) sum[type] += attempt[type].data[x]; /*note that not all pixels are checked to speed this up while still having probably the best choice*/
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
-        }
 
-        prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
-      }
-    }
-
-    for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
+  for(i = 0; i < numthreads; i++)
+  {
+    bands[i].out = out;
+    bands[i].in = in;
+    bands[i].zeros = zeros;
+    bands[i].linebytes = linebytes;
+    bands[i].bytewidth = (bpp + 7) / 8; /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
+    bands[i].first = (unsigned)(h * i / numthreads);
+    bands[i].end = (unsigned)(h * (i + 1) / numthreads);
+    bands[i].adaptive = !(info->colorType == 3 || info->bitDepth < 8); /*choose heuristic as described above*/
+    bands[i].simd = settings->simd;
+#ifdef LODEPNG_THREADS
+    bands[i].threaded = i > 0 && startThread(&bands[i].thread, filterRows, &bands[i]);
+#endif /*LODEPNG_THREADS*/
   }
-  #if 0 /*deflate the scanline with a fixed tree after every filter attempt to see which one deflates best. This is slow, and _does not work as expected_: the heuristic gives smaller result!*/
-  else if(heuristic == 2) /*adaptive filtering by using deflate*/
+  for(i = 0; i < numthreads; i++)
   {
-    size_t size[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest;
-    unsigned type = 0, bestType = 0;
-    unsigned char* dummy;
-    LodeZlib_CompressSettings deflatesettings = LodeZlib_defaultCompressSettings;
-    deflatesettings.btype = 1; /*use fixed tree on the attempts so that the tree is not adapted to the filtertype on purpose, to simulate the true case where the tree is the same for the whole image*/
-    for(type = 0; type < 5; type++)
-    {
-      ucvector_init(&attempt[type]);
-      ucvector_resize(&attempt[type], linebytes); /*todo: give error if resize failed*/
-    }
-    for(y = 0; y < h; y++) /*try the 5 filter types*/
+#ifdef LODEPNG_THREADS
+    if(bands[i].threaded)
     {
-      for(type = 0; type < 5; type++)
-      {
-        filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-        size[type] = 0;
-        dummy = 0;
-        LodePNG_compress(&dummy, &size[type], attempt[type].data, attempt[type].size, &deflatesettings);
-        free(dummy);
-        /*check if this is smallest size (or if type == 0 it's the first case so always store the values)*/
-        if(type == 0 || size[type] < smallest)
-        {
-          bestType = type;
-          smallest = size[type];
-        }
-      }
-      prevline = &in[y * linebytes];
-      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-      for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
+      joinThread(&bands[i].thread);
+      continue;
     }
-    for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
+#endif /*LODEPNG_THREADS*/
+    filterRows(&bands[i]); /*the calling thread's own rows, or those of a thread that couldn't start*/
   }
-  #endif
 
-  return error;
+  free(zeros);
+  free(bands);
+  return 0;
 }
 
 static void addPaddingBits(unsigned char* out, const unsigned char* in, size_t olinebits, size_t ilinebits, unsigned h)
@@ -4419,7 +7082,7 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
 }
 
 /*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image*/
-static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in, const LodePNG_InfoPng* infoPng) /*return value is error*/
+static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in, const LodePNG_InfoPng* infoPng, const LodePNG_EncodeSettings* settings) /*return value is error*/
 {
   /*
   This function converts the pure 2D image with the PNG's colortype, into filtered-padded-interlaced data. Steps:
@@ -4447,52 +7110,51 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
         if(!error)
         {
           addPaddingBits(padded.data, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
-          error = filter(*out, padded.data, w, h, &infoPng->color);
+          error = filter(*out, padded.data, w, h, &infoPng->color, settings);
         }
         ucvector_cleanup(&padded);
       }
-      else error = filter(*out, in, w, h, &infoPng->color); /*we can immediatly filter into the out buffer, no other steps needed*/
+      else error = filter(*out, in, w, h, &infoPng->color, settings); /*we can immediatly filter into the out buffer, no other steps needed*/
     }
   }
   else /*interlaceMethod is 1 (Adam7)*/
   {
-    unsigned char* adam7 = (unsigned char*)malloc((h * w * bpp + 7) / 8);
-    if(!adam7 && ((h * w * bpp + 7) / 8)) error = 9952; /*alloc fail*/
+    unsigned passw[7], passh[7];
+    size_t filter_passstart[8], padded_passstart[8], passstart[8];
+    unsigned char* adam7;
+
+    Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+
+    /*the passes are each padded to whole bytes at their end, that can be more than the image itself*/
+    adam7 = (unsigned char*)malloc(passstart[7]);
+    if(!adam7 && passstart[7]) error = 9952; /*alloc fail*/
 
     while(!error) /*not a real while loop, used to break out to cleanup to avoid a goto*/
     {
-      unsigned passw[7], passh[7];
-      size_t filter_passstart[8], padded_passstart[8], passstart[8];
+      ucvector padded;
       unsigned i;
 
-      Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
-
       *outsize = filter_passstart[7]; /*image size plus an extra byte per scanline + possible padding bits*/
       *out = (unsigned char*)malloc(*outsize);
       if(!(*out) && (*outsize)) ERROR_BREAK(9953 /*alloc fail*/);
 
       Adam7_interlace(adam7, in, w, h, bpp);
 
-      for(i = 0; i < 7; i++)
+      ucvector_init(&padded);
+      if(bpp < 8 && !ucvector_resize(&padded, padded_passstart[7])) error = 9954;
+      for(i = 0; i < 7 && !error; i++)
       {
         if(bpp < 8)
         {
-          ucvector padded;
-          ucvector_init(&padded);
-          if(!ucvector_resize(&padded, h * ((w * bpp + 7) / 8))) error = 9954;
-          if(!error)
-          {
-            addPaddingBits(&padded.data[padded_passstart[i]], &adam7[passstart[i]], ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
-            error = filter(&(*out)[filter_passstart[i]], &padded.data[padded_passstart[i]], passw[i], passh[i], &infoPng->color);
-          }
-
-          ucvector_cleanup(&padded);
+          addPaddingBits(&padded.data[padded_passstart[i]], &adam7[passstart[i]], ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
+          error = filter(&(*out)[filter_passstart[i]], &padded.data[padded_passstart[i]], passw[i], passh[i], &infoPng->color, settings);
         }
         else
         {
-          error = filter(&(*out)[filter_passstart[i]], &adam7[padded_passstart[i]], passw[i], passh[i], &infoPng->color);
+          error = filter(&(*out)[filter_passstart[i]], &adam7[padded_passstart[i]], passw[i], passh[i], &infoPng->color, settings);
         }
       }
+      ucvector_cleanup(&padded);
 
       break;
     }
@@ -4634,10 +7296,10 @@ void LodePNG_Encoder_encode(LodePNG_Encoder* encoder, unsigned char** out, size_
     converted = (unsigned char*)malloc(size);
     if(!converted && size) encoder->error = 9955; /*alloc fail*/
     if(!encoder->error) encoder->error = LodePNG_convert(converted, image, &info.color, &encoder->infoRaw.color, w, h);
-    if(!encoder->error) preProcessScanlines(&data, &datasize, converted, &info);/*filter(data.data, converted.data, w, h, LodePNG_InfoColor_getBpp(&info.color));*/
+    if(!encoder->error) preProcessScanlines(&data, &datasize, converted, &info, &encoder->settings);/*filter(data.data, converted.data, w, h, LodePNG_InfoColor_getBpp(&info.color));*/
     free(converted);
   }
-  else preProcessScanlines(&data, &datasize, image, &info);/*filter(data.data, image, w, h, LodePNG_InfoColor_getBpp(&info.color));*/
+  else preProcessScanlines(&data, &datasize, image, &info, &encoder->settings);/*filter(data.data, image, w, h, LodePNG_InfoColor_getBpp(&info.color));*/
 
   ucvector_init(&outv);
   while(!encoder->error) /*not really a while loop, this is only used to break out if an error happens to avoid goto's to do the ucvector cleanup*/
@@ -4828,6 +7490,7 @@ void LodePNG_EncodeSettings_init(LodePNG_EncodeSettings* settings)
   LodeZlib_CompressSettings_init(&settings->zlibsettings);
   settings->autoLeaveOutAlphaChannel = 1;
   settings->force_palette = 0;
+  settings->simd = 1;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 1;
   settings->text_compression = 0;
@@ -5000,6 +7663,10 @@ const char* LodePNG_error_text(unsigned code)
     case 78: return "failed to open file for reading"; /*file doesn't exist or couldn't be opened for reading*/
     case 79: return "failed to open file for writing";
     case 80: return "tried creating a tree of 0 symbols";
+    case 81: return "invalid distance while inflating, it points to before the start of the data";
+    case 82: return "the output buffer given to decodeInto is too small for the image";
+    case 83: return "the image data ended before the last row";
+    case 84: return "the PNG stream ended before IEND, or wasn't begun with streamBegin";
     default: ; /*nothing to do here, checks for other error values are below*/
   }
 
@@ -5134,6 +7801,26 @@ namespace LodePNG
     decode(out, in.empty() ? 0 : &in[0], in.size());
   }
 
+  void Decoder::decodeInto(unsigned char* out, size_t stride, size_t outsize, const unsigned char* in, size_t insize)
+  {
+    LodePNG_Decoder_decodeInto(this, out, stride, outsize, in, insize);
+  }
+
+  void Decoder::streamBegin(const LodePNG_StreamCallbacks& callbacks)
+  {
+    LodePNG_Decoder_streamBegin(this, &callbacks);
+  }
+
+  void Decoder::streamPush(const unsigned char* in, size_t insize)
+  {
+    LodePNG_Decoder_streamPush(this, in, insize);
+  }
+
+  void Decoder::streamEnd()
+  {
+    LodePNG_Decoder_streamEnd(this);
+  }
+
   void Decoder::inspect(const unsigned char* in, size_t insize)
   {
     LodePNG_Decoder_inspect(this, in, insize);
@@ -6,6 +6,7 @@
 #endif
 
 
+#include "yaml-cpp/dll.h"
 #include "yaml-cpp/null.h"
 #include "yaml-cpp/traits.h"
 #include <string>
@@ -21,12 +22,32 @@ namespace YAML
 	YAML_CPP_API bool Convert(const std::string& input, bool& output);
 	YAML_CPP_API bool Convert(const std::string& input, _Null& output);
 	
+	// numeric conversion
+	// . Parses the same prefix that 'std::stringstream >> output' would (with std::ios::dec
+	//   unset, so integers may be hex "0x1f" or octal "017"), but without constructing a
+	//   stream or allocating, and independently of the global locale.
+	YAML_CPP_API bool ConvertNumber(const std::string& input, char& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned char& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, short& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned short& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, int& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned int& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, long& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned long& output);
+#if defined(_MSC_VER) && (_MSC_VER < 1310)
+	YAML_CPP_API bool ConvertNumber(const std::string& input, __int64& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned __int64& output);
+#else
+	YAML_CPP_API bool ConvertNumber(const std::string& input, long long& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, unsigned long long& output);
+#endif
+	YAML_CPP_API bool ConvertNumber(const std::string& input, float& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, double& output);
+	YAML_CPP_API bool ConvertNumber(const std::string& input, long double& output);
+
 	template <typename T> 
 	inline bool Convert(const std::string& input, T& output, typename enable_if<is_numeric<T> >::type * = 0) {
-		std::stringstream stream(input);
-		stream.unsetf(std::ios::dec);
-		stream >> output;
-		return !!stream;
+		return ConvertNumber(input, output);
 	}
 }
 
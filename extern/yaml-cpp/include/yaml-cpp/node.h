@@ -99,6 +99,7 @@ namespace YAML
 		void SetScalarData(const std::string& data);
 		void Append(Node& node);
 		void Insert(Node& key, Node& value);
+		void BuildKeyIndex();
 
 		// helper for sequences
 		template <typename, bool> friend struct _FindFromNodeAtIndex;
@@ -110,6 +111,8 @@ namespace YAML
 
 		template <typename T>
 		const Node *FindValueForKey(const T& key) const;
+		const Node *FindValueForKey(const std::string& key) const;
+		bool IsKey(const std::string& key) const;
 
 	private:
 		std::auto_ptr<NodeOwnership> m_pOwnership;
@@ -124,6 +127,11 @@ namespace YAML
 		std::string m_scalarData;
 		node_seq m_seqData;
 		node_map m_mapData;
+
+		// open-addressed hash of the scalar keys in m_mapData, built by BuildKeyIndex
+		typedef std::pair<const Node *, const Node *> key_index_entry;
+		typedef std::vector<key_index_entry> key_index;
+		key_index m_keyIndex;
 	};
 }
 
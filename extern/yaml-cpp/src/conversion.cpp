@@ -1,5 +1,10 @@
 #include "yaml-cpp/conversion.h"
 #include <algorithm>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <locale>
 
 ////////////////////////////////////////////////////////////////
 // Specializations for converting a string to specific types
@@ -45,6 +50,275 @@ namespace
 		std::string rest = str.substr(1);
 		return firstcaps && (IsEntirely(rest, IsLower) || IsEntirely(rest, IsUpper));
 	}
+
+	////////////////////////////////////////////////////////////////
+	// Numeric parsing
+	// . Each parser accepts exactly the prefix that the stream extraction operators would
+	//   (leading whitespace, then the longest valid number), and fails on the same inputs.
+
+	bool IsSpace(char ch) { return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r'; }
+	bool IsDigit(char ch) { return '0' <= ch && ch <= '9'; }
+
+	int DigitValue(char ch, int base)
+	{
+		int value = base;
+		if('0' <= ch && ch <= '9')
+			value = ch - '0';
+		else if('a' <= ch && ch <= 'f')
+			value = ch - 'a' + 10;
+		else if('A' <= ch && ch <= 'F')
+			value = ch - 'A' + 10;
+		return value < base ? value : -1;
+	}
+
+	const char *SkipSpace(const char *p, const char *end)
+	{
+		while(p != end && IsSpace(*p))
+			++p;
+		return p;
+	}
+
+	// ParseInteger
+	// . Base detection as with std::ios::dec unset: "0x"/"0X" is hex, a leading '0' is octal.
+	// . A '-' on an unsigned type wraps, as it does for the stream operators.
+	template <typename T>
+	bool ParseInteger(const std::string& input, T& output)
+	{
+		typedef std::numeric_limits<T> limits;
+
+		const char *p = SkipSpace(input.data(), input.data() + input.size());
+		const char *end = input.data() + input.size();
+
+		bool negative = false;
+		if(p != end && (*p == '+' || *p == '-')) {
+			negative = (*p == '-');
+			++p;
+		}
+
+		int base = 10;
+		if(p != end && *p == '0') {
+			if(p + 1 != end && (p[1] == 'x' || p[1] == 'X')) {
+				base = 16;
+				p += 2;
+			} else {
+				base = 8;
+			}
+		}
+
+		// the largest magnitude we can store (negative signed values can go one further)
+		unsigned long long maxMagnitude = static_cast<unsigned long long>(limits::max());
+		if(negative && limits::is_signed)
+			maxMagnitude += 1;
+
+		unsigned long long magnitude = 0;
+		bool anyDigits = false, overflow = false;
+		for(;p != end;++p) {
+			int digit = DigitValue(*p, base);
+			if(digit < 0)
+				break;
+
+			anyDigits = true;
+			if(magnitude > (maxMagnitude - digit) / base)
+				overflow = true;
+			else
+				magnitude = magnitude * base + digit;
+		}
+
+		if(!anyDigits || overflow)
+			return false;
+
+		if(!negative)
+			output = static_cast<T>(magnitude);
+		else if(limits::is_signed)
+			output = magnitude ? static_cast<T>(-static_cast<long long>(magnitude - 1) - 1) : 0;
+		else
+			output = static_cast<T>(0 - magnitude);
+		return true;
+	}
+
+	// ParseCharacter
+	// . Streaming into a char reads a single character rather than a number.
+	template <typename T>
+	bool ParseCharacter(const std::string& input, T& output)
+	{
+		const char *end = input.data() + input.size();
+		const char *p = SkipSpace(input.data(), end);
+		if(p == end)
+			return false;
+
+		output = static_cast<T>(*p);
+		return true;
+	}
+
+	// Exact powers of ten for the fast floating point path
+	const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	struct DecimalNumber {
+		const char *begin, *end; // the characters making up the number
+		bool negative;
+		unsigned long long mantissa;
+		int exponent;
+		bool exact; // mantissa * 10^exponent is exactly the number written
+	};
+
+	// ScanDecimal
+	// . Finds [sign] digits [. digits] [e [sign] digits], collecting the significant digits as it goes.
+	bool ScanDecimal(const std::string& input, DecimalNumber& number)
+	{
+		const char *end = input.data() + input.size();
+		const char *p = SkipSpace(input.data(), end);
+
+		number.begin = p;
+		number.negative = false;
+		number.mantissa = 0;
+		number.exponent = 0;
+		number.exact = true;
+
+		if(p != end && (*p == '+' || *p == '-')) {
+			number.negative = (*p == '-');
+			++p;
+		}
+
+		bool anyDigits = false;
+		for(;p != end && IsDigit(*p);++p) {
+			anyDigits = true;
+			if(number.mantissa < 100000000000000000ULL)
+				number.mantissa = number.mantissa * 10 + (*p - '0');
+			else {
+				number.exponent++;
+				if(*p != '0')
+					number.exact = false;
+			}
+		}
+
+		if(p != end && *p == '.') {
+			++p;
+			for(;p != end && IsDigit(*p);++p) {
+				anyDigits = true;
+				if(number.mantissa < 100000000000000000ULL) {
+					number.mantissa = number.mantissa * 10 + (*p - '0');
+					number.exponent--;
+				} else if(*p != '0') {
+					number.exact = false;
+				}
+			}
+		}
+
+		if(!anyDigits)
+			return false;
+
+		// an exponent marker must be followed by digits, or the whole number is rejected
+		if(p != end && (*p == 'e' || *p == 'E')) {
+			++p;
+			bool negativeExponent = false;
+			if(p != end && (*p == '+' || *p == '-')) {
+				negativeExponent = (*p == '-');
+				++p;
+			}
+			if(p == end || !IsDigit(*p))
+				return false;
+
+			int exponent = 0;
+			for(;p != end && IsDigit(*p);++p)
+				if(exponent < 100000)
+					exponent = exponent * 10 + (*p - '0');
+			number.exponent += negativeExponent ? -exponent : exponent;
+		}
+
+		number.end = p;
+		return true;
+	}
+
+	// FastDecimal
+	// . Clinger's fast path: when both the mantissa and the power of ten are exact doubles,
+	//   a single multiply or divide gives the correctly rounded result.
+	bool FastDecimal(const DecimalNumber& number, double& output)
+	{
+		if(!number.exact || number.mantissa > (1ULL << 53) || number.exponent < -22 || number.exponent > 22)
+			return false;
+
+		double value = static_cast<double>(number.mantissa);
+		if(number.exponent < 0)
+			value /= powersOfTen[-number.exponent];
+		else
+			value *= powersOfTen[number.exponent];
+
+		output = number.negative ? -value : value;
+		return true;
+	}
+
+	// IsFloatMidpoint
+	// . True if the double lies exactly halfway between two floats, where rounding it again to
+	//   float could differ from rounding the original decimal number directly.
+	bool IsFloatMidpoint(double value)
+	{
+		unsigned long long bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const unsigned long long lowBits = (1ULL << 29) - 1;
+		return (bits & lowBits) == (1ULL << 28);
+	}
+
+	double StringToFloat(const char *str, char **end, double) { return std::strtod(str, end); }
+	float StringToFloat(const char *str, char **end, float) { return std::strtof(str, end); }
+	long double StringToFloat(const char *str, char **end, long double) { return std::strtold(str, end); }
+
+	// SlowDecimal
+	// . Hands the scanned number to the C library, swapping in the C locale's decimal point.
+	template <typename T>
+	bool SlowDecimal(const DecimalNumber& number, T& output)
+	{
+		char buffer[128];
+		std::size_t length = number.end - number.begin;
+		T value;
+
+		if(length < sizeof(buffer)) {
+			std::memcpy(buffer, number.begin, length);
+			buffer[length] = '\0';
+
+			const char *decimalPoint = std::localeconv()->decimal_point;
+			if(decimalPoint && decimalPoint[0] && decimalPoint[1] == '\0')
+				std::replace(buffer, buffer + length, '.', decimalPoint[0]);
+
+			char *parseEnd;
+			value = StringToFloat(buffer, &parseEnd, T());
+			if(parseEnd != buffer + length)
+				return false;
+		} else {
+			// absurdly long number; let a classic locale stream deal with it
+			std::stringstream stream(std::string(number.begin, number.end));
+			stream.imbue(std::locale::classic());
+			stream >> value;
+			if(!stream)
+				return false;
+		}
+
+		if(value == std::numeric_limits<T>::infinity() || value == -std::numeric_limits<T>::infinity())
+			return false;
+
+		output = value;
+		return true;
+	}
+
+	template <typename T>
+	bool ParseFloat(const std::string& input, T& output)
+	{
+		DecimalNumber number;
+		if(!ScanDecimal(input, number))
+			return false;
+
+		double value;
+		if(sizeof(T) <= sizeof(double) && FastDecimal(number, value)) {
+			if(sizeof(T) == sizeof(double) || !IsFloatMidpoint(value)) {
+				output = static_cast<T>(value);
+				return true;
+			}
+		}
+
+		return SlowDecimal(number, output);
+	}
 }
 
 namespace YAML
@@ -85,5 +359,23 @@ namespace YAML
 	{
 		return input.empty() || input == "~" || input == "null" || input == "Null" || input == "NULL";
 	}
-}
 
+	bool ConvertNumber(const std::string& input, char& output) { return ParseCharacter(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned char& output) { return ParseCharacter(input, output); }
+	bool ConvertNumber(const std::string& input, short& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned short& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, int& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned int& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, long& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned long& output) { return ParseInteger(input, output); }
+#if defined(_MSC_VER) && (_MSC_VER < 1310)
+	bool ConvertNumber(const std::string& input, __int64& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned __int64& output) { return ParseInteger(input, output); }
+#else
+	bool ConvertNumber(const std::string& input, long long& output) { return ParseInteger(input, output); }
+	bool ConvertNumber(const std::string& input, unsigned long long& output) { return ParseInteger(input, output); }
+#endif
+	bool ConvertNumber(const std::string& input, float& output) { return ParseFloat(input, output); }
+	bool ConvertNumber(const std::string& input, double& output) { return ParseFloat(input, output); }
+	bool ConvertNumber(const std::string& input, long double& output) { return ParseFloat(input, output); }
+}
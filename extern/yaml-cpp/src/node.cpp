@@ -12,6 +12,20 @@
 #include <cassert>
 #include <stdexcept>
 
+namespace
+{
+	// FNV-1a
+	std::size_t HashKey(const std::string& key)
+	{
+		std::size_t hash = 2166136261u;
+		for(std::size_t i=0;i<key.size();i++) {
+			hash ^= static_cast<unsigned char>(key[i]);
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+}
+
 namespace YAML
 {
 	bool ltnode::operator()(const Node *pNode1, const Node *pNode2) const {
@@ -39,6 +53,7 @@ namespace YAML
 		m_scalarData.clear();
 		m_seqData.clear();
 		m_mapData.clear();
+		m_keyIndex.clear();
 	}
 	
 	bool Node::IsAliased() const
@@ -136,6 +151,66 @@ namespace YAML
 		m_mapData[&key] = &value;
 	}
 
+	// BuildKeyIndex
+	// . Indexes the keys of a finished map by their scalar text, so that string lookups
+	//   don't have to walk (and convert) every key.
+	// . Keys are added in iteration order and the first one wins, which is the key a
+	//   linear search would have found.
+	void Node::BuildKeyIndex()
+	{
+		assert(m_type == NodeType::Map); // TODO: throw?
+		m_keyIndex.clear();
+
+		std::size_t capacity = 1;
+		while(capacity < m_mapData.size() * 2)
+			capacity *= 2;
+		m_keyIndex.resize(capacity, key_index_entry(0, 0));
+
+		const std::string nullKey = "~";
+		for(node_map::const_iterator it=m_mapData.begin();it!=m_mapData.end();++it) {
+			const Node& keyNode = *it->first;
+			if(keyNode.m_type != NodeType::Scalar && keyNode.m_type != NodeType::Null)
+				continue;
+
+			const std::string& key = keyNode.m_type == NodeType::Null ? nullKey : keyNode.m_scalarData;
+			std::size_t slot = HashKey(key) & (capacity - 1);
+			while(m_keyIndex[slot].first && !m_keyIndex[slot].first->IsKey(key))
+				slot = (slot + 1) & (capacity - 1);
+
+			if(!m_keyIndex[slot].first)
+				m_keyIndex[slot] = key_index_entry(it->first, it->second);
+		}
+	}
+
+	// FindValueForKey
+	// . Constant time lookup through the key index, for the common case of a string key.
+	const Node *Node::FindValueForKey(const std::string& key) const
+	{
+		if(m_keyIndex.empty()) {
+			// not indexed (yet), so do it the slow way
+			for(node_map::const_iterator it=m_mapData.begin();it!=m_mapData.end();++it)
+				if(it->first->IsKey(key))
+					return it->second;
+			return 0;
+		}
+
+		const std::size_t mask = m_keyIndex.size() - 1;
+		for(std::size_t slot = HashKey(key) & mask;m_keyIndex[slot].first;slot = (slot + 1) & mask) {
+			if(m_keyIndex[slot].first->IsKey(key))
+				return m_keyIndex[slot].second;
+		}
+		return 0;
+	}
+
+	// IsKey
+	// . True if this (scalar or null) key node reads as the given string.
+	bool Node::IsKey(const std::string& key) const
+	{
+		if(m_type == NodeType::Null)
+			return key == "~";
+		return m_type == NodeType::Scalar && key == m_scalarData;
+	}
+
 	// begin
 	// Returns an iterator to the beginning of this (sequence or map).
 	Iterator Node::begin() const
@@ -67,6 +67,7 @@ namespace YAML
 	void NodeBuilder::OnMapEnd()
 	{
 		m_didPushKey.pop();
+		Top().BuildKeyIndex();
 		Pop();
 	}
 	
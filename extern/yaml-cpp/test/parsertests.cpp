@@ -654,6 +654,119 @@ namespace Test
 				return false;
 			return true;
 		}
+
+		bool Floats()
+		{
+			std::string input =
+				"- 1.5\n"
+				"- -0.278\n"
+				"- .5\n"
+				"- 6.02e23\n"
+				"- 1e\n"
+				"- 1.5abc\n"
+				"- 1e40\n";
+
+			std::stringstream stream(input);
+			YAML::Parser parser(stream);
+			YAML::Node doc;
+
+			parser.GetNextDocument(doc);
+			if(doc.size() != 7)
+				return false;
+			if(doc[0].to<float>() != 1.5f)
+				return false;
+			if(doc[1].to<double>() != -0.278)
+				return false;
+			if(doc[2].to<float>() != 0.5f)
+				return false;
+			if(doc[3].to<double>() != 6.02e23)
+				return false;
+
+			// like the stream operators, we need exponent digits but ignore trailing junk
+			float value;
+			if(doc[4].Read(value))
+				return false;
+			if(!doc[5].Read(value) || value != 1.5f)
+				return false;
+			if(doc[6].Read(value))
+				return false;
+
+			double doubleValue;
+			if(!doc[6].Read(doubleValue) || doubleValue != 1e40)
+				return false;
+			return true;
+		}
+
+		bool IntegerLimits()
+		{
+			std::string input =
+				"- -2147483648\n"
+				"- 2147483648\n"
+				"- -0x10\n"
+				"- 0x\n"
+				"- -1\n"
+				"- 65536\n";
+
+			std::stringstream stream(input);
+			YAML::Parser parser(stream);
+			YAML::Node doc;
+
+			parser.GetNextDocument(doc);
+			if(doc.size() != 6)
+				return false;
+			if(doc[0].to<int>() != -2147483647 - 1)
+				return false;
+
+			int value;
+			if(doc[1].Read(value))
+				return false;
+			if(doc[2].to<int>() != -16)
+				return false;
+			if(doc[3].Read(value))
+				return false;
+			if(doc[4].to<unsigned short>() != 65535)
+				return false;
+
+			unsigned short shortValue;
+			if(doc[5].Read(shortValue))
+				return false;
+			return true;
+		}
+		
+		bool ManyKeys()
+		{
+			std::stringstream input;
+			for(int i=0;i<200;i++)
+				input << "key" << i << ": " << i << "\n";
+			input << "~: null key\n";
+			input << "0x10: hex key\n";
+
+			std::stringstream stream(input.str());
+			YAML::Parser parser(stream);
+			YAML::Node doc;
+			parser.GetNextDocument(doc);
+
+			for(int i=0;i<200;i++) {
+				std::stringstream key;
+				key << "key" << i;
+				if(doc[key.str()].to<int>() != i)
+					return false;
+			}
+			if(doc.FindValue("key200"))
+				return false;
+			if(doc["~"].to<std::string>() != "null key")
+				return false;
+
+			// non-string keys still go through conversion
+			if(doc[16].to<std::string>() != "hex key")
+				return false;
+
+			// a copy should be indexed just the same
+			std::auto_ptr<YAML::Node> clone = doc.Clone();
+			if((*clone)["key123"].to<int>() != 123)
+				return false;
+			return true;
+		}
 		
 		bool KeyNotFound()
 		{
@@ -1067,6 +1180,9 @@ namespace Test
 		RunParserTest(&Parser::MultipleDocsWithSomeExplicitIndicators, "multiple docs with some explicit indicators", passed, total);
 		RunParserTest(&Parser::BlockKeyWithNullValue, "block key with null value", passed, total);
 		RunParserTest(&Parser::Bases, "bases", passed, total);
+		RunParserTest(&Parser::Floats, "floats", passed, total);
+		RunParserTest(&Parser::IntegerLimits, "integer limits", passed, total);
+		RunParserTest(&Parser::ManyKeys, "many keys", passed, total);
 		RunParserTest(&Parser::KeyNotFound, "key not found", passed, total);
 		RunParserTest(&Parser::DuplicateKey, "duplicate key", passed, total);
 		RunParserTest(&Parser::DefaultPlainScalarTag, "default plain scalar tag", passed, total);
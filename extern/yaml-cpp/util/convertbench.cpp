@@ -0,0 +1,111 @@
+#include "yaml-cpp/yaml.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Measures numeric scalar conversion throughput on a mesh-style file of
+// "pos: [x, y, z]" entries, comparing YAML::Convert against the
+// std::stringstream extraction it replaced.
+//
+//   convert-bench [vertex count] [file to write the generated YAML to]
+
+namespace
+{
+	template <typename T>
+	bool StreamConvert(const std::string& input, T& output)
+	{
+		std::stringstream stream(input);
+		stream.unsetf(std::ios::dec);
+		stream >> output;
+		return !!stream;
+	}
+
+	std::string GenerateMesh(int vertexCount)
+	{
+		std::stringstream out;
+		std::srand(1);
+		out << "vertices:\n";
+		for(int i=0;i<vertexCount;i++) {
+			char line[128];
+			std::sprintf(line, "  - index: %d\n    pos: [%.6f, %.6f, %.6f]\n", i,
+				std::rand() / (double)RAND_MAX * 200.0 - 100.0,
+				std::rand() / (double)RAND_MAX * 200.0 - 100.0,
+				std::rand() / (double)RAND_MAX * 200.0 - 100.0);
+			out << line;
+		}
+		return out.str();
+	}
+
+	double Seconds(std::clock_t start)
+	{
+		return (std::clock() - start) / (double)CLOCKS_PER_SEC;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int vertexCount = argc > 1 ? std::atoi(argv[1]) : 200000;
+	std::string input = GenerateMesh(vertexCount);
+	if(argc > 2) {
+		std::ofstream fout(argv[2]);
+		fout << input;
+	}
+
+	// pull every scalar out of the tree first so we time only the conversion
+	std::stringstream stream(input);
+	YAML::Parser parser(stream);
+	YAML::Node doc;
+	parser.GetNextDocument(doc);
+
+	std::vector<std::string> floats, ints;
+	const YAML::Node& vertices = doc["vertices"];
+	for(std::size_t i=0;i<vertices.size();i++) {
+		std::string scalar;
+		vertices[i]["index"].GetScalar(scalar);
+		ints.push_back(scalar);
+		for(std::size_t j=0;j<3;j++) {
+			vertices[i]["pos"][j].GetScalar(scalar);
+			floats.push_back(scalar);
+		}
+	}
+
+	const int passes = 5;
+	std::vector<float> streamFloats(floats.size()), convertFloats(floats.size());
+	std::vector<int> streamInts(ints.size()), convertInts(ints.size());
+
+	std::clock_t start = std::clock();
+	for(int pass=0;pass<passes;pass++) {
+		for(std::size_t i=0;i<floats.size();i++)
+			StreamConvert(floats[i], streamFloats[i]);
+		for(std::size_t i=0;i<ints.size();i++)
+			StreamConvert(ints[i], streamInts[i]);
+	}
+	double streamTime = Seconds(start);
+
+	start = std::clock();
+	for(int pass=0;pass<passes;pass++) {
+		for(std::size_t i=0;i<floats.size();i++)
+			YAML::Convert(floats[i], convertFloats[i]);
+		for(std::size_t i=0;i<ints.size();i++)
+			YAML::Convert(ints[i], convertInts[i]);
+	}
+	double convertTime = Seconds(start);
+
+	std::size_t scalars = passes * (floats.size() + ints.size());
+	std::cout << vertexCount << " vertices, " << scalars << " conversions\n";
+	std::cout << "stringstream:  " << streamTime << "s (" << scalars / streamTime / 1e6 << " M scalars/s)\n";
+	std::cout << "YAML::Convert: " << convertTime << "s (" << scalars / convertTime / 1e6 << " M scalars/s)\n";
+	std::cout << "speedup:       " << streamTime / convertTime << "x\n";
+
+	// both passes should have produced exactly the same values
+	if(streamFloats != convertFloats || streamInts != convertInts) {
+		std::cout << "mismatch between conversions!\n";
+		return 1;
+	}
+	return 0;
+}
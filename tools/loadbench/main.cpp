@@ -0,0 +1,479 @@
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "lodepng.h"
+
+#include "yaml-cpp/yaml.h"
+
+#include "model.h"
+#include "texture_cache.h"
+#include "yaml_model_handler.h"
+
+// Times each stage of loading a model, on synthetic grid meshes of growing
+// size, and prints the results as JSON so they can be tracked over time.
+//
+//   loadbench [-r repeats] [-t texture_size] [vertex_count ...]
+//
+// Run it from a directory containing data/ (the build directory works) for
+// the shaders. The synthetic models, texture and texture cache entry are
+// written to a directory of their own under $TMPDIR (or /tmp), which is
+// removed again however the run ends.
+// The texture cache stages time building and then using its entry for the
+// texture, and the cached stages load the model through that entry.
+// The upload stages need a headless EGL context and are null without one.
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    const char *texture_name = "loadbench.png";
+
+    // Everything written goes under scratch_directory. The paths are kept in
+    // fixed buffers so the signal handler can remove them without allocating;
+    // an empty one has nothing to remove.
+    char scratch_directory[256];
+    char texture_file[320];
+    char cache_directory[320];
+    char cache_entry[320];
+    char model_file[320];
+
+    void removeScratch() {
+        const char *files[] = {model_file, cache_entry, texture_file};
+        for (int i=0; i < 3; i++) {
+            if (files[i][0] != '\0') {
+#ifdef _WIN32
+                _unlink(files[i]);
+#else
+                unlink(files[i]);
+#endif
+            }
+        }
+
+        const char *directories[] = {cache_directory, scratch_directory};
+        for (int i=0; i < 2; i++) {
+            if (directories[i][0] != '\0') {
+#ifdef _WIN32
+                _rmdir(directories[i]);
+#else
+                rmdir(directories[i]);
+#endif
+            }
+        }
+    }
+
+    void interrupted(int) {
+        removeScratch();
+        _exit(1);
+    }
+
+    void terminated() {
+        removeScratch();
+        abort();
+    }
+
+    // Make the scratch directory and clean it up on exit, on an uncaught exception and on SIGINT/SIGTERM
+    bool makeScratchDirectory() {
+        const char *temp = getenv("TMPDIR");
+        if (temp == NULL || temp[0] == '\0') {
+            temp = "/tmp";
+        }
+        snprintf(scratch_directory, sizeof(scratch_directory), "%s/loadbench.XXXXXX", temp);
+#ifdef _WIN32
+        if (_mktemp_s(scratch_directory, strlen(scratch_directory) + 1) != 0 || _mkdir(scratch_directory) != 0) {
+#else
+        if (mkdtemp(scratch_directory) == NULL) {
+#endif
+            scratch_directory[0] = '\0';
+            return false;
+        }
+
+        snprintf(cache_directory, sizeof(cache_directory), "%s/cache", scratch_directory);
+        atexit(removeScratch);
+        std::set_terminate(terminated);
+        signal(SIGINT, interrupted);
+        signal(SIGTERM, interrupted);
+        return true;
+    }
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Consumes the parser's events without doing anything, so parsing alone can be timed
+    class NullHandler : public YAML::EventHandler {
+        public:
+            void OnDocumentStart(const YAML::Mark&) {}
+            void OnDocumentEnd() {}
+            void OnNull(const YAML::Mark&, YAML::anchor_t) {}
+            void OnAlias(const YAML::Mark&, YAML::anchor_t) {}
+            void OnScalar(const YAML::Mark&, const std::string&, YAML::anchor_t, const std::string&) {}
+            void OnSequenceStart(const YAML::Mark&, const std::string&, YAML::anchor_t) {}
+            void OnSequenceEnd() {}
+            void OnMapStart(const YAML::Mark&, const std::string&, YAML::anchor_t) {}
+            void OnMapEnd() {}
+    };
+
+    // Passes events on to another handler, adding up the time it spends on them
+    class TimedHandler : public YAML::EventHandler {
+        public:
+            TimedHandler(YAML::EventHandler &handler) : handler(handler), milliseconds(0.0) {}
+
+            void OnDocumentStart(const YAML::Mark& mark) {
+                Clock::time_point start = Clock::now();
+                handler.OnDocumentStart(mark);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnDocumentEnd() {
+                Clock::time_point start = Clock::now();
+                handler.OnDocumentEnd();
+                milliseconds += millisecondsSince(start);
+            }
+            void OnNull(const YAML::Mark& mark, YAML::anchor_t anchor) {
+                Clock::time_point start = Clock::now();
+                handler.OnNull(mark, anchor);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnAlias(const YAML::Mark& mark, YAML::anchor_t anchor) {
+                Clock::time_point start = Clock::now();
+                handler.OnAlias(mark, anchor);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnScalar(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor, const std::string& value) {
+                Clock::time_point start = Clock::now();
+                handler.OnScalar(mark, tag, anchor, value);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnSequenceStart(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor) {
+                Clock::time_point start = Clock::now();
+                handler.OnSequenceStart(mark, tag, anchor);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnSequenceEnd() {
+                Clock::time_point start = Clock::now();
+                handler.OnSequenceEnd();
+                milliseconds += millisecondsSince(start);
+            }
+            void OnMapStart(const YAML::Mark& mark, const std::string& tag, YAML::anchor_t anchor) {
+                Clock::time_point start = Clock::now();
+                handler.OnMapStart(mark, tag, anchor);
+                milliseconds += millisecondsSince(start);
+            }
+            void OnMapEnd() {
+                Clock::time_point start = Clock::now();
+                handler.OnMapEnd();
+                milliseconds += millisecondsSince(start);
+            }
+
+            YAML::EventHandler &handler;
+            double milliseconds;
+    };
+
+    // A model file split into its sections, so each can be parsed on its own
+    typedef struct {
+        size_t vertex_count;
+        size_t index_count;
+        std::string vertices;
+        std::string indices;
+        std::string rest;
+    } SyntheticModel;
+
+    // A rippled grid of about vertex_count vertices with normals and texcoords
+    void makeGrid(size_t vertex_count, SyntheticModel &model) {
+        size_t width = (size_t)sqrt((double)vertex_count);
+        width = width < 2 ? 2 : width;
+        size_t height = vertex_count / width;
+        height = height < 2 ? 2 : height;
+
+        std::ostringstream vertices, indices;
+        vertices << "    vertices:\n";
+        for (size_t y=0; y < height; y++) {
+            for (size_t x=0; x < width; x++) {
+                float u = (float)x / (width-1);
+                float v = (float)y / (height-1);
+                vertices << "        - index  : " << y*width + x << "\n"
+                         << "          pos    : [" << u*2.0f - 1.0f << ", " << 0.1f*sinf(u*20.0f) << ", " << v*2.0f - 1.0f << "]\n"
+                         << "          normal : [0.0, 1.0, 0.0]\n"
+                         << "          tex    : [" << u << ", " << v << "]\n";
+            }
+        }
+
+        indices << "    indices:\n";
+        for (size_t y=0; y+1 < height; y++) {
+            for (size_t x=0; x+1 < width; x++) {
+                size_t i = y*width + x;
+                indices << "        - [" << i << ", " << i+width << ", " << i+1 << "]\n"
+                        << "        - [" << i+1 << ", " << i+width << ", " << i+width+1 << "]\n";
+            }
+        }
+
+        model.vertex_count = width*height;
+        model.index_count = (width-1)*(height-1)*6;
+        model.vertices = vertices.str();
+        model.indices = indices.str();
+        model.rest = std::string("    textures:\n        - \"") + texture_name + "\"\n";
+    }
+
+    // A noisy gradient, so the PNG doesn't compress down to nothing
+    bool writeTexture(unsigned size) {
+        std::vector<unsigned char> image(size*size*4);
+        unsigned seed = 1;
+        for (unsigned i=0; i < size*size; i++) {
+            seed = seed*1103515245 + 12345;
+            image[i*4+0] = (unsigned char)(i % size);
+            image[i*4+1] = (unsigned char)(i / size);
+            image[i*4+2] = (unsigned char)(seed >> 16);
+            image[i*4+3] = 255;
+        }
+        return LodePNG_encode32_file(texture_file, &image[0], size, size) == 0;
+    }
+
+    // Parse a document, either just for the events or into a model
+    void parseDocument(const std::string &document, YAML::EventHandler &handler) {
+        std::istringstream stream(document);
+        YAML::Parser parser(stream);
+        parser.HandleNextDocument(handler);
+    }
+
+    // Time how long the model handler spends turning one section of the
+    // model file into vertices/indices, leaving out the parsing itself
+    double extractTime(const std::string &section) {
+        Model model;
+        YAMLModelHandler model_handler(model);
+        TimedHandler timed_handler(model_handler);
+        parseDocument("mesh:\n" + section, timed_handler);
+        return timed_handler.milliseconds;
+    }
+
+#ifdef HAVE_EGL
+    // Make a GL 3.2 core context with no window, using Mesa's surfaceless platform if it's there
+    bool createHeadlessContext() {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+        if (getPlatformDisplay != NULL) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+#endif
+        if (display == EGL_NO_DISPLAY) {
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+            return false;
+        }
+
+        EGLint config_attributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+        EGLConfig config = NULL;
+        EGLint config_count = 0;
+        eglChooseConfig(display, config_attributes, &config, 1, &config_count);
+
+        EGLint context_attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 2,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext context = eglCreateContext(display, config_count > 0 ? config : NULL, EGL_NO_CONTEXT, context_attributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            return false;
+        }
+
+        // Core profiles need glewExperimental, and glewInit leaves an error behind
+        glewExperimental = GL_TRUE;
+        if (glewInit() != GLEW_OK) {
+            return false;
+        }
+        glGetError();
+        return true;
+    }
+#else
+    bool createHeadlessContext() {
+        return false;
+    }
+#endif
+}
+
+int main(int argc, char **argv) {
+
+    int repeats = 1;
+    unsigned texture_size = 1024;
+    std::vector<size_t> vertex_counts;
+
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+            texture_size = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            vertex_counts.push_back(strtoul(argv[i], NULL, 10));
+        } else {
+            std::cout << "Usage: loadbench [-r repeats] [-t texture_size] [vertex_count ...]" << std::endl;
+            return 1;
+        }
+    }
+    repeats = repeats < 1 ? 1 : repeats;
+
+    if (vertex_counts.empty()) {
+        vertex_counts.push_back(1000);
+        vertex_counts.push_back(10000);
+        vertex_counts.push_back(100000);
+        vertex_counts.push_back(1000000);
+    }
+
+    if (!makeScratchDirectory()) {
+        std::cout << "Error: unable to make a directory for the test files" << std::endl;
+        return 1;
+    }
+
+    snprintf(texture_file, sizeof(texture_file), "%s/%s", scratch_directory, texture_name);
+    if (!writeTexture(texture_size)) {
+        std::cout << "Error: unable to write " << texture_file << std::endl;
+        return 1;
+    }
+    snprintf(cache_entry, sizeof(cache_entry), "%s", TextureCache(cache_directory).entryPath(texture_file).c_str());
+
+    bool have_gl = createHeadlessContext();
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"model_load\",\n"
+              << "  \"repeats\": " << repeats << ",\n"
+              << "  \"texture_size\": " << texture_size << ",\n"
+              << "  \"headless_gl\": " << (have_gl ? "true" : "false") << ",\n"
+              << "  \"results\": [\n";
+
+    for (size_t s=0; s < vertex_counts.size(); s++) {
+        SyntheticModel synthetic;
+        makeGrid(vertex_counts[s], synthetic);
+
+        snprintf(model_file, sizeof(model_file), "%s/loadbench_%lu.yml", scratch_directory, (unsigned long)vertex_counts[s]);
+        std::string document = "mesh:\n" + synthetic.vertices + synthetic.indices + synthetic.rest;
+        std::ofstream(model_file, std::ios::out | std::ios::binary) << document;
+
+        // Keep the fastest run of each stage, it's the least disturbed by everything else
+        double file_read = 0.0, yaml_parse = 0.0, vertex_extract = 0.0, index_extract = 0.0;
+        double texture_decode = 0.0, model_read = 0.0, upload = 0.0;
+        double cache_build = 0.0, cache_load = 0.0, cached_model_read = 0.0, cached_upload = 0.0;
+
+        for (int r=0; r < repeats; r++) {
+            Clock::time_point start = Clock::now();
+            std::ifstream file(model_file, std::ios::in | std::ios::binary);
+            std::ostringstream contents;
+            contents << file.rdbuf();
+            double time = millisecondsSince(start);
+            file_read = (r == 0 || time < file_read) ? time : file_read;
+
+            start = Clock::now();
+            NullHandler null_handler;
+            parseDocument(contents.str(), null_handler);
+            time = millisecondsSince(start);
+            yaml_parse = (r == 0 || time < yaml_parse) ? time : yaml_parse;
+
+            time = extractTime(synthetic.vertices);
+            vertex_extract = (r == 0 || time < vertex_extract) ? time : vertex_extract;
+
+            time = extractTime(synthetic.indices);
+            index_extract = (r == 0 || time < index_extract) ? time : index_extract;
+
+            start = Clock::now();
+            TextureImage image;
+            decodeTexture(texture_file, image);
+            time = millisecondsSince(start);
+            texture_decode = (r == 0 || time < texture_decode) ? time : texture_decode;
+
+            // Decoding and building the mip levels once, then mapping the entry
+            TextureCache texture_cache(cache_directory);
+            MappedFile entry_file;
+            remove(cache_entry);
+            start = Clock::now();
+            texture_cache.load(texture_file, image, entry_file);
+            time = millisecondsSince(start);
+            cache_build = (r == 0 || time < cache_build) ? time : cache_build;
+
+            start = Clock::now();
+            texture_cache.load(texture_file, image, entry_file);
+            time = millisecondsSince(start);
+            cache_load = (r == 0 || time < cache_load) ? time : cache_load;
+            entry_file.close();
+
+            // The whole CPU side, as the model loader runs it
+            start = Clock::now();
+            Model model;
+            model.texture_directory = std::string(scratch_directory) + "/";
+            model.cache_textures = false;
+            model.read(model_file);
+            time = millisecondsSince(start);
+            model_read = (r == 0 || time < model_read) ? time : model_read;
+
+            start = Clock::now();
+            Model cached_model;
+            cached_model.texture_directory = std::string(scratch_directory) + "/";
+            cached_model.texture_cache_directory = std::string(cache_directory) + "/";
+            cached_model.read(model_file);
+            time = millisecondsSince(start);
+            cached_model_read = (r == 0 || time < cached_model_read) ? time : cached_model_read;
+
+            if (have_gl) {
+                start = Clock::now();
+                model.upload();
+                glFinish();
+                time = millisecondsSince(start);
+                upload = (r == 0 || time < upload) ? time : upload;
+
+                start = Clock::now();
+                cached_model.upload();
+                glFinish();
+                time = millisecondsSince(start);
+                cached_upload = (r == 0 || time < cached_upload) ? time : cached_upload;
+            }
+        }
+
+        remove(model_file);
+        model_file[0] = '\0';
+
+        std::cout << "    {\n"
+                  << "      \"vertices\": " << synthetic.vertex_count << ",\n"
+                  << "      \"indices\": " << synthetic.index_count << ",\n"
+                  << "      \"file_bytes\": " << document.size() << ",\n"
+                  << "      \"file_read_ms\": " << file_read << ",\n"
+                  << "      \"yaml_parse_ms\": " << yaml_parse << ",\n"
+                  << "      \"vertex_extract_ms\": " << vertex_extract << ",\n"
+                  << "      \"index_extract_ms\": " << index_extract << ",\n"
+                  << "      \"texture_decode_ms\": " << texture_decode << ",\n"
+                  << "      \"texture_cache_build_ms\": " << cache_build << ",\n"
+                  << "      \"texture_cache_load_ms\": " << cache_load << ",\n"
+                  << "      \"model_read_ms\": " << model_read << ",\n"
+                  << "      \"cached_model_read_ms\": " << cached_model_read << ",\n";
+        if (have_gl) {
+            std::cout << "      \"upload_ms\": " << upload << ",\n"
+                      << "      \"cached_upload_ms\": " << cached_upload;
+        } else {
+            std::cout << "      \"upload_ms\": null,\n"
+                      << "      \"cached_upload_ms\": null";
+        }
+        std::cout << "\n    }" << (s+1 < vertex_counts.size() ? "," : "") << "\n";
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,386 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lodepng.h"
+
+// Measures how fast PNGs decode and encode, and prints the results as JSON.
+//
+//   pngbench [-r repeats] [-s synthetic_size] [-i] [-e threads] [file.png ...]
+//
+// Each image is decoded:
+// - with and without SIMD unfiltering, checking both give the same pixels
+// - with the CRC and Adler-32 checks skipped, as for trusted assets
+// - to RGBA, with and without the SIMD colour conversions
+// - to RGBA a block at a time, as if streamed from a file
+// - to 16-bit RGBA whole, into padded rows and streamed, checking all three agree
+// With -e each image is also encoded:
+// - at the fast, default and max levels on one thread
+// - at the default level on the given number of threads (0 for one per core)
+// - at the fast level with the scalar scanline filters
+//
+// The images are the files named (or the textures in data/images/) and
+// synthetic RGBA, RGB and grey+alpha images of the given size, Adam7
+// interlaced with -i.
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    typedef struct {
+        std::string name;
+        std::vector<unsigned char> png;
+    } BenchImage;
+
+    // Smooth gradients with some noise and hard edges, so the encoder picks a mix of filters
+    bool makeImage(unsigned size, unsigned channels, bool interlace, BenchImage &image) {
+        std::vector<unsigned char> pixels(size*size*channels);
+        unsigned seed = 1;
+        for (unsigned y=0; y < size; y++) {
+            for (unsigned x=0; x < size; x++) {
+                seed = seed*1103515245 + 12345;
+                unsigned char *pixel = &pixels[(y*size + x)*channels];
+                pixel[0] = (unsigned char)(x + (seed >> 28));
+                pixel[1] = (unsigned char)(y ^ x);
+                if (channels >= 3) {
+                    pixel[2] = (unsigned char)((x/64 + y/64) % 2 ? 200 : (seed >> 16));
+                }
+                if (channels == 4) {
+                    pixel[3] = (unsigned char)(255 - y);
+                }
+            }
+        }
+
+        unsigned char *png = NULL;
+        size_t png_size = 0;
+        LodePNG_Encoder encoder;
+        LodePNG_Encoder_init(&encoder);
+        encoder.infoRaw.color.colorType = encoder.infoPng.color.colorType = channels == 4 ? 6 : (channels == 3 ? 2 : 4);
+        encoder.infoPng.interlaceMethod = interlace ? 1 : 0;
+        LodePNG_Encoder_encode(&encoder, &png, &png_size, &pixels[0], size, size);
+        unsigned error = encoder.error;
+        LodePNG_Encoder_cleanup(&encoder);
+        if (error) {
+            std::cout << "Error: " << LodePNG_error_text(error) << std::endl;
+            return false;
+        }
+
+        char name[64];
+        sprintf(name, "synthetic_%s_%u%s", channels == 4 ? "rgba" : (channels == 3 ? "rgb" : "grey_alpha"), size, interlace ? "_adam7" : "");
+        image.name = name;
+        image.png.assign(png, png + png_size);
+        free(png);
+        return true;
+    }
+
+    bool loadImage(const char *filename, BenchImage &image) {
+        unsigned char *png = NULL;
+        size_t png_size = 0;
+        if (LodePNG_loadFile(&png, &png_size, filename) || png_size == 0) {
+            free(png);
+            std::cout << "Error: unable to read " << filename << std::endl;
+            return false;
+        }
+        image.name = filename;
+        image.png.assign(png, png + png_size);
+        free(png);
+        return true;
+    }
+
+    // Decode in the PNG's own colour type, so only the decoder itself gets timed,
+    // or to 8-bit RGBA, which adds the colour conversion
+    double decodeTime(const BenchImage &image, bool simd, bool verify_checksums, bool rgba, std::vector<unsigned char> &pixels, LodePNG::Decoder &decoder) {
+        decoder.getSettings().simd = simd;
+        decoder.getSettings().color_convert = rgba;
+        decoder.getSettings().ignoreCrc = !verify_checksums;
+        decoder.getSettings().zlibsettings.ignoreAdler32 = !verify_checksums;
+
+        // decode() appends to the vector
+        pixels.clear();
+        Clock::time_point start = Clock::now();
+        decoder.decode(pixels, image.png);
+        return millisecondsSince(start);
+    }
+
+    // Encode the decoded pixels again in the PNG's own colour type at the given
+    // compression level on the given number of threads, filtering the scanlines with
+    // or without SIMD, and check that they decode back to the same pixels
+    double encodeTime(const std::vector<unsigned char> &pixels, const LodePNG_InfoPng &info, unsigned level, unsigned threads, bool simd, size_t &bytes, bool &match) {
+        LodePNG::Encoder encoder;
+        LodePNG_InfoColor_copy(&encoder.getInfoPng().color, &info.color);
+        LodePNG_InfoColor_copy(&encoder.getInfoRaw().color, &info.color);
+        encoder.getSettings().autoLeaveOutAlphaChannel = 0;
+        encoder.getSettings().zlibsettings.level = level;
+        encoder.getSettings().zlibsettings.threads = threads;
+        encoder.getSettings().simd = simd;
+
+        std::vector<unsigned char> png;
+        Clock::time_point start = Clock::now();
+        encoder.encode(png, pixels, info.width, info.height);
+        double time = millisecondsSince(start);
+        bytes = png.size();
+
+        LodePNG::Decoder decoder;
+        decoder.getSettings().color_convert = 0;
+        std::vector<unsigned char> decoded;
+        decoder.decode(decoded, png);
+        match = !encoder.hasError() && !decoder.hasError() && decoded == pixels;
+        return time;
+    }
+
+    // The size of the reads streamTime pretends to do
+    const size_t stream_block = 65536;
+
+    // Where the streamed rows go, and when the first preview of an interlaced image came
+    typedef struct {
+        std::vector<unsigned char> *pixels;
+        size_t stride;
+        Clock::time_point start;
+        double preview;
+    } StreamRows;
+
+    void allocateRows(void *user, LodePNG_Decoder *decoder) {
+        StreamRows *rows = (StreamRows*)user;
+        rows->stride = (size_t)decoder->infoPng.width * LodePNG_InfoColor_getBpp(&decoder->infoRaw.color) / 8;
+        rows->pixels->resize(rows->stride * decoder->infoPng.height);
+    }
+
+    void storeRow(void *user, unsigned y, const unsigned char *row, size_t size) {
+        StreamRows *rows = (StreamRows*)user;
+        memcpy(&(*rows->pixels)[y*rows->stride], row, size);
+    }
+
+    void firstPreview(void *user, unsigned, const unsigned char*, unsigned, unsigned) {
+        StreamRows *rows = (StreamRows*)user;
+        if (rows->preview < 0.0) {
+            rows->preview = millisecondsSince(rows->start);
+        }
+    }
+
+    // Decode to 8-bit RGBA, giving the decoder stream_block bytes of the PNG at a
+    // time. preview is how long the first preview took, or -1 without interlacing.
+    double streamTime(const BenchImage &image, std::vector<unsigned char> &pixels, double &preview, LodePNG::Decoder &decoder) {
+        decoder.getSettings().simd = true;
+        decoder.getSettings().color_convert = true;
+        decoder.getSettings().ignoreCrc = false;
+        decoder.getSettings().zlibsettings.ignoreAdler32 = false;
+
+        StreamRows rows = {&pixels, 0, Clock::time_point(), -1.0};
+        LodePNG_StreamCallbacks callbacks = {&rows, allocateRows, storeRow, firstPreview};
+
+        Clock::time_point start = Clock::now();
+        rows.start = start;
+        decoder.streamBegin(callbacks);
+        for (size_t offset=0; offset < image.png.size() && !decoder.hasError(); offset += stream_block) {
+            size_t size = image.png.size() - offset < stream_block ? image.png.size() - offset : stream_block;
+            decoder.streamPush(&image.png[offset], size);
+        }
+        decoder.streamEnd();
+        preview = rows.preview;
+        return millisecondsSince(start);
+    }
+
+    // Decode to 16-bit RGBA with decode(), with decodeInto() into padded rows and
+    // streamed, and check they agree. decode() converts the colours of the whole
+    // image at once and the other two a row at a time.
+    bool conversionsMatch(const BenchImage &image) {
+        LodePNG::Decoder decoder;
+        decoder.getSettings().color_convert = true;
+        decoder.getInfoRaw().color.colorType = 6;
+        decoder.getInfoRaw().color.bitDepth = 16;
+
+        std::vector<unsigned char> whole;
+        decoder.decode(whole, image.png);
+        if (decoder.hasError()) {
+            return false;
+        }
+
+        size_t row_size = (size_t)decoder.getWidth() * 8;
+        size_t stride = row_size + 16;
+        unsigned height = decoder.getHeight();
+        std::vector<unsigned char> padded(stride * height);
+        decoder.decodeInto(&padded[0], stride, padded.size(), &image.png[0], image.png.size());
+        if (decoder.hasError()) {
+            return false;
+        }
+        for (unsigned y=0; y < height; y++) {
+            if (memcmp(&padded[y*stride], &whole[y*row_size], row_size) != 0) {
+                return false;
+            }
+        }
+
+        std::vector<unsigned char> streamed;
+        StreamRows rows = {&streamed, 0, Clock::now(), -1.0};
+        LodePNG_StreamCallbacks callbacks = {&rows, allocateRows, storeRow, NULL};
+        decoder.streamBegin(callbacks);
+        decoder.streamPush(&image.png[0], image.png.size());
+        decoder.streamEnd();
+        return !decoder.hasError() && streamed == whole;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    int repeats = 3;
+    unsigned synthetic_size = 4096;
+    bool interlace = false;
+    int encode_threads = -1;
+    std::vector<const char*> filenames;
+
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+            synthetic_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            interlace = true;
+        } else if (strcmp(argv[i], "-e") == 0 && i+1 < argc) {
+            encode_threads = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            filenames.push_back(argv[i]);
+        } else {
+            std::cout << "Usage: pngbench [-r repeats] [-s synthetic_size] [-i] [-e threads] [file.png ...]" << std::endl;
+            return 1;
+        }
+    }
+    repeats = repeats < 1 ? 1 : repeats;
+    if (encode_threads == 0) {
+        encode_threads = std::thread::hardware_concurrency();
+    }
+
+    if (filenames.empty()) {
+        filenames.push_back("data/images/brick.png");
+        filenames.push_back("data/images/brick_normal.png");
+    }
+
+    std::vector<BenchImage> images;
+    for (size_t i=0; i < filenames.size(); i++) {
+        BenchImage image;
+        if (loadImage(filenames[i], image)) {
+            images.push_back(image);
+        }
+    }
+    if (synthetic_size > 0) {
+        for (unsigned channels=4; channels >= 2; channels--) {
+            BenchImage image;
+            if (makeImage(synthetic_size, channels, interlace, image)) {
+                images.push_back(image);
+            }
+        }
+    }
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"png_decode\",\n"
+              << "  \"repeats\": " << repeats << ",\n";
+    if (encode_threads > 0) {
+        std::cout << "  \"encode_threads\": " << encode_threads << ",\n";
+    }
+    std::cout
+              << "  \"results\": [\n";
+
+    bool all_match = true;
+    for (size_t i=0; i < images.size(); i++) {
+        LodePNG::Decoder decoder;
+        std::vector<unsigned char> scalar_pixels, simd_pixels, unchecked_pixels;
+        std::vector<unsigned char> rgba_scalar_pixels, rgba_simd_pixels, stream_pixels;
+
+        // Keep the fastest run, it's the least disturbed by everything else
+        double scalar = 0.0, simd = 0.0, unchecked = 0.0, rgba_scalar = 0.0, rgba_simd = 0.0, stream = 0.0, preview = -1.0;
+        // Encoding at the fast, default and max levels, the default on encode_threads,
+        // then the fast level again with scalar filtering
+        double encode[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+        size_t encode_bytes[5] = {0, 0, 0, 0, 0};
+        bool encode_match = true;
+        for (int r=0; r < repeats; r++) {
+            double time = decodeTime(images[i], false, true, false, scalar_pixels, decoder);
+            scalar = (r == 0 || time < scalar) ? time : scalar;
+
+            time = decodeTime(images[i], true, true, false, simd_pixels, decoder);
+            simd = (r == 0 || time < simd) ? time : simd;
+            if (decoder.hasError()) {
+                break;
+            }
+
+            time = decodeTime(images[i], true, false, false, unchecked_pixels, decoder);
+            unchecked = (r == 0 || time < unchecked) ? time : unchecked;
+
+            time = decodeTime(images[i], false, true, true, rgba_scalar_pixels, decoder);
+            rgba_scalar = (r == 0 || time < rgba_scalar) ? time : rgba_scalar;
+
+            time = decodeTime(images[i], true, true, true, rgba_simd_pixels, decoder);
+            rgba_simd = (r == 0 || time < rgba_simd) ? time : rgba_simd;
+
+            double preview_time;
+            time = streamTime(images[i], stream_pixels, preview_time, decoder);
+            stream = (r == 0 || time < stream) ? time : stream;
+            preview = (r == 0 || preview_time < preview) ? preview_time : preview;
+            if (decoder.hasError()) {
+                break;
+            }
+
+            for (int e=0; e < 5 && encode_threads > 0; e++) {
+                bool round_trip;
+                unsigned level = e < 3 ? e+1 : (e == 3 ? 2 : 1);
+                unsigned threads = e == 3 ? encode_threads : 1;
+                time = encodeTime(simd_pixels, decoder.getInfoPng(), level, threads, e != 4, encode_bytes[e], round_trip);
+                encode[e] = (r == 0 || time < encode[e]) ? time : encode[e];
+                encode_match = encode_match && round_trip;
+            }
+            // The scalar and SIMD filters must pick the same filters
+            encode_match = encode_match && encode_bytes[4] == encode_bytes[0];
+        }
+
+        if (decoder.hasError()) {
+            std::cout << "Error: " << images[i].name << ": " << LodePNG_error_text(decoder.getError()) << std::endl;
+            return 1;
+        }
+
+        bool match = scalar_pixels == simd_pixels && simd_pixels == unchecked_pixels && rgba_scalar_pixels == rgba_simd_pixels && rgba_simd_pixels == stream_pixels && encode_match &&
+                     conversionsMatch(images[i]);
+        all_match = all_match && match;
+
+        double megabytes = simd_pixels.size() / (1024.0*1024.0);
+        std::cout << "    {\n"
+                  << "      \"image\": \"" << images[i].name << "\",\n"
+                  << "      \"width\": " << decoder.getWidth() << ",\n"
+                  << "      \"height\": " << decoder.getHeight() << ",\n"
+                  << "      \"channels\": " << decoder.getChannels() << ",\n"
+                  << "      \"png_bytes\": " << images[i].png.size() << ",\n"
+                  << "      \"scalar_ms\": " << scalar << ",\n"
+                  << "      \"simd_ms\": " << simd << ",\n"
+                  << "      \"unchecked_ms\": " << unchecked << ",\n"
+                  << "      \"rgba_scalar_ms\": " << rgba_scalar << ",\n"
+                  << "      \"rgba_simd_ms\": " << rgba_simd << ",\n"
+                  << "      \"stream_ms\": " << stream << ",\n";
+        if (preview >= 0.0) {
+            std::cout << "      \"preview_ms\": " << preview << ",\n";
+        } else {
+            std::cout << "      \"preview_ms\": null,\n";
+        }
+        if (encode_threads > 0) {
+            std::cout << "      \"fast_encode_ms\": " << encode[0] << ",\n"
+                      << "      \"fast_encode_bytes\": " << encode_bytes[0] << ",\n"
+                      << "      \"encode_ms\": " << encode[1] << ",\n"
+                      << "      \"encode_bytes\": " << encode_bytes[1] << ",\n"
+                      << "      \"max_encode_ms\": " << encode[2] << ",\n"
+                      << "      \"max_encode_bytes\": " << encode_bytes[2] << ",\n"
+                      << "      \"parallel_encode_ms\": " << encode[3] << ",\n"
+                      << "      \"scalar_filter_encode_ms\": " << encode[4] << ",\n";
+        }
+        std::cout
+                  << "      \"scalar_mb_per_s\": " << megabytes / (scalar / 1000.0) << ",\n"
+                  << "      \"simd_mb_per_s\": " << megabytes / (simd / 1000.0) << ",\n"
+                  << "      \"identical\": " << (match ? "true" : "false") << "\n"
+                  << "    }" << (i+1 < images.size() ? "," : "") << "\n";
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "model.h"
+
+// Converts YAML model files into the binary mesh cache format that
+// Model::fromBinary maps straight into the buffer objects.
+//
+//   yml2mesh [-O] [-S] data/models/cube.yml [data/models/cube.mesh]
+//
+// When no output name is given the ".yml" extension is swapped for ".mesh".
+// -O bakes the vertex cache/fetch optimisation into the output, and -S splits
+// meshes too big for 16-bit indices into sub-meshes.
+int main(int argc, char **argv) {
+
+    bool optimize_mesh = false;
+    bool split_mesh = false;
+    while (argc > 1 && (strcmp(argv[1], "-O") == 0 || strcmp(argv[1], "-S") == 0)) {
+        if (argv[1][1] == 'O') {
+            optimize_mesh = true;
+        } else {
+            split_mesh = true;
+        }
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2 || argc > 3) {
+        std::cout << "Usage: yml2mesh [-O] [-S] <model.yml> [model.mesh]" << std::endl;
+        return 1;
+    }
+
+    std::string input_filename = argv[1];
+    std::string output_filename;
+    if (argc == 3) {
+        output_filename = argv[2];
+    } else {
+        size_t ext_pos = input_filename.rfind('.');
+        output_filename = input_filename.substr(0, ext_pos) + ".mesh";
+    }
+
+    // Only the CPU side of the model gets loaded, so no GL context is needed
+    Model model;
+    model.optimize_mesh = optimize_mesh;
+    model.split_mesh = split_mesh;
+    try {
+        if (!model.readYAML(input_filename.c_str())) {
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: unable to read " << input_filename << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!model.toBinary(output_filename.c_str())) {
+        std::cout << "Error: unable to write " << output_filename << std::endl;
+        return 1;
+    }
+
+    std::cout << input_filename << " -> " << output_filename << " ("
+              << model.vertex_list.size() << " vertices, "
+              << model.index_list.size() << " " << model.index_size*8 << "-bit indices in "
+              << model.draw_ranges.size() << " draw ranges)" << std::endl;
+
+    return 0;
+}